@@ -234,8 +234,10 @@ set(SERVERLIST
     ${ENGINE_DIR}/server/sv_ccmds.cpp
     ${ENGINE_DIR}/server/sv_client.cpp
     ${ENGINE_DIR}/server/sv_init.cpp
+    ${ENGINE_DIR}/server/sv_loadtest.cpp
     ${ENGINE_DIR}/server/sv_main.cpp
     ${ENGINE_DIR}/server/sv_net_chan.cpp
+    ${ENGINE_DIR}/server/sv_profiler.cpp
     ${ENGINE_DIR}/server/sv_sgame.cpp
     ${ENGINE_DIR}/server/sv_snapshot.cpp
     ${ENGINE_DIR}/server/CryptoChallenge.cpp
@@ -295,6 +297,8 @@ endif()
 # Tests runnable for any engine variant
 set(ENGINETESTLIST ${COMMONTESTLIST}
     ${ENGINE_DIR}/framework/CommandSystemTest.cpp
+    ${ENGINE_DIR}/qcommon/msg_test.cpp
+    ${ENGINE_DIR}/server/sv_snapshot_test.cpp
 )
 
 set(QCOMMONLIST
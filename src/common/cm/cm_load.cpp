@@ -36,30 +36,87 @@ Maryland 20850 USA.
 
 #include <common/FileSystem.h>
 
-// to allow boxes to be treated as brush models, we allocate
-// some extra indexes along with those needed by the map
-static const int BOX_LEAF_BRUSHES = 1; // ydnar
-static const int BOX_BRUSHES      = 1;
-static const int BOX_SIDES        = 6;
-static const int BOX_LEAFS        = 2;
-static const int BOX_PLANES       = 12;
-
 #define LL( x ) x = LittleLong( x )
 
-clipMap_t cm;
-int       c_pointcontents;
-int       c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces;
+clipMap_t        cm;
+
+static std::mutex                     cmStatsLock;
+static std::vector<cmThreadStats_t *> cmStatsThreads;
+static cmStats_t                      cmStatsExited; // not yet taken from threads which have exited
 
-static cmodel_t  box_model;
-static cplane_t  *box_planes;
-static cbrush_t  *box_brush;
+thread_local cmThreadStats_t          cmThreadStats;
 
-void      CM_InitBoxHull();
 void      CM_FloodAreaConnections();
+static void CM_PackBrush( cbrush_t *b, float *planes, int *surfaceFlags );
+
+/*
+===================
+boxHull_t
+
+Set up the planes and nodes so that the six floats of a bounding box
+can just be stored out and get a proper clipping hull structure.
+Each thread has its own, so that it can trace against its boxes while
+other threads trace against theirs.
+===================
+*/
+struct boxHull_t
+{
+	cmodel_t     model;
+	cplane_t     planes[ 12 ];
+	cbrushside_t sides[ 6 ];
+	cbrush_t     brush;
+	int          leafBrush;
+
+	alignas(16) float packedPlanes[ 4 * 8 ];
+	int          packedSurfaceFlags[ 8 ];
+
+	boxHull_t(): model(), planes(), sides(), brush(), leafBrush( 0 ), packedPlanes(), packedSurfaceFlags()
+	{
+		brush.numsides = 6;
+		brush.sides = sides;
+		brush.contents = CONTENTS_BODY;
+
+		model.leaf.numLeafBrushes = 1;
+		model.leaf.firstLeafBrush = &leafBrush;
+
+		for ( int i = 0; i < 6; i++ )
+		{
+			int side = i & 1;
+
+			// brush sides
+			sides[ i ].plane = &planes[ i * 2 + side ];
+			sides[ i ].surfaceFlags = 0;
+
+			// planes
+			cplane_t *p = &planes[ i * 2 ];
+			p->type = i >> 1;
+			p->signbits = 0;
+			VectorClear( p->normal );
+			p->normal[ i >> 1 ] = 1;
+
+			p = &planes[ i * 2 + 1 ];
+			p->type = 3 + ( i >> 1 );
+			p->signbits = 0;
+			VectorClear( p->normal );
+			p->normal[ i >> 1 ] = -1;
+
+			SetPlaneSignbits( p );
+		}
+
+		CM_PackBrush( &brush, packedPlanes, packedSurfaceFlags );
+	}
+};
+
+static thread_local boxHull_t boxHull;
 
 Cvar::Cvar<bool> cm_forceTriangles(VM_STRING_PREFIX "cm_forceTriangles", "Convert all patches into triangles?", Cvar::CHEAT | Cvar::ROM, false);
+static Cvar::Cvar<bool> cm_reuseMap(VM_STRING_PREFIX "cm_reuseMap", "keep the collision map in memory to reset it instead of loading it again when the same map is loaded", Cvar::NONE, true);
+static Cvar::Cvar<bool> cm_surfaceCache(VM_STRING_PREFIX "cm_surfaceCache", "save the collision data of the curved and triangle surfaces of the maps in the home path to load them faster the next time", Cvar::NONE, true);
 Log::Logger cmLog(VM_STRING_PREFIX "common.cm");
 
+// identifies the files the current collision map was loaded from, empty if none
+static std::string loadedMapKey;
+
 static std::vector<void*> allocations;
 
 void* CM_Alloc( size_t size )
@@ -195,6 +252,67 @@ static void CMod_LoadSubmodels(const byte *const cmod_base, const lump_t *l)
 	}
 }
 
+/*
+=================
+CM_PackNodes
+
+Copies the nodes in the tree to cm.packedNodes in depth-first order
+=================
+*/
+static void CM_PackNodes()
+{
+	std::vector<int> packedNums( cm.numNodes, -1 );
+	std::vector<int> order;
+	std::vector<int> stack = { 0 };
+
+	order.reserve( cm.numNodes );
+
+	while ( !stack.empty() )
+	{
+		int num = stack.back();
+		stack.pop_back();
+
+		if ( num < 0 || packedNums[ num ] >= 0 )
+		{
+			continue;
+		}
+
+		packedNums[ num ] = order.size();
+		order.push_back( num );
+
+		for ( int j = 1; j >= 0; j-- )
+		{
+			int child = cm.nodes[ num ].children[ j ];
+
+			if ( child >= cm.numNodes )
+			{
+				Sys::Drop( "CM_PackNodes: bad child %i", child );
+			}
+
+			// the first child comes out next
+			stack.push_back( child );
+		}
+	}
+
+	cm.packedNodes = ( cPackedNode_t * ) CM_Alloc( cm.numNodes * sizeof( *cm.packedNodes ) );
+
+	for ( size_t i = 0; i < order.size(); i++ )
+	{
+		const cNode_t &node = cm.nodes[ order[ i ] ];
+		cPackedNode_t &packed = cm.packedNodes[ i ];
+
+		VectorCopy( node.plane->normal, packed.normal );
+		packed.dist = node.plane->dist;
+		packed.type = node.plane->type;
+
+		for ( int j = 0; j < 2; j++ )
+		{
+			int child = node.children[ j ];
+			packed.children[ j ] = child < 0 ? child : packedNums[ child ];
+		}
+	}
+}
+
 /*
 =================
 CMod_LoadNodes
@@ -237,6 +355,8 @@ static void CMod_LoadNodes(const byte *const cmod_base, const lump_t *l)
 			out->children[ j ] = child;
 		}
 	}
+
+	CM_PackNodes();
 }
 
 /*
@@ -257,6 +377,33 @@ void CM_BoundBrush( cbrush_t *b )
 	b->bounds[ 1 ][ 2 ] = b->sides[ 5 ].plane->dist;
 }
 
+/*
+=================
+CM_PackBrush
+
+Copies the planes and surface flags of the sides of a brush into its
+packed arrays, which have room for CM_PackedSides( b->numsides ) sides
+=================
+*/
+static void CM_PackBrush( cbrush_t *b, float *planes, int *surfaceFlags )
+{
+	int stride = CM_PackedSides( b->numsides );
+
+	b->packedPlanes = planes;
+	b->packedSurfaceFlags = surfaceFlags;
+
+	for ( int i = 0; i < stride; i++ )
+	{
+		const cbrushside_t *side = &b->sides[ std::min( i, b->numsides - 1 ) ];
+
+		planes[ i ] = side->plane->normal[ 0 ];
+		planes[ stride + i ] = side->plane->normal[ 1 ];
+		planes[ 2 * stride + i ] = side->plane->normal[ 2 ];
+		planes[ 3 * stride + i ] = side->plane->dist;
+		surfaceFlags[ i ] = side->surfaceFlags;
+	}
+}
+
 /*
 =================
 CMod_LoadBrushes
@@ -279,7 +426,7 @@ static void CMod_LoadBrushes(const byte *const cmod_base, const lump_t *l)
 
 	count = l->filelen / sizeof( *in );
 
-	cm.brushes = ( cbrush_t * ) CM_Alloc( ( BOX_BRUSHES + count ) * sizeof( *cm.brushes ) );
+	cm.brushes = ( cbrush_t * ) CM_Alloc( count * sizeof( *cm.brushes ) );
 	cm.numBrushes = count;
 
 	out = cm.brushes;
@@ -300,6 +447,26 @@ static void CMod_LoadBrushes(const byte *const cmod_base, const lump_t *l)
 
 		CM_BoundBrush( out );
 	}
+
+	// the packed sides of all the brushes, each brush starting 16 bytes aligned
+	int numPacked = 0;
+
+	for ( i = 0; i < count; i++ )
+	{
+		numPacked += CM_PackedSides( cm.brushes[ i ].numsides );
+	}
+
+	// CM_Alloc only has the alignment of calloc, 8 bytes on some 32-bit platforms
+	byte  *block = ( byte * ) CM_Alloc( 4 * numPacked * sizeof( float ) + 15 );
+	float *planes = ( float * )( ( reinterpret_cast<uintptr_t>( block ) + 15 ) & ~uintptr_t( 15 ) );
+	int   *surfaceFlags = ( int * ) CM_Alloc( numPacked * sizeof( int ) );
+
+	for ( i = 0; i < count; i++ )
+	{
+		CM_PackBrush( &cm.brushes[ i ], planes, surfaceFlags );
+		planes += 4 * CM_PackedSides( cm.brushes[ i ].numsides );
+		surfaceFlags += CM_PackedSides( cm.brushes[ i ].numsides );
+	}
 }
 
 /*
@@ -328,7 +495,7 @@ static void CMod_LoadLeafs(const byte *const cmod_base, const lump_t *l)
 		Sys::Drop( "Map with no leafs" );
 	}
 
-	cm.leafs = ( cLeaf_t * ) CM_Alloc( ( BOX_LEAFS + count ) * sizeof( *cm.leafs ) );
+	cm.leafs = ( cLeaf_t * ) CM_Alloc( count * sizeof( *cm.leafs ) );
 	cm.numLeafs = count;
 
 	out = cm.leafs;
@@ -383,7 +550,7 @@ static void CMod_LoadPlanes(const byte *const cmod_base, const lump_t *l)
 		Sys::Drop( "Map with no planes" );
 	}
 
-	cm.planes = ( cplane_t * ) CM_Alloc( ( BOX_PLANES + count ) * sizeof( *cm.planes ) );
+	cm.planes = ( cplane_t * ) CM_Alloc( count * sizeof( *cm.planes ) );
 	cm.numPlanes = count;
 
 	out = cm.planes;
@@ -423,7 +590,7 @@ static void CMod_LoadLeafBrushes(const byte *const cmod_base, const lump_t *l)
 	count = l->filelen / sizeof( *in );
 
 	// ydnar: more than <count> brushes are stored in leafbrushes...
-	cm.leafbrushes = ( int * ) CM_Alloc( ( BOX_LEAF_BRUSHES + count ) * sizeof( *cm.leafbrushes ) );
+	cm.leafbrushes = ( int * ) CM_Alloc( count * sizeof( *cm.leafbrushes ) );
 	cm.numLeafBrushes = count;
 
 	out = cm.leafbrushes;
@@ -489,7 +656,7 @@ static void CMod_LoadBrushSides(const byte *const cmod_base, const lump_t *l)
 
 	count = l->filelen / sizeof( *in );
 
-	cm.brushsides = ( cbrushside_t * ) CM_Alloc( ( BOX_SIDES + count ) * sizeof( *cm.brushsides ) );
+	cm.brushsides = ( cbrushside_t * ) CM_Alloc( count * sizeof( *cm.brushsides ) );
 	cm.numBrushSides = count;
 
 	out = cm.brushsides;
@@ -619,11 +786,15 @@ static void CMod_LoadVisibility(const byte *const cmod_base, const lump_t *l)
 /*
 =================
 CMod_LoadSurfaces
+
+The collision data of the surfaces is taken from cachedCollides, indexed by
+surface number, instead of being generated if it isn't nullptr
 =================
 */
 static const int MAX_PATCH_SIZE  = 64;
 static const int MAX_PATCH_VERTS = ( MAX_PATCH_SIZE * MAX_PATCH_SIZE );
-static void CMod_LoadSurfaces(const byte *const cmod_base, const lump_t *surfs, const lump_t *verts, const lump_t *indexesLump)
+static void CMod_LoadSurfaces(const byte *const cmod_base, const lump_t *surfs, const lump_t *verts, const lump_t *indexesLump,
+                              cSurfaceCollide_t *const *cachedCollides)
 {
 	drawVert_t    *dv, *dv_p;
 	dsurface_t    *in;
@@ -672,6 +843,16 @@ static void CMod_LoadSurfaces(const byte *const cmod_base, const lump_t *surfs,
 			cm.surfaces[ i ] = surface = ( cSurface_t * ) CM_Alloc( sizeof( *surface ) );
 			surface->type = mapSurfaceType_t::MST_PATCH;
 
+			shaderNum = LittleLong( in->shaderNum );
+			surface->contents = cm.shaders[ shaderNum ].contentFlags;
+			surface->surfaceFlags = cm.shaders[ shaderNum ].surfaceFlags;
+
+			if ( cachedCollides )
+			{
+				surface->sc = cachedCollides[ i ];
+				continue;
+			}
+
 			// load the full drawverts onto the stack
 			width = LittleLong( in->patchWidth );
 			height = LittleLong( in->patchHeight );
@@ -691,10 +872,6 @@ static void CMod_LoadSurfaces(const byte *const cmod_base, const lump_t *surfs,
 				vertexes[ j ][ 2 ] = LittleFloat( dv_p->xyz[ 2 ] );
 			}
 
-			shaderNum = LittleLong( in->shaderNum );
-			surface->contents = cm.shaders[ shaderNum ].contentFlags;
-			surface->surfaceFlags = cm.shaders[ shaderNum ].surfaceFlags;
-
 			// create the internal facet structure
 			surface->sc = CM_GeneratePatchCollide( width, height, vertexes );
 		}
@@ -705,6 +882,16 @@ static void CMod_LoadSurfaces(const byte *const cmod_base, const lump_t *surfs,
 			cm.surfaces[ i ] = surface = ( cSurface_t * ) CM_Alloc( sizeof( *surface ) );
 			surface->type = mapSurfaceType_t::MST_TRIANGLE_SOUP;
 
+			shaderNum = LittleLong( in->shaderNum );
+			surface->contents = cm.shaders[ shaderNum ].contentFlags;
+			surface->surfaceFlags = cm.shaders[ shaderNum ].surfaceFlags;
+
+			if ( cachedCollides )
+			{
+				surface->sc = cachedCollides[ i ];
+				continue;
+			}
+
 			// load the full drawverts onto the stack
 			numVertexes = LittleLong( in->numVerts );
 
@@ -741,18 +928,447 @@ static void CMod_LoadSurfaces(const byte *const cmod_base, const lump_t *surfs,
 				}
 			}
 
-			shaderNum = LittleLong( in->shaderNum );
-			surface->contents = cm.shaders[ shaderNum ].contentFlags;
-			surface->surfaceFlags = cm.shaders[ shaderNum ].surfaceFlags;
-
 			// create the internal facet structure
 			surface->sc = CM_GenerateTriangleSoupCollide( numVertexes, vertexes, numIndexes, indexes );
 		}
 	}
 }
 
+/*
+===============================================================================
+
+SURFACE COLLISION CACHE
+
+The planes and facets made for the patches and triangle soups are saved in the
+home path, and the later loads of the same BSP read them instead of generating
+them again. The planes are saved without their hash chain pointer so that the
+engine and the VMs of any architecture share the file.
+
+===============================================================================
+*/
+
+static const char SURFACE_CACHE_IDENT[ 4 ] = { 'C', 'M', 'S', 'C' };
+static const int  SURFACE_CACHE_VERSION = 2;
+
+struct surfaceCacheHeader_t
+{
+	char     ident[ 4 ];
+	int32_t  version;
+	int32_t  facetSize; // the layout of the facets of the build
+	int32_t  padding;
+	uint64_t checksum; // of the BSP
+	int32_t  triangleSoups; // if they have collision data
+	int32_t  numSurfaces; // each followed by its planes and facets
+};
+
+struct surfaceCacheEntry_t
+{
+	int32_t surfaceNum;
+	int32_t numPlanes;
+	int32_t numFacets;
+	vec3_t  bounds[ 2 ];
+};
+
+struct surfaceCachePlane_t
+{
+	vec3_t  normal;
+	float   dist;
+	int32_t signbits;
+};
+
+static_assert( std::is_trivially_copyable<cFacet_t>::value, "the facets are saved as they are in memory" );
+static_assert( sizeof( bool ) == 1, "the bools of the facets are checked as bytes" );
+
+/*
+==================
+CM_SurfaceCachePath
+==================
+*/
+static std::string CM_SurfaceCachePath( Str::StringRef name )
+{
+	return Str::Format( "collisionCache/%s.surfaces", name );
+}
+
+/*
+==================
+CM_BSPChecksum
+
+FNV-1a over 64-bit words, in 4 interleaved streams so that it keeps up with
+the memory
+==================
+*/
+static uint64_t CM_BSPChecksum( const std::string &data )
+{
+	const uint64_t prime = 0x100000001b3ull;
+	uint64_t       hashes[ 4 ] = { 0xcbf29ce484222325ull, 0xcbf29ce484222325ull ^ 1, 0xcbf29ce484222325ull ^ 2, 0xcbf29ce484222325ull ^ 3 };
+	uint64_t       words[ 4 ];
+	size_t         blocks = data.size() / sizeof( words );
+
+	for ( size_t i = 0; i < blocks; i++ )
+	{
+		memcpy( words, data.data() + i * sizeof( words ), sizeof( words ) );
+
+		for ( int j = 0; j < 4; j++ )
+		{
+			hashes[ j ] = ( hashes[ j ] ^ words[ j ] ) * prime;
+		}
+	}
+
+	uint64_t hash = data.size();
+
+	for ( uint64_t h : hashes )
+	{
+		hash = ( hash ^ h ^ ( h >> 32 ) ) * prime;
+	}
+
+	for ( size_t i = blocks * sizeof( words ); i < data.size(); i++ )
+	{
+		hash = ( hash ^ static_cast<byte>( data[ i ] ) ) * prime;
+	}
+
+	return hash;
+}
+
+/*
+==================
+CM_SurfaceHasCollide
+
+If CMod_LoadSurfaces makes collision data for the surface
+==================
+*/
+static bool CM_SurfaceHasCollide( const dsurface_t *in )
+{
+	return LittleLong( in->surfaceType ) == mapSurfaceType_t::MST_PATCH
+	       || ( LittleLong( in->surfaceType ) == mapSurfaceType_t::MST_TRIANGLE_SOUP && ( cm.perPolyCollision || cm_forceTriangles.Get() ) );
+}
+
+/*
+==================
+CM_ReadSurfaceCache
+
+Fills cachedCollides with the collision data of every surface that has some,
+indexed by surface number, if the cache was saved for this BSP
+==================
+*/
+static bool CM_ReadSurfaceCache( Str::StringRef name, uint64_t checksum, const byte *const cmod_base, const lump_t *surfs,
+                                 std::vector<cSurfaceCollide_t *> &cachedCollides )
+{
+	const dsurface_t *in = ( const dsurface_t * )( cmod_base + surfs->fileofs );
+	int              count = surfs->filelen / sizeof( *in );
+	int              numCollides = 0;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		numCollides += CM_SurfaceHasCollide( in + i );
+	}
+
+	if ( !numCollides )
+	{
+		return false;
+	}
+
+	std::string path = CM_SurfaceCachePath( name );
+	std::error_code err;
+	FS::File file = FS::HomePath::OpenRead( path, err );
+	std::string data;
+
+	if ( !err )
+	{
+		data = file.ReadAll( err );
+	}
+
+	if ( err )
+	{
+		cmLog.Debug( "No surface collision cache %s: %s", path, err.message() );
+		return false;
+	}
+
+	surfaceCacheHeader_t header;
+
+	if ( data.size() < sizeof( header ) )
+	{
+		cmLog.Warn( "Ignoring the truncated surface collision cache %s", path );
+		return false;
+	}
+
+	memcpy( &header, data.data(), sizeof( header ) );
+
+	if ( memcmp( header.ident, SURFACE_CACHE_IDENT, sizeof( header.ident ) ) || header.version != SURFACE_CACHE_VERSION
+	     || header.facetSize != sizeof( cFacet_t )
+	     || header.checksum != checksum || header.triangleSoups != ( cm.perPolyCollision || cm_forceTriangles.Get() )
+	     || header.numSurfaces != numCollides )
+	{
+		cmLog.Debug( "The surface collision cache %s is outdated", path );
+		return false;
+	}
+
+	// everything is checked before allocating, as the memory isn't freed until the next map
+	std::vector<surfaceCacheEntry_t> entries( numCollides );
+	std::vector<size_t>              entryOffsets( numCollides );
+	std::vector<bool>                cached( count, false );
+	size_t                           offset = sizeof( header );
+	int                              totalPlanes = 0, totalFacets = 0;
+	bool                             valid = true;
+
+	for ( int n = 0; valid && n < numCollides; n++ )
+	{
+		surfaceCacheEntry_t &entry = entries[ n ];
+
+		if ( data.size() - offset < sizeof( entry ) )
+		{
+			valid = false;
+			break;
+		}
+
+		memcpy( &entry, data.data() + offset, sizeof( entry ) );
+		offset += sizeof( entry );
+		entryOffsets[ n ] = offset;
+
+		if ( entry.surfaceNum < 0 || entry.surfaceNum >= count || cached[ entry.surfaceNum ]
+		     || !CM_SurfaceHasCollide( in + entry.surfaceNum ) || entry.numPlanes < 0 || entry.numFacets < 0
+		     || static_cast<size_t>( entry.numPlanes ) > ( data.size() - offset ) / sizeof( surfaceCachePlane_t ) )
+		{
+			valid = false;
+			break;
+		}
+
+		offset += entry.numPlanes * sizeof( surfaceCachePlane_t );
+
+		if ( static_cast<size_t>( entry.numFacets ) > ( data.size() - offset ) / sizeof( cFacet_t ) )
+		{
+			valid = false;
+			break;
+		}
+
+		// the traces take the plane numbers as they are, and the bools must be
+		// checked before they are copied as such
+		for ( int i = 0; valid && i < entry.numFacets; i++ )
+		{
+			const byte *raw = ( const byte * ) data.data() + offset + i * sizeof( cFacet_t );
+
+			for ( int j = 0; valid && j < MAX_FACET_BEVELS; j++ )
+			{
+				valid = raw[ offsetof( cFacet_t, borderInward ) + j ] <= 1;
+			}
+
+			if ( !valid )
+			{
+				break;
+			}
+
+			cFacet_t facet;
+			memcpy( &facet, raw, sizeof( facet ) );
+			valid = facet.surfacePlane >= 0 && facet.surfacePlane < entry.numPlanes
+			        && facet.numBorders >= 0 && facet.numBorders <= MAX_FACET_BEVELS;
+
+			for ( int j = 0; valid && j < facet.numBorders; j++ )
+			{
+				valid = facet.borderPlanes[ j ] >= 0 && facet.borderPlanes[ j ] < entry.numPlanes;
+			}
+		}
+
+		offset += entry.numFacets * sizeof( cFacet_t );
+		cached[ entry.surfaceNum ] = true;
+		totalPlanes += entry.numPlanes;
+		totalFacets += entry.numFacets;
+	}
+
+	if ( !valid || offset != data.size() )
+	{
+		cmLog.Warn( "Ignoring the invalid surface collision cache %s", path );
+		return false;
+	}
+
+	cSurfaceCollide_t *collides = ( cSurfaceCollide_t * ) CM_Alloc( numCollides * sizeof( *collides ) );
+	cPlane_t          *planes = ( cPlane_t * ) CM_Alloc( totalPlanes * sizeof( *planes ) );
+	cFacet_t          *facets = ( cFacet_t * ) CM_Alloc( totalFacets * sizeof( *facets ) );
+
+	cachedCollides.assign( count, nullptr );
+
+	for ( int n = 0; n < numCollides; n++ )
+	{
+		const surfaceCacheEntry_t &entry = entries[ n ];
+		cSurfaceCollide_t         *sc = &collides[ n ];
+		const char                *src = data.data() + entryOffsets[ n ];
+
+		sc->numPlanes = entry.numPlanes;
+		sc->planes = planes;
+		sc->numFacets = entry.numFacets;
+		sc->facets = facets;
+		VectorCopy( entry.bounds[ 0 ], sc->bounds[ 0 ] );
+		VectorCopy( entry.bounds[ 1 ], sc->bounds[ 1 ] );
+
+		for ( int i = 0; i < entry.numPlanes; i++ )
+		{
+			surfaceCachePlane_t plane;
+			memcpy( &plane, src, sizeof( plane ) );
+			src += sizeof( plane );
+
+			VectorCopy( plane.normal, planes[ i ].plane.normal );
+			planes[ i ].plane.dist = plane.dist;
+			planes[ i ].signbits = plane.signbits;
+			planes[ i ].hashChain = nullptr;
+		}
+
+		memcpy( facets, src, entry.numFacets * sizeof( cFacet_t ) );
+
+		planes += entry.numPlanes;
+		facets += entry.numFacets;
+		cachedCollides[ entry.surfaceNum ] = sc;
+	}
+
+	cmLog.Debug( "Loaded the surface collision cache %s", path );
+	return true;
+}
+
+/*
+==================
+CM_WriteSurfaceCache
+==================
+*/
+static void CM_WriteSurfaceCache( Str::StringRef name, uint64_t checksum )
+{
+	surfaceCacheHeader_t header{};
+	std::string          data( sizeof( header ), '\0' );
+
+	memcpy( header.ident, SURFACE_CACHE_IDENT, sizeof( header.ident ) );
+	header.version = SURFACE_CACHE_VERSION;
+	header.facetSize = sizeof( cFacet_t );
+	header.checksum = checksum;
+	header.triangleSoups = cm.perPolyCollision || cm_forceTriangles.Get();
+
+	for ( int i = 0; i < cm.numSurfaces; i++ )
+	{
+		const cSurface_t *surface = cm.surfaces[ i ];
+
+		if ( !surface )
+		{
+			continue;
+		}
+
+		const cSurfaceCollide_t *sc = surface->sc;
+		surfaceCacheEntry_t     entry{};
+
+		entry.surfaceNum = i;
+		entry.numPlanes = sc->numPlanes;
+		entry.numFacets = sc->numFacets;
+		VectorCopy( sc->bounds[ 0 ], entry.bounds[ 0 ] );
+		VectorCopy( sc->bounds[ 1 ], entry.bounds[ 1 ] );
+		data.append( ( const char * ) &entry, sizeof( entry ) );
+
+		for ( int j = 0; j < sc->numPlanes; j++ )
+		{
+			surfaceCachePlane_t plane;
+			VectorCopy( sc->planes[ j ].plane.normal, plane.normal );
+			plane.dist = sc->planes[ j ].plane.dist;
+			plane.signbits = sc->planes[ j ].signbits;
+			data.append( ( const char * ) &plane, sizeof( plane ) );
+		}
+
+		data.append( ( const char * ) sc->facets, sc->numFacets * sizeof( cFacet_t ) );
+		header.numSurfaces++;
+	}
+
+	if ( !header.numSurfaces )
+	{
+		return;
+	}
+
+	memcpy( &data[ 0 ], &header, sizeof( header ) );
+
+	// written under another name first so that no load reads half of it, one
+	// which other processes saving the same map don't write to at the same time
+	uint32_t suffix;
+	Sys::GenRandomBytes( &suffix, sizeof( suffix ) );
+
+	std::string path = CM_SurfaceCachePath( name );
+	std::string tempPath = Str::Format( "%s.%08x.tmp", path, suffix );
+	std::error_code err;
+	FS::File file = FS::HomePath::OpenWrite( tempPath, err );
+
+	if ( !err )
+	{
+		file.Write( data.data(), data.size(), err );
+	}
+
+	if ( !err )
+	{
+		file.Close( err );
+	}
+
+	if ( !err )
+	{
+		FS::HomePath::MoveFile( path, tempPath, err );
+	}
+
+	if ( err )
+	{
+		std::error_code ignored;
+		file = FS::File();
+		FS::HomePath::DeleteFile( tempPath, ignored );
+		cmLog.Warn( "Couldn't save the surface collision cache %s: %s", path, err.message() );
+		return;
+	}
+
+	cmLog.Debug( "Saved the surface collision cache %s", path );
+}
+
 //==================================================================
 
+/*
+==================
+CM_MapKey
+
+Identifies the pak and the version of the files of a map
+==================
+*/
+static std::string CM_MapKey( Str::StringRef name )
+{
+	std::string key = name;
+
+	if ( cm_forceTriangles.Get() )
+	{
+		key += " triangles";
+	}
+
+	for ( const std::string &path : { "maps/" + name + ".bsp", "maps/" + name + ".ent" } )
+	{
+		const FS::LoadedPakInfo *pak = FS::PakPath::LocateFile( path );
+
+		if ( !pak )
+		{
+			key += " -";
+		}
+		else if ( pak->realChecksum )
+		{
+			key += Str::Format( " %s:%08x", pak->path, *pak->realChecksum );
+		}
+		else
+		{
+			// directory paks have no checksum, their files may change at any time
+			std::error_code err;
+			auto timestamp = FS::PakPath::FileTimestamp( path, err );
+			key += Str::Format( " %s:%d", pak->path, timestamp.time_since_epoch().count() );
+		}
+	}
+
+	return key;
+}
+
+/*
+==================
+CM_ResetMap
+
+Puts a map that is loaded again back in its state right after loading
+==================
+*/
+static void CM_ResetMap()
+{
+	// the game opens the area portals again when it starts
+	memset( cm.areaPortals, 0, cm.numAreas * cm.numAreas * sizeof( *cm.areaPortals ) );
+	CM_FloodAreaConnections();
+}
+
 /*
 ==================
 CM_LoadMap
@@ -766,6 +1382,18 @@ void CM_LoadMap(Str::StringRef name)
 
 	cmLog.Debug( "CM_LoadMap(%s)", name);
 
+	std::string mapKey = CM_MapKey( name );
+
+	if ( cm_reuseMap.Get() && name[ 0 ] && mapKey == loadedMapKey )
+	{
+		cmLog.Debug( "Reusing the collision map of %s", name );
+		CM_ResetMap();
+		return;
+	}
+
+	// clear collision map data
+	CM_ClearMap();
+
 	std::string mapFile = "maps/" + name + ".bsp";
 
 	std::error_code err;
@@ -785,9 +1413,6 @@ void CM_LoadMap(Str::StringRef name)
 		externalEntities = "";
 	}
 
-	// clear collision map data
-	CM_ClearMap();
-
 	if ( !name[ 0 ] )
 	{
 		cm.numLeafs = 1;
@@ -824,12 +1449,74 @@ void CM_LoadMap(Str::StringRef name)
 	CMod_LoadNodes(cmod_base, &header.lumps[LUMP_NODES]);
 	CMod_LoadEntityString(cmod_base, &header.lumps[LUMP_ENTITIES], externalEntities);
 	CMod_LoadVisibility(cmod_base, &header.lumps[LUMP_VISIBILITY]);
+
+	// the generated collision data of the surfaces only depends on the BSP
+	std::vector<cSurfaceCollide_t *> cachedCollides;
+	uint64_t checksum = 0;
+	bool     cached = false;
+
+	if ( cm_surfaceCache.Get() )
+	{
+		checksum = CM_BSPChecksum( mapData );
+		cached = CM_ReadSurfaceCache( name, checksum, cmod_base, &header.lumps[ LUMP_SURFACES ], cachedCollides );
+	}
+
 	CMod_LoadSurfaces(cmod_base,
-					  &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS], &header.lumps[LUMP_DRAWINDEXES]);
+					  &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS], &header.lumps[LUMP_DRAWINDEXES],
+					  cached ? cachedCollides.data() : nullptr);
 
-	CM_InitBoxHull();
+	if ( cm_surfaceCache.Get() && !cached )
+	{
+		CM_WriteSurfaceCache( name, checksum );
+	}
 
 	CM_FloodAreaConnections();
+
+	loadedMapKey = std::move( mapKey );
+}
+
+cmThreadStats_t::cmThreadStats_t() : counts(), taken()
+{
+	std::lock_guard<std::mutex> lock( cmStatsLock );
+	cmStatsThreads.push_back( this );
+}
+
+cmThreadStats_t::~cmThreadStats_t()
+{
+	std::lock_guard<std::mutex> lock( cmStatsLock );
+
+	for ( int i = 0; i < Util::ordinal( cmStat_t::NUM_STATS ); i++ )
+	{
+		cmStatsExited[ i ] += counts[ i ].load( std::memory_order_relaxed ) - taken[ i ];
+	}
+
+	cmStatsThreads.erase( std::find( cmStatsThreads.begin(), cmStatsThreads.end(), this ) );
+}
+
+/*
+==================
+CM_TakeStats
+==================
+*/
+cmStats_t CM_TakeStats()
+{
+	std::lock_guard<std::mutex> lock( cmStatsLock );
+	cmStats_t stats = cmStatsExited;
+
+	cmStatsExited.fill( 0 );
+
+	for ( cmThreadStats_t *thread : cmStatsThreads )
+	{
+		for ( int i = 0; i < Util::ordinal( cmStat_t::NUM_STATS ); i++ )
+		{
+			unsigned count = thread->counts[ i ].load( std::memory_order_relaxed );
+
+			stats[ i ] += count - thread->taken[ i ];
+			thread->taken[ i ] = count;
+		}
+	}
+
+	return stats;
 }
 
 /*
@@ -841,6 +1528,7 @@ void CM_ClearMap()
 {
 	CM_FreeAll();
 	ResetStruct( cm );
+	loadedMapKey.clear();
 }
 
 /*
@@ -862,7 +1550,7 @@ cmodel_t       *CM_ClipHandleToModel( clipHandle_t handle )
 
 	if ( handle == BOX_MODEL_HANDLE || handle == CAPSULE_MODEL_HANDLE )
 	{
-		return &box_model;
+		return &boxHull.model;
 	}
 
 	Sys::Drop( "CM_ClipHandleToModel: bad handle %i (max %d)", handle, cm.numSubModels );
@@ -888,6 +1576,11 @@ int CM_NumInlineModels()
 	return cm.numSubModels;
 }
 
+int CM_NumClusters()
+{
+	return cm.numClusters;
+}
+
 char           *CM_EntityString()
 {
 	return cm.entityString;
@@ -917,54 +1610,14 @@ int CM_LeafArea( int leafnum )
 
 /*
 ===================
-CM_InitBoxHull
+CM_BoxBrush
 
-Set up the planes and nodes so that the six floats of a bounding box
-can just be stored out and get a proper clipping hull structure.
+The brush of the box model, see CM_LeafBrush
 ===================
 */
-void CM_InitBoxHull()
+cbrush_t *CM_BoxBrush()
 {
-	int          i;
-	int          side;
-	cplane_t     *p;
-	cbrushside_t *s;
-
-	box_planes = &cm.planes[ cm.numPlanes ];
-
-	box_brush = &cm.brushes[ cm.numBrushes ];
-	box_brush->numsides = 6;
-	box_brush->sides = cm.brushsides + cm.numBrushSides;
-	box_brush->contents = CONTENTS_BODY;
-
-	box_model.leaf.numLeafBrushes = 1;
-	box_model.leaf.firstLeafBrush = cm.leafbrushes + cm.numLeafBrushes;
-	cm.leafbrushes[ cm.numLeafBrushes ] = cm.numBrushes;
-
-	for ( i = 0; i < 6; i++ )
-	{
-		side = i & 1;
-
-		// brush sides
-		s = &cm.brushsides[ cm.numBrushSides + i ];
-		s->plane = cm.planes + ( cm.numPlanes + i * 2 + side );
-		s->surfaceFlags = 0;
-
-		// planes
-		p = &box_planes[ i * 2 ];
-		p->type = i >> 1;
-		p->signbits = 0;
-		VectorClear( p->normal );
-		p->normal[ i >> 1 ] = 1;
-
-		p = &box_planes[ i * 2 + 1 ];
-		p->type = 3 + ( i >> 1 );
-		p->signbits = 0;
-		VectorClear( p->normal );
-		p->normal[ i >> 1 ] = -1;
-
-		SetPlaneSignbits( p );
-	}
+	return &boxHull.brush;
 }
 
 /*
@@ -978,29 +1631,35 @@ Capsules are handled differently though.
 */
 clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, bool capsule )
 {
-	VectorCopy( mins, box_model.mins );
-	VectorCopy( maxs, box_model.maxs );
+	boxHull_t &box = boxHull;
+
+	VectorCopy( mins, box.model.mins );
+	VectorCopy( maxs, box.model.maxs );
 
 	if ( capsule )
 	{
 		return CAPSULE_MODEL_HANDLE;
 	}
 
-	box_planes[ 0 ].dist = maxs[ 0 ];
-	box_planes[ 1 ].dist = -maxs[ 0 ];
-	box_planes[ 2 ].dist = mins[ 0 ];
-	box_planes[ 3 ].dist = -mins[ 0 ];
-	box_planes[ 4 ].dist = maxs[ 1 ];
-	box_planes[ 5 ].dist = -maxs[ 1 ];
-	box_planes[ 6 ].dist = mins[ 1 ];
-	box_planes[ 7 ].dist = -mins[ 1 ];
-	box_planes[ 8 ].dist = maxs[ 2 ];
-	box_planes[ 9 ].dist = -maxs[ 2 ];
-	box_planes[ 10 ].dist = mins[ 2 ];
-	box_planes[ 11 ].dist = -mins[ 2 ];
-
-	VectorCopy( mins, box_brush->bounds[ 0 ] );
-	VectorCopy( maxs, box_brush->bounds[ 1 ] );
+	box.planes[ 0 ].dist = maxs[ 0 ];
+	box.planes[ 1 ].dist = -maxs[ 0 ];
+	box.planes[ 2 ].dist = mins[ 0 ];
+	box.planes[ 3 ].dist = -mins[ 0 ];
+	box.planes[ 4 ].dist = maxs[ 1 ];
+	box.planes[ 5 ].dist = -maxs[ 1 ];
+	box.planes[ 6 ].dist = mins[ 1 ];
+	box.planes[ 7 ].dist = -mins[ 1 ];
+	box.planes[ 8 ].dist = maxs[ 2 ];
+	box.planes[ 9 ].dist = -maxs[ 2 ];
+	box.planes[ 10 ].dist = mins[ 2 ];
+	box.planes[ 11 ].dist = -mins[ 2 ];
+
+	VectorCopy( mins, box.brush.bounds[ 0 ] );
+	VectorCopy( maxs, box.brush.bounds[ 1 ] );
+	CM_PackBrush( &box.brush, box.packedPlanes, box.packedSurfaceFlags );
+
+	// the brush number past those of the map designates the box brush
+	box.leafBrush = cm.numBrushes;
 
 	return BOX_MODEL_HANDLE;
 }
@@ -50,6 +50,19 @@ struct cNode_t
 	int       children[ 2 ]; // negative numbers are leafs
 };
 
+// the nodes again, with their planes, in depth-first order so that a node
+// is followed by its first child, for the tree descents
+struct cPackedNode_t
+{
+	vec3_t normal;
+	float  dist;
+	int    type; // of the plane, axial if < 3
+	int    children[ 2 ]; // packed node numbers, negative numbers are leafs
+	int    padding;
+};
+
+static_assert( sizeof( cPackedNode_t ) == 32, "two packed nodes should fit in a cache line" );
+
 struct cLeaf_t
 {
 	int cluster;
@@ -80,9 +93,20 @@ struct cbrush_t
 	vec3_t       bounds[ 2 ];
 	int          numsides;
 	cbrushside_t *sides;
-	int          checkcount; // to avoid repeated testings
+
+	// the sides again, packed for the trace kernels: the normal x, y and z and
+	// the dist of the planes as 4 arrays of CM_PackedSides( numsides ) floats,
+	// and the surface flags, padded with copies of the last side
+	float        *packedPlanes;
+	int          *packedSurfaceFlags;
 };
 
+// the packed arrays of a brush hold whole groups of 4 sides
+inline int CM_PackedSides( int numsides )
+{
+	return ( numsides + 3 ) & ~3;
+}
+
 struct cPlane_t
 {
 	plane_t plane;
@@ -139,7 +163,6 @@ struct cSurfaceCollide_t
 
 struct cSurface_t
 {
-	int               checkcount; // to avoid repeated testings
 	int               surfaceFlags;
 	int               contents;
 	cSurfaceCollide_t *sc;
@@ -165,6 +188,7 @@ struct clipMap_t
 
 	int          numNodes;
 	cNode_t      *nodes;
+	cPackedNode_t *packedNodes; // [ numNodes ], the root is still 0
 
 	int          numLeafs;
 	cLeaf_t      *leafs;
@@ -197,7 +221,6 @@ struct clipMap_t
 	cSurface_t   **surfaces; // non-patches will be nullptr
 
 	int          floodvalid;
-	int          checkcount; // incremented on each trace
 	bool     perPolyCollision;
 };
 
@@ -214,8 +237,28 @@ struct clipMap_t
 #define SURFACE_CLIP_EPSILON ( 0.125f )
 
 extern clipMap_t cm;
-extern int       c_pointcontents;
-extern int       c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces;
+
+// each thread counts its own statistics, so that threads tracing together don't
+// fight over a cache line; CM_TakeStats sums them
+struct cmThreadStats_t
+{
+	// only written by their thread, unsigned so that they can wrap around
+	std::atomic<unsigned> counts[ Util::ordinal( cmStat_t::NUM_STATS ) ];
+	// what CM_TakeStats already reported, under its lock
+	unsigned              taken[ Util::ordinal( cmStat_t::NUM_STATS ) ];
+
+	cmThreadStats_t();
+	~cmThreadStats_t();
+};
+
+extern thread_local cmThreadStats_t cmThreadStats;
+
+inline void CM_CountStat( cmStat_t stat )
+{
+	std::atomic<unsigned> &count = cmThreadStats.counts[ Util::ordinal( stat ) ];
+	count.store( count.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+}
+
 extern Cvar::Cvar<bool> cm_forceTriangles;
 extern Log::Logger cmLog;
 
@@ -245,6 +288,12 @@ struct traceWork_t
 	bool    isPoint; // optimized case
 	trace_t     trace; // returned from trace call
 	sphere_t    sphere; // sphere for oriendted capsule collision
+
+	// brushes and surfaces in several leafs are only checked once,
+	// they are marked with the generation of the trace of the thread
+	uint32_t    *brushVisits;
+	uint32_t    *surfaceVisits;
+	uint32_t    visitGeneration;
 };
 
 struct leafList_t
@@ -307,6 +356,13 @@ void                           CM_StoreLeafs( leafList_t *ll, int nodenum );
 void                           CM_BoxLeafnums_r( leafList_t *ll, int nodenum );
 
 cmodel_t                       *CM_ClipHandleToModel( clipHandle_t handle );
+cbrush_t                       *CM_BoxBrush();
+
+// the box model of CM_TempBoxModel is per thread, its brush comes after those of the map
+inline cbrush_t *CM_LeafBrush( int brushNum )
+{
+	return brushNum < cm.numBrushes ? &cm.brushes[ brushNum ] : CM_BoxBrush();
+}
 
 // XreaL BEGIN
 bool                       CM_BoundsIntersect( const vec3_t mins, const vec3_t maxs, const vec3_t mins2, const vec3_t maxs2 );
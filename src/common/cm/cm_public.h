@@ -32,6 +32,9 @@ Maryland 20850 USA.
 ===========================================================================
 */
 
+#ifndef CM_PUBLIC_H_
+#define CM_PUBLIC_H_
+
 #include "engine/qcommon/q_shared.h"
 
 void         CM_LoadMap(Str::StringRef name);
@@ -43,15 +46,35 @@ clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, bool capsule
 void         CM_ModelBounds( clipHandle_t model, vec3_t mins, vec3_t maxs );
 
 int          CM_NumInlineModels();
+int          CM_NumClusters();
 char         *CM_EntityString();
 
 // returns an ORed contents mask
 int          CM_PointContents( const vec3_t p, clipHandle_t model );
 int          CM_TransformedPointContents( const vec3_t p, clipHandle_t model, const vec3_t origin, const vec3_t angles );
 
+// statistics for showTraceStats
+enum class cmStat_t
+{
+	TRACES,
+	BRUSH_TRACES,
+	PATCH_TRACES,
+	TRISOUP_TRACES,
+	POINT_CONTENTS,
+	NUM_STATS
+};
+
+using cmStats_t = std::array<int, Util::ordinal( cmStat_t::NUM_STATS )>;
+
+// sums what every thread counted since the previous call
+cmStats_t    CM_TakeStats();
+
 void         CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end, const vec3_t mins,
                           const vec3_t maxs, clipHandle_t model, int brushmask, int skipmask,
                           traceType_t type );
+void         CM_BoxTraceBatch( trace_t *results, int numTraces, const vec3_t *starts, const vec3_t *ends,
+                               const vec3_t mins, const vec3_t maxs, clipHandle_t model, int brushmask,
+                               int skipmask, traceType_t type );
 void         CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
                                      const vec3_t mins, const vec3_t maxs, clipHandle_t model,
                                      int brushmask, int skipmask, const vec3_t origin,
@@ -79,3 +102,5 @@ int      CM_WriteAreaBits( byte *buffer, int area );
 // cm_marks.c
 int      CM_MarkFragments( int numPoints, const vec3_t *points, const vec3_t projection,
                            int maxPoints, vec3_t pointBuffer, int maxFragments, markFragment_t *fragmentBuffer );
+
+#endif // CM_PUBLIC_H_
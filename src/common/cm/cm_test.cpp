@@ -44,22 +44,20 @@ CM_PointLeafnum_r
 */
 int CM_PointLeafnum_r( const vec3_t p, int num )
 {
-	float    d;
-	cNode_t  *node;
-	cplane_t *plane;
+	float               d;
+	const cPackedNode_t *node;
 
 	while ( num >= 0 )
 	{
-		node = cm.nodes + num;
-		plane = node->plane;
+		node = cm.packedNodes + num;
 
-		if ( plane->type < 3 )
+		if ( node->type < 3 )
 		{
-			d = p[ plane->type ] - plane->dist;
+			d = p[ node->type ] - node->dist;
 		}
 		else
 		{
-			d = DotProduct( plane->normal, p ) - plane->dist;
+			d = DotProduct( node->normal, p ) - node->dist;
 		}
 
 		if ( d < 0 )
@@ -72,7 +70,7 @@ int CM_PointLeafnum_r( const vec3_t p, int num )
 		}
 	}
 
-	c_pointcontents++; // optimize counter
+	CM_CountStat( cmStat_t::POINT_CONTENTS ); // optimize counter
 
 	return -1 - num;
 }
@@ -168,8 +166,6 @@ int CM_BoxLeafnums( const vec3_t mins, const vec3_t maxs, int *list, int listsiz
 {
 	leafList_t ll;
 
-	cm.checkcount++;
-
 	VectorCopy( mins, ll.bounds[ 0 ] );
 	VectorCopy( maxs, ll.bounds[ 1 ] );
 	ll.count = 0;
@@ -233,7 +229,7 @@ int CM_PointContents( const vec3_t p, clipHandle_t model )
 	const int *endBrushNum = firstBrushNum + leaf->numLeafBrushes;
 	for ( const int *brushNum = firstBrushNum; brushNum < endBrushNum; brushNum++ )
 	{
-		const cbrush_t *b = &cm.brushes[ *brushNum ];
+		const cbrush_t *b = CM_LeafBrush( *brushNum );
 
 		// XreaL BEGIN
 		if ( !CM_BoundsIntersectPoint( b->bounds[ 0 ], b->bounds[ 1 ], p ) )
@@ -224,14 +224,57 @@ static void CM_TestBoxInBrush( traceWork_t *tw, const cbrush_t *brush )
 	}
 	else
 	{
-		for ( const cbrushside_t *side = firstSide; side < endSide; side++ )
+		int         stride = CM_PackedSides( brush->numsides );
+		const float *planes = brush->packedPlanes;
+
+#if defined(DAEMON_USE_ARCH_INTRINSICS_i686_sse)
+		__m128 mins0 = _mm_set1_ps( tw->size[ 0 ][ 0 ] );
+		__m128 mins1 = _mm_set1_ps( tw->size[ 0 ][ 1 ] );
+		__m128 mins2 = _mm_set1_ps( tw->size[ 0 ][ 2 ] );
+		__m128 maxs0 = _mm_set1_ps( tw->size[ 1 ][ 0 ] );
+		__m128 maxs1 = _mm_set1_ps( tw->size[ 1 ][ 1 ] );
+		__m128 maxs2 = _mm_set1_ps( tw->size[ 1 ][ 2 ] );
+		__m128 start0 = _mm_set1_ps( tw->start[ 0 ] );
+		__m128 start1 = _mm_set1_ps( tw->start[ 1 ] );
+		__m128 start2 = _mm_set1_ps( tw->start[ 2 ] );
+
+		for ( int i = 4; i < stride; i += 4 )
+		{
+			// the groups of 4 sides start with the 5th one, leave out the
+			// axial planes in it and the padding
+			int lanes = ( ( 1 << std::min( brush->numsides - i, 4 ) ) - 1 ) & ( i == 4 ? 0xc : 0xf );
+			__m128 n0 = _mm_load_ps( planes + i );
+			__m128 n1 = _mm_load_ps( planes + stride + i );
+			__m128 n2 = _mm_load_ps( planes + 2 * stride + i );
+
+			// adjust the plane distances appropriately for mins/maxs,
+			// the corner nearest to each plane gives the smallest products
+			__m128 corner = _mm_add_ps( _mm_add_ps( _mm_min_ps( _mm_mul_ps( mins0, n0 ), _mm_mul_ps( maxs0, n0 ) ),
+			                                        _mm_min_ps( _mm_mul_ps( mins1, n1 ), _mm_mul_ps( maxs1, n1 ) ) ),
+			                            _mm_min_ps( _mm_mul_ps( mins2, n2 ), _mm_mul_ps( maxs2, n2 ) ) );
+			__m128 sideDist = _mm_sub_ps( _mm_load_ps( planes + 3 * stride + i ), corner );
+
+			__m128 startDist = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( start0, n0 ), _mm_mul_ps( start1, n1 ) ), _mm_mul_ps( start2, n2 ) ), sideDist );
+
+			// if completely in front of face, no intersection
+			if ( _mm_movemask_ps( _mm_cmpgt_ps( startDist, _mm_setzero_ps() ) ) & lanes )
+			{
+				return;
+			}
+		}
+#else
+		for ( int side = 6; side < brush->numsides; side++ )
 		{
-			const cplane_t *plane = side->plane;
+			vec3_t normal = { planes[ side ], planes[ stride + side ], planes[ 2 * stride + side ] };
 
-			// adjust the plane distance appropriately for mins/maxs
-			dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+			// adjust the plane distance appropriately for mins/maxs,
+			// the corner nearest to the plane gives the smallest products
+			dist = planes[ 3 * stride + side ]
+			       - ( ( std::min( tw->size[ 0 ][ 0 ] * normal[ 0 ], tw->size[ 1 ][ 0 ] * normal[ 0 ] )
+			             + std::min( tw->size[ 0 ][ 1 ] * normal[ 1 ], tw->size[ 1 ][ 1 ] * normal[ 1 ] ) )
+			           + std::min( tw->size[ 0 ][ 2 ] * normal[ 2 ], tw->size[ 1 ][ 2 ] * normal[ 2 ] ) );
 
-			d1 = DotProduct( tw->start, plane->normal ) - dist;
+			d1 = DotProduct( tw->start, normal ) - dist;
 
 			// if completely in front of face, no intersection
 			if ( d1 > 0 )
@@ -239,6 +282,7 @@ static void CM_TestBoxInBrush( traceWork_t *tw, const cbrush_t *brush )
 				return;
 			}
 		}
+#endif
 	}
 
 	// inside this brush
@@ -372,14 +416,14 @@ void CM_TestInLeaf( traceWork_t *tw, const cLeaf_t *leaf )
 	const int *endBrushNum = firstBrushNum + leaf->numLeafBrushes;
 	for ( const int *brushNum = firstBrushNum; brushNum < endBrushNum; brushNum++ )
 	{
-		cbrush_t *b = &cm.brushes[ *brushNum ];
-
-		if ( b->checkcount == cm.checkcount )
+		if ( tw->brushVisits[ *brushNum ] == tw->visitGeneration )
 		{
 			continue; // already checked this brush in another leaf
 		}
 
-		b->checkcount = cm.checkcount;
+		tw->brushVisits[ *brushNum ] = tw->visitGeneration;
+
+		cbrush_t *b = CM_LeafBrush( *brushNum );
 
 		if ( !( b->contents & tw->contents ) )
 		{
@@ -411,12 +455,12 @@ void CM_TestInLeaf( traceWork_t *tw, const cLeaf_t *leaf )
 			continue;
 		}
 
-		if ( surface->checkcount == cm.checkcount )
+		if ( tw->surfaceVisits[ *surfaceNum ] == tw->visitGeneration )
 		{
 			continue; // already checked this surface in another leaf
 		}
 
-		surface->checkcount = cm.checkcount;
+		tw->surfaceVisits[ *surfaceNum ] = tw->visitGeneration;
 
 		if ( !( surface->contents & tw->contents ) )
 		{
@@ -633,12 +677,8 @@ void CM_PositionTest( traceWork_t *tw )
 	ll.lastLeaf = 0;
 	ll.overflowed = false;
 
-	cm.checkcount++;
-
 	CM_BoxLeafnums_r( &ll, 0 );
 
-	cm.checkcount++;
-
 	// test the contents of the leafs
 	for ( i = 0; i < ll.count; i++ )
 	{
@@ -668,8 +708,8 @@ CM_TracePointThroughSurfaceCollide
 */
 void CM_TracePointThroughSurfaceCollide( traceWork_t *tw, const cSurfaceCollide_t *sc )
 {
-	static bool frontFacing[ SHADER_MAX_TRIANGLES ];
-	static float    intersection[ SHADER_MAX_TRIANGLES ];
+	static thread_local bool  frontFacing[ SHADER_MAX_TRIANGLES ];
+	static thread_local float intersection[ SHADER_MAX_TRIANGLES ];
 	float           intersect;
 	const cPlane_t  *planes;
 	const cFacet_t  *facet;
@@ -1008,13 +1048,13 @@ void CM_TraceThroughSurface( traceWork_t *tw, const cSurface_t *surface )
 	if ( !cm_noCurves.Get() && surface->type == mapSurfaceType_t::MST_PATCH && surface->sc )
 	{
 		CM_TraceThroughSurfaceCollide( tw, surface->sc );
-		c_patch_traces++;
+		CM_CountStat( cmStat_t::PATCH_TRACES );
 	}
 
 	if ( ( cm.perPolyCollision || cm_forceTriangles.Get() ) && surface->type == mapSurfaceType_t::MST_TRIANGLE_SOUP && surface->sc )
 	{
 		CM_TraceThroughSurfaceCollide( tw, surface->sc );
-		c_trisoup_traces++;
+		CM_CountStat( cmStat_t::TRISOUP_TRACES );
 	}
 
 	if ( tw->trace.fraction < oldFrac )
@@ -1024,6 +1064,173 @@ void CM_TraceThroughSurface( traceWork_t *tw, const cSurface_t *surface )
 	}
 }
 
+/*
+================
+CM_TraceThroughBrushSides
+
+Updates the trace once all the sides of a brush have been checked,
+and the trace was not completely outside of it
+================
+*/
+static void CM_TraceThroughBrushSides( traceWork_t *tw, const cbrush_t *brush, bool startout, bool getout,
+                                       float enterFrac, float leaveFrac, int leadside )
+{
+	if ( !startout )
+	{
+		// original point was inside brush
+		tw->trace.startsolid = true;
+
+		if ( !getout )
+		{
+			tw->trace.allsolid = true;
+			tw->trace.fraction = 0;
+			tw->trace.contents = brush->contents;
+		}
+
+		return;
+	}
+
+	if ( enterFrac < leaveFrac )
+	{
+		if ( enterFrac > -1 && enterFrac < tw->trace.fraction )
+		{
+			if ( enterFrac < 0 )
+			{
+				enterFrac = 0;
+			}
+
+			int         stride = CM_PackedSides( brush->numsides );
+			const float *planes = brush->packedPlanes;
+
+			tw->trace.fraction = enterFrac;
+			tw->trace.plane.normal[ 0 ] = planes[ leadside ];
+			tw->trace.plane.normal[ 1 ] = planes[ stride + leadside ];
+			tw->trace.plane.normal[ 2 ] = planes[ 2 * stride + leadside ];
+			tw->trace.plane.dist = planes[ 3 * stride + leadside ];
+			tw->trace.surfaceFlags = brush->packedSurfaceFlags[ leadside ];
+			tw->trace.contents = brush->contents;
+		}
+	}
+}
+
+#if defined(DAEMON_USE_ARCH_INTRINSICS_i686_sse)
+/*
+================
+CM_TraceBoxThroughBrush
+
+The box trace case of CM_TraceThroughBrush, checking 4 packed sides at once
+================
+*/
+static void CM_TraceBoxThroughBrush( traceWork_t *tw, const cbrush_t *brush )
+{
+	int         stride = CM_PackedSides( brush->numsides );
+	const float *planes = brush->packedPlanes;
+
+	__m128 mins0 = _mm_set1_ps( tw->size[ 0 ][ 0 ] );
+	__m128 mins1 = _mm_set1_ps( tw->size[ 0 ][ 1 ] );
+	__m128 mins2 = _mm_set1_ps( tw->size[ 0 ][ 2 ] );
+	__m128 maxs0 = _mm_set1_ps( tw->size[ 1 ][ 0 ] );
+	__m128 maxs1 = _mm_set1_ps( tw->size[ 1 ][ 1 ] );
+	__m128 maxs2 = _mm_set1_ps( tw->size[ 1 ][ 2 ] );
+	__m128 start0 = _mm_set1_ps( tw->start[ 0 ] );
+	__m128 start1 = _mm_set1_ps( tw->start[ 1 ] );
+	__m128 start2 = _mm_set1_ps( tw->start[ 2 ] );
+	__m128 end0 = _mm_set1_ps( tw->end[ 0 ] );
+	__m128 end1 = _mm_set1_ps( tw->end[ 1 ] );
+	__m128 end2 = _mm_set1_ps( tw->end[ 2 ] );
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps( 1.0f );
+	__m128 epsilon = _mm_set1_ps( SURFACE_CLIP_EPSILON );
+
+	// the latest entry and earliest exit of each lane, the side numbers being exact as floats
+	__m128 enterFrac = _mm_set1_ps( -1.0f );
+	__m128 enterSide = zero;
+	__m128 leaveFrac = one;
+	__m128 getout = zero;
+	__m128 startout = zero;
+	__m128 side = _mm_setr_ps( 0, 1, 2, 3 );
+
+	//
+	// compare the trace against all planes of the brush
+	// find the latest time the trace crosses a plane towards the interior
+	// and the earliest time the trace crosses a plane towards the exterior
+	//
+	for ( int i = 0; i < stride; i += 4, side = _mm_add_ps( side, _mm_set1_ps( 4 ) ) )
+	{
+		__m128 n0 = _mm_load_ps( planes + i );
+		__m128 n1 = _mm_load_ps( planes + stride + i );
+		__m128 n2 = _mm_load_ps( planes + 2 * stride + i );
+
+		// adjust the plane distances appropriately for mins/maxs,
+		// the corner nearest to each plane gives the smallest products
+		__m128 corner = _mm_add_ps( _mm_add_ps( _mm_min_ps( _mm_mul_ps( mins0, n0 ), _mm_mul_ps( maxs0, n0 ) ),
+		                                        _mm_min_ps( _mm_mul_ps( mins1, n1 ), _mm_mul_ps( maxs1, n1 ) ) ),
+		                            _mm_min_ps( _mm_mul_ps( mins2, n2 ), _mm_mul_ps( maxs2, n2 ) ) );
+		__m128 dist = _mm_sub_ps( _mm_load_ps( planes + 3 * stride + i ), corner );
+
+		__m128 d1 = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( start0, n0 ), _mm_mul_ps( start1, n1 ) ), _mm_mul_ps( start2, n2 ) ), dist );
+		__m128 d2 = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( end0, n0 ), _mm_mul_ps( end1, n1 ) ), _mm_mul_ps( end2, n2 ) ), dist );
+
+		__m128 d1out = _mm_cmpgt_ps( d1, zero );
+		__m128 d2out = _mm_cmpgt_ps( d2, zero );
+
+		// if completely in front of a face, no intersection with the entire brush
+		if ( _mm_movemask_ps( _mm_and_ps( d1out, _mm_or_ps( _mm_cmpge_ps( d2, epsilon ), _mm_cmpge_ps( d2, d1 ) ) ) ) )
+		{
+			return;
+		}
+
+		getout = _mm_or_ps( getout, d2out );
+		startout = _mm_or_ps( startout, d1out );
+
+		// if it doesn't cross the plane, the plane isn't relevant
+		__m128 crosses = _mm_or_ps( d1out, d2out );
+		__m128 enters = _mm_and_ps( crosses, _mm_cmpgt_ps( d1, d2 ) );
+		__m128 leaves = _mm_andnot_ps( enters, crosses );
+		__m128 denominator = _mm_sub_ps( d1, d2 );
+
+		__m128 enter = _mm_div_ps( _mm_sub_ps( d1, epsilon ), denominator );
+		enter = _mm_andnot_ps( _mm_cmplt_ps( enter, zero ), enter );
+		__m128 later = _mm_and_ps( enters, _mm_cmpgt_ps( enter, enterFrac ) );
+		enterFrac = _mm_or_ps( _mm_and_ps( later, enter ), _mm_andnot_ps( later, enterFrac ) );
+		enterSide = _mm_or_ps( _mm_and_ps( later, side ), _mm_andnot_ps( later, enterSide ) );
+
+		__m128 leave = _mm_div_ps( _mm_add_ps( d1, epsilon ), denominator );
+		__m128 past = _mm_cmpgt_ps( leave, one );
+		leave = _mm_or_ps( _mm_and_ps( past, one ), _mm_andnot_ps( past, leave ) );
+		__m128 earlier = _mm_and_ps( leaves, _mm_cmplt_ps( leave, leaveFrac ) );
+		leaveFrac = _mm_or_ps( _mm_and_ps( earlier, leave ), _mm_andnot_ps( earlier, leaveFrac ) );
+	}
+
+	alignas(16) float enterFracs[ 4 ];
+	alignas(16) float enterSides[ 4 ];
+	alignas(16) float leaveFracs[ 4 ];
+	_mm_store_ps( enterFracs, enterFrac );
+	_mm_store_ps( enterSides, enterSide );
+	_mm_store_ps( leaveFracs, leaveFrac );
+
+	// the first side with the latest entry, as when checking them in order
+	float bestEnter = enterFracs[ 0 ];
+	float bestSide = enterSides[ 0 ];
+	float bestLeave = leaveFracs[ 0 ];
+
+	for ( int i = 1; i < 4; i++ )
+	{
+		if ( enterFracs[ i ] > bestEnter || ( enterFracs[ i ] == bestEnter && enterSides[ i ] < bestSide ) )
+		{
+			bestEnter = enterFracs[ i ];
+			bestSide = enterSides[ i ];
+		}
+
+		bestLeave = std::min( bestLeave, leaveFracs[ i ] );
+	}
+
+	CM_TraceThroughBrushSides( tw, brush, _mm_movemask_ps( startout ), _mm_movemask_ps( getout ),
+	                           bestEnter, bestLeave, static_cast<int>( bestSide ) );
+}
+#endif
+
 /*
 ================
 CM_TraceThroughBrush
@@ -1048,13 +1255,20 @@ void CM_TraceThroughBrush( traceWork_t *tw, const cbrush_t *brush )
 		return;
 	}
 
-	c_brush_traces++;
+	CM_CountStat( cmStat_t::BRUSH_TRACES );
+
+#if defined(DAEMON_USE_ARCH_INTRINSICS_i686_sse)
+	if ( tw->type != traceType_t::TT_CAPSULE )
+	{
+		CM_TraceBoxThroughBrush( tw, brush );
+		return;
+	}
+#endif
 
 	getout = false;
 	startout = false;
 
-	const cplane_t *clipplane = nullptr;
-	const cbrushside_t *leadside = nullptr;
+	int leadside = 0;
 
 	const cbrushside_t *firstSide = brush->sides;
 	const cbrushside_t *endSide = firstSide + brush->numsides;
@@ -1126,8 +1340,7 @@ void CM_TraceThroughBrush( traceWork_t *tw, const cbrush_t *brush )
 				if ( f > enterFrac )
 				{
 					enterFrac = f;
-					clipplane = plane;
-					leadside = side;
+					leadside = side - firstSide;
 				}
 			}
 			else
@@ -1154,15 +1367,22 @@ void CM_TraceThroughBrush( traceWork_t *tw, const cbrush_t *brush )
 		// find the latest time the trace crosses a plane towards the interior
 		// and the earliest time the trace crosses a plane towards the exterior
 		//
-		for ( const cbrushside_t *side = firstSide; side < endSide; side++ )
+		int         stride = CM_PackedSides( brush->numsides );
+		const float *planes = brush->packedPlanes;
+
+		for ( int side = 0; side < brush->numsides; side++ )
 		{
-			const cplane_t *plane = side->plane;
+			vec3_t normal = { planes[ side ], planes[ stride + side ], planes[ 2 * stride + side ] };
 
-			// adjust the plane distance appropriately for mins/maxs
-			dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+			// adjust the plane distance appropriately for mins/maxs,
+			// the corner nearest to the plane gives the smallest products
+			dist = planes[ 3 * stride + side ]
+			       - ( ( std::min( tw->size[ 0 ][ 0 ] * normal[ 0 ], tw->size[ 1 ][ 0 ] * normal[ 0 ] )
+			             + std::min( tw->size[ 0 ][ 1 ] * normal[ 1 ], tw->size[ 1 ][ 1 ] * normal[ 1 ] ) )
+			           + std::min( tw->size[ 0 ][ 2 ] * normal[ 2 ], tw->size[ 1 ][ 2 ] * normal[ 2 ] ) );
 
-			d1 = DotProduct( tw->start, plane->normal ) - dist;
-			d2 = DotProduct( tw->end, plane->normal ) - dist;
+			d1 = DotProduct( tw->start, normal ) - dist;
+			d2 = DotProduct( tw->end, normal ) - dist;
 
 			if ( d2 > 0 )
 			{
@@ -1200,7 +1420,6 @@ void CM_TraceThroughBrush( traceWork_t *tw, const cbrush_t *brush )
 				if ( f > enterFrac )
 				{
 					enterFrac = f;
-					clipplane = plane;
 					leadside = side;
 				}
 			}
@@ -1222,134 +1441,110 @@ void CM_TraceThroughBrush( traceWork_t *tw, const cbrush_t *brush )
 		}
 	}
 
-	//
-	// all planes have been checked, and the trace was not
-	// completely outside the brush
-	//
-	if ( !startout )
-	{
-		// original point was inside brush
-		tw->trace.startsolid = true;
-
-		if ( !getout )
-		{
-			tw->trace.allsolid = true;
-			tw->trace.fraction = 0;
-			tw->trace.contents = brush->contents;
-		}
-
-		return;
-	}
-
-	if ( enterFrac < leaveFrac )
-	{
-		if ( enterFrac > -1 && enterFrac < tw->trace.fraction )
-		{
-			if ( enterFrac < 0 )
-			{
-				enterFrac = 0;
-			}
-
-			tw->trace.fraction = enterFrac;
-			VectorCopy(clipplane->normal, tw->trace.plane.normal);
-			tw->trace.plane.dist = clipplane->dist;
-			tw->trace.surfaceFlags = leadside->surfaceFlags;
-			tw->trace.contents = brush->contents;
-		}
-	}
+	CM_TraceThroughBrushSides( tw, brush, startout, getout, enterFrac, leaveFrac, leadside );
 }
 
 /*
 ================
-CM_TraceThroughLeaf
+CM_TraceThroughLeafSurfaces
 ================
 */
-void CM_TraceThroughLeaf( traceWork_t *tw, const cLeaf_t *leaf )
+static void CM_TraceThroughLeafSurfaces( traceWork_t *tw, const cLeaf_t *leaf )
 {
-	// trace line against all brushes in the leaf
-	const int *firstBrushNum = leaf->firstLeafBrush;
-	const int *endBrushNum = firstBrushNum + leaf->numLeafBrushes;
-	for ( const int *brushNum = firstBrushNum; brushNum < endBrushNum; brushNum++ )
+	// CM_TraceThroughSurface does not set startsolid/allsolid so 0 fraction is the most we'll know
+	if ( !tw->trace.fraction )
 	{
-		cbrush_t *b = &cm.brushes[ *brushNum ];
+		return;
+	}
 
-		if ( b->checkcount == cm.checkcount )
+	// trace line against all surfaces in the leaf
+	const int *firstSurfaceNum = leaf->firstLeafSurface;
+	const int *endSurfaceNum = firstSurfaceNum + leaf->numLeafSurfaces;
+	for ( const int *surfaceNum = firstSurfaceNum; surfaceNum < endSurfaceNum; surfaceNum++ )
+	{
+		cSurface_t *surface = cm.surfaces[ *surfaceNum ];
+
+		if ( !surface )
 		{
-			continue; // already checked this brush in another leaf
+			continue;
 		}
 
-		b->checkcount = cm.checkcount;
+		if ( tw->surfaceVisits[ *surfaceNum ] == tw->visitGeneration )
+		{
+			continue; // already checked this surface in another leaf
+		}
 
-		if ( !( b->contents & tw->contents ) )
+		tw->surfaceVisits[ *surfaceNum ] = tw->visitGeneration;
+
+		if ( !( surface->contents & tw->contents ) )
 		{
 			continue;
 		}
 
-		if ( b->contents & tw->skipContents )
+		if ( surface->contents & tw->skipContents )
 		{
 			continue;
 		}
 
-		if ( !CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], b->bounds[ 0 ], b->bounds[ 1 ] ) )
+		if ( !CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], surface->sc->bounds[ 0 ], surface->sc->bounds[ 1 ] ) )
 		{
 			continue;
 		}
 
-		CM_TraceThroughBrush( tw, b );
+		CM_TraceThroughSurface( tw, surface );
 
-		if ( tw->trace.allsolid )
+		if ( !tw->trace.fraction )
 		{
 			return;
 		}
 	}
+}
 
-	// CM_TraceThroughSurface does not set startsolid/allsolid so 0 fraction is the most we'll know
-	if ( !tw->trace.fraction )
-	{
-		return;
-	}
-
-	// trace line against all surfaces in the leaf
-	const int *firstSurfaceNum = leaf->firstLeafSurface;
-	const int *endSurfaceNum = firstSurfaceNum + leaf->numLeafSurfaces;
-	for ( const int *surfaceNum = firstSurfaceNum; surfaceNum < endSurfaceNum; surfaceNum++ )
+/*
+================
+CM_TraceThroughLeaf
+================
+*/
+void CM_TraceThroughLeaf( traceWork_t *tw, const cLeaf_t *leaf )
+{
+	// trace line against all brushes in the leaf
+	const int *firstBrushNum = leaf->firstLeafBrush;
+	const int *endBrushNum = firstBrushNum + leaf->numLeafBrushes;
+	for ( const int *brushNum = firstBrushNum; brushNum < endBrushNum; brushNum++ )
 	{
-		cSurface_t *surface = cm.surfaces[ *surfaceNum ];
-
-		if ( !surface )
+		if ( tw->brushVisits[ *brushNum ] == tw->visitGeneration )
 		{
-			continue;
+			continue; // already checked this brush in another leaf
 		}
 
-		if ( surface->checkcount == cm.checkcount )
-		{
-			continue; // already checked this surface in another leaf
-		}
+		tw->brushVisits[ *brushNum ] = tw->visitGeneration;
 
-		surface->checkcount = cm.checkcount;
+		cbrush_t *b = CM_LeafBrush( *brushNum );
 
-		if ( !( surface->contents & tw->contents ) )
+		if ( !( b->contents & tw->contents ) )
 		{
 			continue;
 		}
 
-		if ( surface->contents & tw->skipContents )
+		if ( b->contents & tw->skipContents )
 		{
 			continue;
 		}
 
-		if ( !CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], surface->sc->bounds[ 0 ], surface->sc->bounds[ 1 ] ) )
+		if ( !CM_BoundsIntersect( tw->bounds[ 0 ], tw->bounds[ 1 ], b->bounds[ 0 ], b->bounds[ 1 ] ) )
 		{
 			continue;
 		}
 
-		CM_TraceThroughSurface( tw, surface );
+		CM_TraceThroughBrush( tw, b );
 
-		if ( !tw->trace.fraction )
+		if ( tw->trace.allsolid )
 		{
 			return;
 		}
 	}
+
+	CM_TraceThroughLeafSurfaces( tw, leaf );
 }
 
 static const float RADIUS_EPSILON = 1.0f;
@@ -1708,165 +1903,254 @@ void CM_TraceBoundingBoxThroughCapsule( traceWork_t *tw, clipHandle_t model )
 
 /*
 ==================
-CM_TraceThroughTree
+CM_SplitTraceAtNode
 
-Traverse all the contacted leafs from the start to the end position.
-If the trace is a point, they will be exactly in order, but for larger
-trace volumes it is possible to hit something in a later leaf with
-a smaller intercept fraction.
+Returns the child of the node a trace segment is entirely in, or -1 if it
+has to go through both. The near child is then side, and the segment leaves
+it at frac and enters the far child at frac2.
 ==================
 */
-static void CM_TraceThroughTree( traceWork_t *tw, int num, float p1f, float p2f, const vec3_t p1, const vec3_t p2 )
+static inline int CM_SplitTraceAtNode( const traceWork_t *tw, const cPackedNode_t *node, const vec3_t p1, const vec3_t p2,
+                                       int *side, float *frac, float *frac2 )
 {
-	cNode_t  *node;
-	cplane_t *plane;
-	float    t1, t2, offset;
-	float    frac, frac2;
-	float    idist;
-	vec3_t   mid;
-	int      side;
-	float    midf;
-
-	if ( tw->trace.fraction < p1f )
-	{
-		return; // already hit something nearer
-	}
-
-	// if < 0, we are in a leaf node
-	if ( num < 0 )
-	{
-		CM_TraceThroughLeaf( tw, &cm.leafs[ -1 - num ] );
-		return;
-	}
+	float t1, t2, offset;
+	float idist;
 
 	//
 	// find the point distances to the separating plane
 	// and the offset for the size of the box
 	//
-	node = cm.nodes + num;
-	plane = node->plane;
 
 	// adjust the plane distance appropriately for mins/maxs
-	if ( plane->type < 3 )
+	if ( node->type < 3 )
 	{
-		t1 = p1[ plane->type ] - plane->dist;
-		t2 = p2[ plane->type ] - plane->dist;
-		offset = tw->extents[ plane->type ];
+		t1 = p1[ node->type ] - node->dist;
+		t2 = p2[ node->type ] - node->dist;
+		offset = tw->extents[ node->type ];
 	}
 	else
 	{
-		t1 = DotProduct( plane->normal, p1 ) - plane->dist;
-		t2 = DotProduct( plane->normal, p2 ) - plane->dist;
+		t1 = DotProduct( node->normal, p1 ) - node->dist;
+		t2 = DotProduct( node->normal, p2 ) - node->dist;
 		offset = tw->maxOffset;
 	}
 
 	// see which sides we need to consider
 	if ( t1 >= offset + 1 && t2 >= offset + 1 )
 	{
-		CM_TraceThroughTree( tw, node->children[ 0 ], p1f, p2f, p1, p2 );
-		return;
+		return 0;
 	}
 
 	if ( t1 < -offset - 1 && t2 < -offset - 1 )
 	{
-		CM_TraceThroughTree( tw, node->children[ 1 ], p1f, p2f, p1, p2 );
-		return;
+		return 1;
 	}
 
 	// put the crosspoint SURFACE_CLIP_EPSILON pixels on the near side
 	if ( t1 < t2 )
 	{
 		idist = 1.0f / ( t1 - t2 );
-		side = 1;
-		frac2 = ( t1 + offset + SURFACE_CLIP_EPSILON ) * idist;
-		frac = ( t1 - offset + SURFACE_CLIP_EPSILON ) * idist;
+		*side = 1;
+		*frac2 = ( t1 + offset + SURFACE_CLIP_EPSILON ) * idist;
+		*frac = ( t1 - offset + SURFACE_CLIP_EPSILON ) * idist;
 	}
 	else if ( t1 > t2 )
 	{
 		idist = 1.0f / ( t1 - t2 );
-		side = 0;
-		frac2 = ( t1 - offset - SURFACE_CLIP_EPSILON ) * idist;
-		frac = ( t1 + offset + SURFACE_CLIP_EPSILON ) * idist;
+		*side = 0;
+		*frac2 = ( t1 - offset - SURFACE_CLIP_EPSILON ) * idist;
+		*frac = ( t1 + offset + SURFACE_CLIP_EPSILON ) * idist;
 	}
 	else
 	{
-		side = 0;
-		frac = 1;
-		frac2 = 0;
+		*side = 0;
+		*frac = 1;
+		*frac2 = 0;
 	}
 
-	// move up to the node
-	if ( frac < 0 )
+	if ( *frac < 0 )
 	{
-		frac = 0;
+		*frac = 0;
 	}
 
-	if ( frac > 1 )
+	if ( *frac > 1 )
 	{
-		frac = 1;
+		*frac = 1;
 	}
 
-	midf = p1f + ( p2f - p1f ) * frac;
+	if ( *frac2 < 0 )
+	{
+		*frac2 = 0;
+	}
+
+	if ( *frac2 > 1 )
+	{
+		*frac2 = 1;
+	}
+
+	return -1;
+}
+
+/*
+==================
+CM_TraceSegmentPoint
+==================
+*/
+static inline void CM_TraceSegmentPoint( float p1f, float p2f, const vec3_t p1, const vec3_t p2, float frac,
+                                         float *midf, vec3_t mid )
+{
+	*midf = p1f + ( p2f - p1f ) * frac;
 
 	mid[ 0 ] = p1[ 0 ] + frac * ( p2[ 0 ] - p1[ 0 ] );
 	mid[ 1 ] = p1[ 1 ] + frac * ( p2[ 1 ] - p1[ 1 ] );
 	mid[ 2 ] = p1[ 2 ] + frac * ( p2[ 2 ] - p1[ 2 ] );
+}
 
-	CM_TraceThroughTree( tw, node->children[ side ], p1f, midf, p1, mid );
+// the far side of a node a trace still has to go through
+struct traceFarSide_t
+{
+	int    num;
+	float  p1f, p2f;
+	vec3_t p1, p2;
+};
 
-	// go past the node
-	if ( frac2 < 0 )
-	{
-		frac2 = 0;
-	}
+// the far sides left by the traces of the thread, see CM_TraceThroughTree
+static thread_local std::vector<traceFarSide_t> traceFarSides;
+
+/*
+==================
+CM_TraceThroughTree
 
-	if ( frac2 > 1 )
+Traverse all the contacted leafs from the start to the end position.
+If the trace is a point, they will be exactly in order, but for larger
+trace volumes it is possible to hit something in a later leaf with
+a smaller intercept fraction.
+
+The near child of a node is traversed first, the far side is kept on a
+stack to be traversed after it.
+==================
+*/
+static void CM_TraceThroughTree( traceWork_t *tw, int num, float p1f, float p2f, const vec3_t p1, const vec3_t p2 )
+{
+	std::vector<traceFarSide_t> &stack = traceFarSides;
+	size_t         base = stack.size();
+	traceFarSide_t segment;
+	int            side;
+	float          frac, frac2;
+
+	segment.num = num;
+	segment.p1f = p1f;
+	segment.p2f = p2f;
+	VectorCopy( p1, segment.p1 );
+	VectorCopy( p2, segment.p2 );
+
+	for ( ;; )
 	{
-		frac2 = 1;
-	}
+		// skip it if we already hit something nearer
+		if ( tw->trace.fraction >= segment.p1f )
+		{
+			// if < 0, we are in a leaf node
+			if ( segment.num < 0 )
+			{
+				CM_TraceThroughLeaf( tw, &cm.leafs[ -1 - segment.num ] );
+			}
+			else
+			{
+				const cPackedNode_t *node = cm.packedNodes + segment.num;
+				int child = CM_SplitTraceAtNode( tw, node, segment.p1, segment.p2, &side, &frac, &frac2 );
 
-	midf = p1f + ( p2f - p1f ) * frac2;
+				if ( child >= 0 )
+				{
+					segment.num = node->children[ child ];
+					continue;
+				}
 
-	mid[ 0 ] = p1[ 0 ] + frac2 * ( p2[ 0 ] - p1[ 0 ] );
-	mid[ 1 ] = p1[ 1 ] + frac2 * ( p2[ 1 ] - p1[ 1 ] );
-	mid[ 2 ] = p1[ 2 ] + frac2 * ( p2[ 2 ] - p1[ 2 ] );
+				// go past the node later
+				traceFarSide_t farSide;
+				farSide.num = node->children[ side ^ 1 ];
+				farSide.p2f = segment.p2f;
+				VectorCopy( segment.p2, farSide.p2 );
+				CM_TraceSegmentPoint( segment.p1f, segment.p2f, segment.p1, segment.p2, frac2, &farSide.p1f, farSide.p1 );
+				stack.push_back( farSide );
+
+				// move up to the node
+				traceFarSide_t nearSide;
+				nearSide.num = node->children[ side ];
+				nearSide.p1f = segment.p1f;
+				VectorCopy( segment.p1, nearSide.p1 );
+				CM_TraceSegmentPoint( segment.p1f, segment.p2f, segment.p1, segment.p2, frac, &nearSide.p2f, nearSide.p2 );
+				segment = nearSide;
+				continue;
+			}
+		}
 
-	CM_TraceThroughTree( tw, node->children[ side ^ 1 ], midf, p2f, mid, p2 );
+		if ( stack.size() == base )
+		{
+			return;
+		}
+
+		segment = stack.back();
+		stack.pop_back();
+	}
 }
 
 //======================================================================
 
+// brushes and surfaces checked by the traces of the thread, see traceWork_t
+struct traceVisits_t
+{
+	uint32_t              generation = 0;
+	std::vector<uint32_t> brushes;
+	std::vector<uint32_t> surfaces;
+};
+
+static thread_local traceVisits_t traceVisits;
+
 /*
 ==================
-CM_Trace
+CM_BeginTraceVisits
+
+Nothing is marked with the new generation yet, no matter
+which map the marks of the previous traces were for
 ==================
 */
-static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, const vec3_t mins,
-                      const vec3_t maxs, clipHandle_t model, const vec3_t origin, int brushmask,
-                      int skipmask, traceType_t type, const sphere_t *sphere )
+static void CM_BeginTraceVisits( traceWork_t *tw )
 {
-	int         i;
-	vec3_t      offset;
-	cmodel_t    *cmod;
+	traceVisits_t &visits = traceVisits;
 
-	cmod = CM_ClipHandleToModel( model );
+	// one more brush for the box model
+	visits.brushes.resize( cm.numBrushes + 1 );
+	visits.surfaces.resize( cm.numSurfaces );
 
-	cm.checkcount++; // for multi-check avoidance
+	if ( ++visits.generation == 0 )
+	{
+		std::fill( visits.brushes.begin(), visits.brushes.end(), 0 );
+		std::fill( visits.surfaces.begin(), visits.surfaces.end(), 0 );
+		visits.generation = 1;
+	}
 
-	c_traces++; // for statistics, may be zeroed
+	tw->brushVisits = visits.brushes.data();
+	tw->surfaceVisits = visits.surfaces.data();
+	tw->visitGeneration = visits.generation;
+}
 
-	// fill in a default trace
-	traceWork_t tw{};
-	tw.trace.fraction = 1; // assume it goes the entire distance until shown otherwise
-	VectorCopy( origin, tw.modelOrigin );
-	tw.type = type;
+/*
+==================
+CM_InitTraceWork
 
-	if ( !cm.numNodes )
-	{
-		*results = tw.trace;
+Everything about a trace but the visit marks and the extents of sweeps
+==================
+*/
+static void CM_InitTraceWork( traceWork_t *tw, const vec3_t start, const vec3_t end, const vec3_t mins,
+                              const vec3_t maxs, const vec3_t origin, int brushmask, int skipmask,
+                              traceType_t type, const sphere_t *sphere )
+{
+	int    i;
+	vec3_t offset;
 
-		return; // map not loaded, shouldn't happen
-	}
+	tw->trace.fraction = 1; // assume it goes the entire distance until shown otherwise
+	VectorCopy( origin, tw->modelOrigin );
+	tw->type = type;
 
 	// allow nullptr to be passed in for 0,0,0
 	if ( !mins )
@@ -1880,8 +2164,8 @@ static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, co
 	}
 
 	// set basic parms
-	tw.contents = brushmask;
-	tw.skipContents = skipmask;
+	tw->contents = brushmask;
+	tw->skipContents = skipmask;
 
 	// adjust so that mins and maxs are always symmetric, which
 	// avoids some complications with plane expanding of rotated
@@ -1891,86 +2175,86 @@ static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, co
 		offset[ 1 ] = ( mins[ 1 ] + maxs[ 1 ] ) * 0.5;
 		offset[ 2 ] = ( mins[ 2 ] + maxs[ 2 ] ) * 0.5;
 
-		tw.size[ 0 ][ 0 ] = mins[ 0 ] - offset[ 0 ];
-		tw.size[ 0 ][ 1 ] = mins[ 1 ] - offset[ 1 ];
-		tw.size[ 0 ][ 2 ] = mins[ 2 ] - offset[ 2 ];
+		tw->size[ 0 ][ 0 ] = mins[ 0 ] - offset[ 0 ];
+		tw->size[ 0 ][ 1 ] = mins[ 1 ] - offset[ 1 ];
+		tw->size[ 0 ][ 2 ] = mins[ 2 ] - offset[ 2 ];
 
-		tw.size[ 1 ][ 0 ] = maxs[ 0 ] - offset[ 0 ];
-		tw.size[ 1 ][ 1 ] = maxs[ 1 ] - offset[ 1 ];
-		tw.size[ 1 ][ 2 ] = maxs[ 2 ] - offset[ 2 ];
+		tw->size[ 1 ][ 0 ] = maxs[ 0 ] - offset[ 0 ];
+		tw->size[ 1 ][ 1 ] = maxs[ 1 ] - offset[ 1 ];
+		tw->size[ 1 ][ 2 ] = maxs[ 2 ] - offset[ 2 ];
 
-		tw.start[ 0 ] = start[ 0 ] + offset[ 0 ];
-		tw.start[ 1 ] = start[ 1 ] + offset[ 1 ];
-		tw.start[ 2 ] = start[ 2 ] + offset[ 2 ];
+		tw->start[ 0 ] = start[ 0 ] + offset[ 0 ];
+		tw->start[ 1 ] = start[ 1 ] + offset[ 1 ];
+		tw->start[ 2 ] = start[ 2 ] + offset[ 2 ];
 
-		tw.end[ 0 ] = end[ 0 ] + offset[ 0 ];
-		tw.end[ 1 ] = end[ 1 ] + offset[ 1 ];
-		tw.end[ 2 ] = end[ 2 ] + offset[ 2 ];
+		tw->end[ 0 ] = end[ 0 ] + offset[ 0 ];
+		tw->end[ 1 ] = end[ 1 ] + offset[ 1 ];
+		tw->end[ 2 ] = end[ 2 ] + offset[ 2 ];
 	}
 
 	// if a sphere is already specified
 	if ( sphere )
 	{
-		tw.sphere = *sphere;
+		tw->sphere = *sphere;
 	}
 	else
 	{
-		tw.sphere.radius = ( tw.size[ 1 ][ 0 ] > tw.size[ 1 ][ 2 ] ) ? tw.size[ 1 ][ 2 ] : tw.size[ 1 ][ 0 ];
-		tw.sphere.halfheight = tw.size[ 1 ][ 2 ];
-		VectorSet( tw.sphere.offset, 0, 0, tw.size[ 1 ][ 2 ] - tw.sphere.radius );
+		tw->sphere.radius = ( tw->size[ 1 ][ 0 ] > tw->size[ 1 ][ 2 ] ) ? tw->size[ 1 ][ 2 ] : tw->size[ 1 ][ 0 ];
+		tw->sphere.halfheight = tw->size[ 1 ][ 2 ];
+		VectorSet( tw->sphere.offset, 0, 0, tw->size[ 1 ][ 2 ] - tw->sphere.radius );
 	}
 
-	tw.maxOffset = VectorLength( tw.size[ 1 ] );
+	tw->maxOffset = VectorLength( tw->size[ 1 ] );
 
-	// tw.offsets[signbits] = vector to appropriate corner from origin
-	tw.offsets[ 0 ][ 0 ] = tw.size[ 0 ][ 0 ];
-	tw.offsets[ 0 ][ 1 ] = tw.size[ 0 ][ 1 ];
-	tw.offsets[ 0 ][ 2 ] = tw.size[ 0 ][ 2 ];
+	// tw->offsets[signbits] = vector to appropriate corner from origin
+	tw->offsets[ 0 ][ 0 ] = tw->size[ 0 ][ 0 ];
+	tw->offsets[ 0 ][ 1 ] = tw->size[ 0 ][ 1 ];
+	tw->offsets[ 0 ][ 2 ] = tw->size[ 0 ][ 2 ];
 
-	tw.offsets[ 1 ][ 0 ] = tw.size[ 1 ][ 0 ];
-	tw.offsets[ 1 ][ 1 ] = tw.size[ 0 ][ 1 ];
-	tw.offsets[ 1 ][ 2 ] = tw.size[ 0 ][ 2 ];
+	tw->offsets[ 1 ][ 0 ] = tw->size[ 1 ][ 0 ];
+	tw->offsets[ 1 ][ 1 ] = tw->size[ 0 ][ 1 ];
+	tw->offsets[ 1 ][ 2 ] = tw->size[ 0 ][ 2 ];
 
-	tw.offsets[ 2 ][ 0 ] = tw.size[ 0 ][ 0 ];
-	tw.offsets[ 2 ][ 1 ] = tw.size[ 1 ][ 1 ];
-	tw.offsets[ 2 ][ 2 ] = tw.size[ 0 ][ 2 ];
+	tw->offsets[ 2 ][ 0 ] = tw->size[ 0 ][ 0 ];
+	tw->offsets[ 2 ][ 1 ] = tw->size[ 1 ][ 1 ];
+	tw->offsets[ 2 ][ 2 ] = tw->size[ 0 ][ 2 ];
 
-	tw.offsets[ 3 ][ 0 ] = tw.size[ 1 ][ 0 ];
-	tw.offsets[ 3 ][ 1 ] = tw.size[ 1 ][ 1 ];
-	tw.offsets[ 3 ][ 2 ] = tw.size[ 0 ][ 2 ];
+	tw->offsets[ 3 ][ 0 ] = tw->size[ 1 ][ 0 ];
+	tw->offsets[ 3 ][ 1 ] = tw->size[ 1 ][ 1 ];
+	tw->offsets[ 3 ][ 2 ] = tw->size[ 0 ][ 2 ];
 
-	tw.offsets[ 4 ][ 0 ] = tw.size[ 0 ][ 0 ];
-	tw.offsets[ 4 ][ 1 ] = tw.size[ 0 ][ 1 ];
-	tw.offsets[ 4 ][ 2 ] = tw.size[ 1 ][ 2 ];
+	tw->offsets[ 4 ][ 0 ] = tw->size[ 0 ][ 0 ];
+	tw->offsets[ 4 ][ 1 ] = tw->size[ 0 ][ 1 ];
+	tw->offsets[ 4 ][ 2 ] = tw->size[ 1 ][ 2 ];
 
-	tw.offsets[ 5 ][ 0 ] = tw.size[ 1 ][ 0 ];
-	tw.offsets[ 5 ][ 1 ] = tw.size[ 0 ][ 1 ];
-	tw.offsets[ 5 ][ 2 ] = tw.size[ 1 ][ 2 ];
+	tw->offsets[ 5 ][ 0 ] = tw->size[ 1 ][ 0 ];
+	tw->offsets[ 5 ][ 1 ] = tw->size[ 0 ][ 1 ];
+	tw->offsets[ 5 ][ 2 ] = tw->size[ 1 ][ 2 ];
 
-	tw.offsets[ 6 ][ 0 ] = tw.size[ 0 ][ 0 ];
-	tw.offsets[ 6 ][ 1 ] = tw.size[ 1 ][ 1 ];
-	tw.offsets[ 6 ][ 2 ] = tw.size[ 1 ][ 2 ];
+	tw->offsets[ 6 ][ 0 ] = tw->size[ 0 ][ 0 ];
+	tw->offsets[ 6 ][ 1 ] = tw->size[ 1 ][ 1 ];
+	tw->offsets[ 6 ][ 2 ] = tw->size[ 1 ][ 2 ];
 
-	tw.offsets[ 7 ][ 0 ] = tw.size[ 1 ][ 0 ];
-	tw.offsets[ 7 ][ 1 ] = tw.size[ 1 ][ 1 ];
-	tw.offsets[ 7 ][ 2 ] = tw.size[ 1 ][ 2 ];
+	tw->offsets[ 7 ][ 0 ] = tw->size[ 1 ][ 0 ];
+	tw->offsets[ 7 ][ 1 ] = tw->size[ 1 ][ 1 ];
+	tw->offsets[ 7 ][ 2 ] = tw->size[ 1 ][ 2 ];
 
 	//
 	// calculate bounds
 	//
-	if ( tw.type == traceType_t::TT_CAPSULE )
+	if ( tw->type == traceType_t::TT_CAPSULE )
 	{
 		for ( i = 0; i < 3; i++ )
 		{
-			if ( tw.start[ i ] < tw.end[ i ] )
+			if ( tw->start[ i ] < tw->end[ i ] )
 			{
-				tw.bounds[ 0 ][ i ] = tw.start[ i ] - fabsf( tw.sphere.offset[ i ] ) - tw.sphere.radius;
-				tw.bounds[ 1 ][ i ] = tw.end[ i ] + fabsf( tw.sphere.offset[ i ] ) + tw.sphere.radius;
+				tw->bounds[ 0 ][ i ] = tw->start[ i ] - fabsf( tw->sphere.offset[ i ] ) - tw->sphere.radius;
+				tw->bounds[ 1 ][ i ] = tw->end[ i ] + fabsf( tw->sphere.offset[ i ] ) + tw->sphere.radius;
 			}
 			else
 			{
-				tw.bounds[ 0 ][ i ] = tw.end[ i ] - fabsf( tw.sphere.offset[ i ] ) - tw.sphere.radius;
-				tw.bounds[ 1 ][ i ] = tw.start[ i ] + fabsf( tw.sphere.offset[ i ] ) + tw.sphere.radius;
+				tw->bounds[ 0 ][ i ] = tw->end[ i ] - fabsf( tw->sphere.offset[ i ] ) - tw->sphere.radius;
+				tw->bounds[ 1 ][ i ] = tw->start[ i ] + fabsf( tw->sphere.offset[ i ] ) + tw->sphere.radius;
 			}
 		}
 	}
@@ -1978,18 +2262,90 @@ static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, co
 	{
 		for ( i = 0; i < 3; i++ )
 		{
-			if ( tw.start[ i ] < tw.end[ i ] )
+			if ( tw->start[ i ] < tw->end[ i ] )
 			{
-				tw.bounds[ 0 ][ i ] = tw.start[ i ] + tw.size[ 0 ][ i ];
-				tw.bounds[ 1 ][ i ] = tw.end[ i ] + tw.size[ 1 ][ i ];
+				tw->bounds[ 0 ][ i ] = tw->start[ i ] + tw->size[ 0 ][ i ];
+				tw->bounds[ 1 ][ i ] = tw->end[ i ] + tw->size[ 1 ][ i ];
 			}
 			else
 			{
-				tw.bounds[ 0 ][ i ] = tw.end[ i ] + tw.size[ 0 ][ i ];
-				tw.bounds[ 1 ][ i ] = tw.start[ i ] + tw.size[ 1 ][ i ];
+				tw->bounds[ 0 ][ i ] = tw->end[ i ] + tw->size[ 0 ][ i ];
+				tw->bounds[ 1 ][ i ] = tw->start[ i ] + tw->size[ 1 ][ i ];
 			}
 		}
 	}
+}
+
+/*
+==================
+CM_InitSweepExtents
+==================
+*/
+static void CM_InitSweepExtents( traceWork_t *tw )
+{
+	//
+	// check for point special case
+	//
+	if ( tw->size[ 0 ][ 0 ] == 0 && tw->size[ 0 ][ 1 ] == 0 && tw->size[ 0 ][ 2 ] == 0 )
+	{
+		tw->isPoint = true;
+		VectorClear( tw->extents );
+	}
+	else
+	{
+		tw->isPoint = false;
+		tw->extents[ 0 ] = tw->size[ 1 ][ 0 ];
+		tw->extents[ 1 ] = tw->size[ 1 ][ 1 ];
+		tw->extents[ 2 ] = tw->size[ 1 ][ 2 ];
+	}
+}
+
+/*
+==================
+CM_FinishTrace
+==================
+*/
+static void CM_FinishTrace( trace_t *results, traceWork_t *tw, const vec3_t start, const vec3_t end )
+{
+	// generate endpos from the original, unmodified start/end
+	if ( tw->trace.fraction == 1 )
+	{
+		VectorCopy( end, tw->trace.endpos );
+	}
+	else
+	{
+		VectorLerp( start, end, tw->trace.fraction, tw->trace.endpos );
+	}
+
+	*results = tw->trace;
+}
+
+/*
+==================
+CM_Trace
+==================
+*/
+static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, const vec3_t mins,
+                      const vec3_t maxs, clipHandle_t model, const vec3_t origin, int brushmask,
+                      int skipmask, traceType_t type, const sphere_t *sphere )
+{
+	cmodel_t    *cmod;
+
+	cmod = CM_ClipHandleToModel( model );
+
+	CM_CountStat( cmStat_t::TRACES ); // for statistics
+
+	// fill in a default trace
+	traceWork_t tw{};
+	CM_BeginTraceVisits( &tw ); // for multi-check avoidance
+	CM_InitTraceWork( &tw, start, end, mins, maxs, origin, brushmask, skipmask, type, sphere );
+
+	if ( !cm.numNodes )
+	{
+		*results = tw.trace;
+
+		return; // map not loaded, shouldn't happen
+	}
 
 	//
 	// check for position test special case
@@ -2036,21 +2392,7 @@ static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, co
 	}
 	else
 	{
-		//
-		// check for point special case
-		//
-		if ( tw.size[ 0 ][ 0 ] == 0 && tw.size[ 0 ][ 1 ] == 0 && tw.size[ 0 ][ 2 ] == 0 )
-		{
-			tw.isPoint = true;
-			VectorClear( tw.extents );
-		}
-		else
-		{
-			tw.isPoint = false;
-			tw.extents[ 0 ] = tw.size[ 1 ][ 0 ];
-			tw.extents[ 1 ] = tw.size[ 1 ][ 1 ];
-			tw.extents[ 2 ] = tw.size[ 1 ][ 2 ];
-		}
+		CM_InitSweepExtents( &tw );
 
 		//
 		// general sweeping through world
@@ -2094,17 +2436,7 @@ static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, co
 		}
 	}
 
-	// generate endpos from the original, unmodified start/end
-	if ( tw.trace.fraction == 1 )
-	{
-		VectorCopy( end, tw.trace.endpos );
-	}
-	else
-	{
-		VectorLerp( start, end, tw.trace.fraction, tw.trace.endpos );
-	}
-
-	*results = tw.trace;
+	CM_FinishTrace( results, &tw, start, end );
 }
 
 /*
@@ -2118,6 +2450,23 @@ void CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end, const
 	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, skipmask, type, nullptr );
 }
 
+/*
+==================
+CM_BoxTraceBatch
+
+Same as CM_BoxTrace for each start and end. Going down the tree with
+the traces together wasn't faster than running them one after the other.
+==================
+*/
+void CM_BoxTraceBatch( trace_t *results, int numTraces, const vec3_t *starts, const vec3_t *ends, const vec3_t mins,
+                       const vec3_t maxs, clipHandle_t model, int brushmask, int skipmask, traceType_t type )
+{
+	for ( int i = 0; i < numTraces; i++ )
+	{
+		CM_Trace( &results[ i ], starts[ i ], ends[ i ], mins, maxs, model, vec3_origin, brushmask, skipmask, type, nullptr );
+	}
+}
+
 /*
 ==================
 CM_TransformedBoxTrace
@@ -2365,7 +2714,7 @@ float CM_DistanceToModel( const vec3_t loc, clipHandle_t model ) {
 	const int *endBrushNum = firstBrushNum + leaf->numLeafBrushes;
 	for ( const int *brushNum = firstBrushNum; brushNum < endBrushNum; brushNum++ )
 	{
-		const cbrush_t *b = &cm.brushes[ *brushNum ];
+		const cbrush_t *b = CM_LeafBrush( *brushNum );
 
 		d1 = CM_DistanceToBrush( loc, b );
 		if( d1 < dist )
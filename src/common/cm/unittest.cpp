@@ -28,6 +28,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ===========================================================================
 */
 
+#include <chrono>
+#include <random>
+#include <thread>
+
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
@@ -184,4 +188,272 @@ TEST_F(TraceTest, BoxHitPatch)
     EXPECT_NEAR(tr.plane.dist, 362.105, PATCH_PLANE_DIST_ATOL);
 }
 
+// loading the same map again resets the collision map kept in memory
+TEST_F(TraceTest, ReloadSameMap)
+{
+    // two areas which aren't connected while their portals are closed
+    vec3_t mins, maxs;
+    CM_ModelBounds(CM_InlineModel(0), mins, maxs);
+    int area1 = -1, area2 = -1;
+    for (float x = mins[0]; x < maxs[0] && area2 < 0; x += 64) {
+        for (float y = mins[1]; y < maxs[1] && area2 < 0; y += 64) {
+            for (float z = mins[2]; z < maxs[2] && area2 < 0; z += 64) {
+                vec3_t point{ x, y, z };
+                int area = CM_LeafArea(CM_PointLeafnum(point));
+                if (area < 0) {
+                    continue;
+                }
+                if (area1 < 0) {
+                    area1 = area;
+                } else if (!CM_AreasConnected(area1, area)) {
+                    area2 = area;
+                }
+            }
+        }
+    }
+    ASSERT_GE(area2, 0);
+
+    CM_AdjustAreaPortalState(area1, area2, true);
+    ASSERT_TRUE(CM_AreasConnected(area1, area2));
+
+    CM_LoadMap("plat23_1.13.4");
+
+    EXPECT_FALSE(CM_AreasConnected(area1, area2));
+
+    trace_t tr;
+    vec3_t start{ 143.9, 1880.8, -126.7 };
+    vec3_t end{ 160.9, 1863.8, -126.7 };
+    vec3_t boxMins{ -32, -32, -22 };
+    vec3_t boxMaxs{ 32, 32, 70 };
+
+    CM_BoxTrace(&tr, start, end, boxMins, boxMaxs, CM_InlineModel(0), contentmask, skipmask, traceType_t::TT_AABB);
+    EXPECT_TRUE(tr.allsolid);
+}
+
+// traces on several threads don't disturb each other, including those against their box models
+TEST_F(TraceTest, ConcurrentTraces)
+{
+    vec3_t start{ -1990, 1855, 70 };
+    vec3_t end{ -1990, 1855, 150 };
+    vec3_t mins{ -9, -9, -30 };
+    vec3_t maxs{ 9, 9, 40 };
+
+    trace_t expected;
+    CM_BoxTrace(&expected, start, end, mins, maxs, CM_InlineModel(0), contentmask, skipmask, traceType_t::TT_AABB);
+
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4);
+
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            // every thread gets a box of its own size
+            vec3_t boxMins{ -1.0f - t, -1.0f - t, -1.0f - t };
+            vec3_t boxMaxs{ 1.0f + t, 1.0f + t, 1.0f + t };
+            vec3_t boxStart{ -100, 0, 0 };
+            vec3_t boxEnd{ 100, 0, 0 };
+
+            for (int i = 0; i < 200; i++) {
+                trace_t tr;
+                CM_BoxTrace(&tr, start, end, mins, maxs, CM_InlineModel(0), contentmask, skipmask, traceType_t::TT_AABB);
+
+                if (tr.fraction != expected.fraction || tr.startsolid != expected.startsolid) {
+                    failures[t]++;
+                }
+
+                clipHandle_t box = CM_TempBoxModel(boxMins, boxMaxs, false);
+                CM_BoxTrace(&tr, boxStart, boxEnd, nullptr, nullptr, box, contentmask, skipmask, traceType_t::TT_AABB);
+
+                // each unit of box size is 0.005 of the trace
+                if (std::abs(tr.fraction - (99.0f - t) / 200.0f) > 0.002f) {
+                    failures[t]++;
+                }
+            }
+        });
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_THAT(failures, ::testing::Each(0));
+}
+
+// Rays of up to 512 units inside the world, some of them position tests,
+// starting in groups within 64 units of each other
+void RandomRays(std::mt19937& rng, int count, int group, vec3_t* starts, vec3_t* ends)
+{
+    vec3_t worldMins, worldMaxs;
+    CM_ModelBounds(CM_InlineModel(0), worldMins, worldMaxs);
+    std::uniform_real_distribution<float> near(-64, 64);
+    std::uniform_real_distribution<float> move(-512, 512);
+    vec3_t center;
+
+    for (int i = 0; i < count; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (i % group == 0) {
+                std::uniform_real_distribution<float> coord(worldMins[axis], worldMaxs[axis]);
+                center[axis] = coord(rng);
+            }
+            starts[i][axis] = center[axis] + near(rng);
+            ends[i][axis] = i % 16 ? starts[i][axis] + move(rng) : starts[i][axis];
+        }
+    }
+}
+
+// batched traces give exactly the results of separate ones
+TEST_F(TraceTest, BoxTraceBatch)
+{
+    const int count = 1000;
+    std::mt19937 rng(1);
+    std::unique_ptr<vec3_t[]> starts(new vec3_t[count]);
+    std::unique_ptr<vec3_t[]> ends(new vec3_t[count]);
+    RandomRays(rng, count, 4, starts.get(), ends.get());
+
+    vec3_t sizes[][2] = {
+        { { 0, 0, 0 }, { 0, 0, 0 } },
+        { { -15, -15, -24 }, { 15, 15, 32 } },
+        { { -3, -5, -7 }, { 11, 9, 13 } },
+    };
+
+    for (auto& size : sizes) {
+        std::vector<trace_t> batch(count);
+        CM_BoxTraceBatch(batch.data(), count, starts.get(), ends.get(), size[0], size[1], CM_InlineModel(0),
+                         contentmask, skipmask, traceType_t::TT_AABB);
+
+        for (int i = 0; i < count; i++) {
+            trace_t tr;
+            CM_BoxTrace(&tr, starts[i], ends[i], size[0], size[1], CM_InlineModel(0), contentmask, skipmask,
+                        traceType_t::TT_AABB);
+
+            SCOPED_TRACE(i);
+            EXPECT_EQ(tr.fraction, batch[i].fraction);
+            EXPECT_EQ(tr.endpos[0], batch[i].endpos[0]);
+            EXPECT_EQ(tr.endpos[1], batch[i].endpos[1]);
+            EXPECT_EQ(tr.endpos[2], batch[i].endpos[2]);
+            EXPECT_EQ(tr.plane.normal[0], batch[i].plane.normal[0]);
+            EXPECT_EQ(tr.plane.normal[1], batch[i].plane.normal[1]);
+            EXPECT_EQ(tr.plane.normal[2], batch[i].plane.normal[2]);
+            EXPECT_EQ(tr.plane.dist, batch[i].plane.dist);
+            EXPECT_EQ(tr.startsolid, batch[i].startsolid);
+            EXPECT_EQ(tr.allsolid, batch[i].allsolid);
+            EXPECT_EQ(tr.surfaceFlags, batch[i].surfaceFlags);
+            EXPECT_EQ(tr.contents, batch[i].contents);
+        }
+    }
+}
+
+// the collision data of the surfaces read back from the cache gives the same traces
+TEST_F(TraceTest, SurfaceCache)
+{
+    const int count = 1000;
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> offset(-64, 64), move(-128, 128);
+    std::unique_ptr<vec3_t[]> starts(new vec3_t[count]);
+    std::unique_ptr<vec3_t[]> ends(new vec3_t[count]);
+    vec3_t mins{ -15, -15, -24 };
+    vec3_t maxs{ 15, 15, 32 };
+
+    // rays around the patches of the tests above
+    const vec3_t patches[] = { { -1990, 1855, 110 }, { 1775, 1114, 150 }, { 1617, 2020, 120 } };
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < 3; j++) {
+            starts[i][j] = patches[i % 3][j] + offset(rng);
+            ends[i][j] = starts[i][j] + move(rng);
+        }
+    }
+
+    // generate the surfaces, then save them
+    Cvar::SetValue("cm_surfaceCache", "0");
+    CM_ClearMap();
+    CM_LoadMap("plat23_1.13.4");
+
+    std::vector<trace_t> expected(count);
+    for (int i = 0; i < count; i++) {
+        CM_BoxTrace(&expected[i], starts[i], ends[i], mins, maxs, CM_InlineModel(0), contentmask, skipmask,
+                    traceType_t::TT_AABB);
+    }
+
+    Cvar::SetValue("cm_surfaceCache", "1");
+    CM_ClearMap();
+    CM_LoadMap("plat23_1.13.4");
+    ASSERT_TRUE(FS::HomePath::FileExists("collisionCache/plat23_1.13.4.surfaces"));
+
+    CM_ClearMap();
+    CM_LoadMap("plat23_1.13.4");
+
+    for (int i = 0; i < count; i++) {
+        trace_t tr;
+        CM_BoxTrace(&tr, starts[i], ends[i], mins, maxs, CM_InlineModel(0), contentmask, skipmask,
+                    traceType_t::TT_AABB);
+
+        SCOPED_TRACE(i);
+        EXPECT_EQ(expected[i].fraction, tr.fraction);
+        EXPECT_EQ(expected[i].endpos[0], tr.endpos[0]);
+        EXPECT_EQ(expected[i].endpos[1], tr.endpos[1]);
+        EXPECT_EQ(expected[i].endpos[2], tr.endpos[2]);
+        EXPECT_EQ(expected[i].plane.normal[0], tr.plane.normal[0]);
+        EXPECT_EQ(expected[i].plane.normal[1], tr.plane.normal[1]);
+        EXPECT_EQ(expected[i].plane.normal[2], tr.plane.normal[2]);
+        EXPECT_EQ(expected[i].plane.dist, tr.plane.dist);
+        EXPECT_EQ(expected[i].startsolid, tr.startsolid);
+        EXPECT_EQ(expected[i].allsolid, tr.allsolid);
+        EXPECT_EQ(expected[i].surfaceFlags, tr.surfaceFlags);
+        EXPECT_EQ(expected[i].contents, tr.contents);
+    }
+}
+
+// Run with GTEST_ALSO_RUN_DISABLED_TESTS=1
+TEST_F(TraceTest, DISABLED_SurfaceCacheBenchmark)
+{
+    const int rounds = 20;
+
+    for (const char* cache : { "0", "1" }) {
+        Cvar::SetValue("cm_surfaceCache", cache);
+        CM_ClearMap();
+        CM_LoadMap("plat23_1.13.4");
+
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++) {
+            CM_ClearMap();
+            CM_LoadMap("plat23_1.13.4");
+        }
+        std::chrono::duration<double, std::milli> loads = std::chrono::steady_clock::now() - start;
+
+        printf("cache %s %8.2f ms/load\n", cache, loads.count() / rounds);
+    }
+}
+
+// Run with GTEST_ALSO_RUN_DISABLED_TESTS=1
+TEST_F(TraceTest, DISABLED_TreeDescentBenchmark)
+{
+    const int count = 4096, rounds = 50;
+    std::mt19937 rng(1);
+    std::unique_ptr<vec3_t[]> starts(new vec3_t[count]);
+    std::unique_ptr<vec3_t[]> ends(new vec3_t[count]);
+    RandomRays(rng, count, 32, starts.get(), ends.get());
+    vec3_t zero{ 0, 0, 0 };
+    trace_t tr;
+    int leafs = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds * 10; round++) {
+        for (int i = 0; i < count; i++) {
+            leafs += CM_PointLeafnum(starts[i]);
+        }
+    }
+    std::chrono::duration<double> points = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < count; i++) {
+            CM_BoxTrace(&tr, starts[i], ends[i], zero, zero, CM_InlineModel(0), contentmask, skipmask,
+                        traceType_t::TT_AABB);
+        }
+    }
+    std::chrono::duration<double> traces = std::chrono::steady_clock::now() - start;
+
+    printf("leafnum  %8.1f points/ms (%d)\n", count * rounds * 10 / points.count() / 1e3, leafs);
+    printf("point    %8.1f traces/ms\n", count * rounds / traces.count() / 1e3);
+}
+
 } // namespace
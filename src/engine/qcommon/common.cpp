@@ -284,16 +284,20 @@ std::unique_ptr<Sys::EventBase> Com_GetEvent()
 		Com_QueueEvent( Util::make_unique<Sys::ConsoleInputEvent>( s ) );
 	}
 
+	// send what was batched since the last time we got here
+	NET_FlushSendBatch();
+
 	// check for network packets
 	msg_t netmsg;
 	netadr_t adr;
 	MSG_Init( &netmsg, sys_packetReceived, sizeof( sys_packetReceived ) );
 	adr.type = netadrtype_t::NA_UNSPEC;
 
-	if ( Sys_GetPacket( &adr, &netmsg ) )
+	// the packets of the receive thread are handled by Com_EventLoop
+	if ( !NET_ReceiveThreadRunning() && Sys_GetPacket( &adr, &netmsg ) )
 	{
 		Com_QueueEvent( Util::make_unique<Sys::PacketEvent>(
-			adr, &netmsg.data[ netmsg.readcount ], netmsg.cursize - netmsg.readcount ) );
+			adr, &netmsg.data[ netmsg.readcount ], netmsg.cursize - netmsg.readcount, Sys::Milliseconds() ) );
 	}
 
 	// return if we have data
@@ -311,7 +315,7 @@ std::unique_ptr<Sys::EventBase> Com_GetEvent()
 Com_RunAndTimeServerPacket
 =================
 */
-static void Com_RunAndTimeServerPacket( const netadr_t *evFrom, msg_t *buf )
+static void Com_RunAndTimeServerPacket( const netadr_t *evFrom, msg_t *buf, int time )
 {
 	int t1, t2, msec;
 
@@ -322,7 +326,7 @@ static void Com_RunAndTimeServerPacket( const netadr_t *evFrom, msg_t *buf )
 		t1 = Sys::Milliseconds();
 	}
 
-	SV_PacketEvent( *evFrom, buf );
+	SV_PacketEvent( *evFrom, buf, time );
 
 	if ( com_speeds->integer )
 	{
@@ -353,7 +357,7 @@ static void HandleConsoleInputEvent(const Sys::ConsoleInputEvent& event)
 	}
 }
 
-static void HandlePacketEvent(const Sys::PacketEvent& event)
+static void HandlePacket( const netadr_t& adr, msg_t *buf, int time )
 {
 	// this cvar allows simulation of connections that
 	// drop a lot of packets.  Note that loopback connections
@@ -367,6 +371,19 @@ static void HandlePacketEvent(const Sys::PacketEvent& event)
 			return; // drop this packet
 		}
 	}
+
+	if ( com_sv_running->integer )
+	{
+		Com_RunAndTimeServerPacket( &adr, buf, time );
+	}
+	else
+	{
+		CL_PacketEvent( adr, buf );
+	}
+}
+
+static void HandlePacketEvent(const Sys::PacketEvent& event)
+{
 	msg_t buf;
 	byte bufData[ MAX_MSGLEN ];
 	MSG_Init( &buf, bufData, sizeof( bufData ) );
@@ -384,14 +401,7 @@ static void HandlePacketEvent(const Sys::PacketEvent& event)
 	buf.cursize = event.data.size();
 	memcpy( buf.data, event.data.data(), buf.cursize );
 
-	if ( com_sv_running->integer )
-	{
-		Com_RunAndTimeServerPacket( &event.adr, &buf );
-	}
-	else
-	{
-		CL_PacketEvent( event.adr, &buf );
-	}
+	HandlePacket( event.adr, &buf, event.time );
 }
 
 /*
@@ -414,6 +424,17 @@ void Com_EventLoop()
 
 	while (true)
 	{
+		// the packets of the receive thread are copied straight from its ring,
+		// it already timestamped them on arrival
+		int packetTime;
+		MSG_Init( &buf, bufData, sizeof( bufData ) );
+
+		if ( NET_GetThreadPacket( &evFrom, &buf, &packetTime ) )
+		{
+			HandlePacket( evFrom, &buf, packetTime );
+			continue;
+		}
+
 		auto ev = Com_GetEvent();
 
 		// if no more events are available
@@ -434,7 +455,7 @@ void Com_EventLoop()
 				// if the server just shut down, flush the events
 				if ( com_sv_running->integer )
 				{
-					Com_RunAndTimeServerPacket( &evFrom, &buf );
+					Com_RunAndTimeServerPacket( &evFrom, &buf, Sys::Milliseconds() );
 				}
 			}
 
@@ -1024,16 +1045,11 @@ void Com_Frame()
 	//
 	if ( showTraceStats.Get() )
 	{
-		extern int c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces;
-		extern int c_pointcontents;
-
-		Log::Notice( "%4i traces  (%ib %ip %it) %4i points", c_traces, c_brush_traces, c_patch_traces, c_trisoup_traces,
-		            c_pointcontents );
-		c_traces = 0;
-		c_brush_traces = 0;
-		c_patch_traces = 0;
-		c_trisoup_traces = 0;
-		c_pointcontents = 0;
+		cmStats_t stats = CM_TakeStats();
+
+		Log::Notice( "%4i traces  (%ib %ip %it) %4i points", stats[ Util::ordinal( cmStat_t::TRACES ) ],
+		            stats[ Util::ordinal( cmStat_t::BRUSH_TRACES ) ], stats[ Util::ordinal( cmStat_t::PATCH_TRACES ) ],
+		            stats[ Util::ordinal( cmStat_t::TRISOUP_TRACES ) ], stats[ Util::ordinal( cmStat_t::POINT_CONTENTS ) ] );
 	}
 
 	// old net chan encryption key
@@ -39,7 +39,9 @@ Maryland 20850 USA.
 #include "qcommon/q_shared.h"
 #include "qcommon.h"
 
-static int bloc = 0;
+// bit cursor shared by the helpers below; thread local so that several
+// threads can encode messages at the same time
+static thread_local int bloc = 0;
 
 //bani - optimized version
 //clears data along the way so we don't have to memset() it ahead of time
@@ -74,6 +76,44 @@ int Huff_getBit( byte *fin, int *offset )
 	return t;
 }
 
+// writes count bits at once, the lowest first, like as many Huff_putBit
+void Huff_putBits( uint64_t bits, int count, byte *fout, int *offset )
+{
+	if ( !count )
+	{
+		return;
+	}
+
+	int x = *offset >> 3;
+	int y = *offset & 7;
+
+	bits <<= y;
+	fout[ x ] = y ? fout[ x ] | byte( bits ) : byte( bits );
+
+	for ( int i = 8; i < y + count; i += 8 )
+	{
+		fout[ ++x ] = byte( bits >> i );
+	}
+
+	*offset += count;
+}
+
+// reads count bits at once, like as many Huff_getBit, the bytes past size being 0
+uint32_t Huff_getBits( const byte *fin, int size, int count, int *offset )
+{
+	int      x = *offset >> 3;
+	int      last = std::min( ( *offset + count + 7 ) >> 3, size );
+	uint64_t window = 0;
+
+	for ( int i = x; i < last; i++ )
+	{
+		window |= uint64_t( fin[ i ] ) << ( 8 * ( i - x ) );
+	}
+
+	*offset += count;
+	return ( window >> ( ( *offset - count ) & 7 ) ) & ( ( uint64_t( 1 ) << count ) - 1 );
+}
+
 //bani - optimized version
 //clears data along the way so we don't have to memset() it ahead of time
 static void add_bit( char bit, byte *fout )
@@ -473,6 +513,100 @@ void Huff_offsetTransmit( huff_t *huff, int ch, byte *fout, int *offset )
 	*offset = bloc;
 }
 
+static void build_codes( huffTables_t *tables, node_t *node, uint64_t code, int length )
+{
+	if ( node->symbol != INTERNAL_NODE )
+	{
+		if ( length > HUFF_MAX_CODE_LENGTH )
+		{
+			Sys::Error( "Huff_BuildTables: code too long" );
+		}
+
+		tables->code[ node->symbol ] = code;
+		tables->length[ node->symbol ] = length;
+
+		if ( length <= HUFF_LOOKUP_BITS )
+		{
+			/* every index starting with the code */
+			for ( int i = code; i < ( 1 << HUFF_LOOKUP_BITS ); i += 1 << length )
+			{
+				tables->lookup[ i ] = node->symbol | length << 9;
+			}
+		}
+
+		return;
+	}
+
+	if ( length == HUFF_LOOKUP_BITS )
+	{
+		tables->subtree[ code ] = node;
+	}
+
+	build_codes( tables, node->left, code, length + 1 );
+	build_codes( tables, node->right, code | uint64_t( 1 ) << length, length + 1 );
+}
+
+/* Compile the codes of a tree which won't be updated anymore, so that a symbol
+ * is sent or received with one lookup instead of a walk through the tree.
+ * The tree must stay alive, as it's still walked for the longest codes */
+void Huff_BuildTables( huffTables_t *tables, node_t *tree )
+{
+	*tables = {};
+
+	if ( tree->symbol == INTERNAL_NODE )
+	{
+		build_codes( tables, tree, 0, 0 );
+		return;
+	}
+
+	/* a tree with only the NYT node has no code, receiving reads no bit */
+	for ( unsigned short &entry : tables->lookup )
+	{
+		entry = tree->symbol;
+	}
+}
+
+/* Get a symbol, giving the same result as Huff_offsetReceive. The bytes
+ * past size are read as 0 */
+void Huff_tableReceive( const huffTables_t *tables, int *ch, const byte *fin, int size, int *offset )
+{
+	int      x = *offset >> 3;
+	uint32_t window;
+
+	if ( x + 3 <= size )
+	{
+		window = fin[ x ] | fin[ x + 1 ] << 8 | fin[ x + 2 ] << 16;
+	}
+	else
+	{
+		window = 0;
+
+		for ( int i = 0; x + i < size && i < 3; i++ )
+		{
+			window |= fin[ x + i ] << ( 8 * i );
+		}
+	}
+
+	int index = ( window >> ( *offset & 7 ) ) & ( ( 1 << HUFF_LOOKUP_BITS ) - 1 );
+	int entry = tables->lookup[ index ];
+
+	if ( !entry )
+	{
+		*offset += HUFF_LOOKUP_BITS;
+		Huff_offsetReceive( tables->subtree[ index ], ch, const_cast<byte *>( fin ), offset );
+		return;
+	}
+
+	*ch = entry & 0x1ff;
+	*offset += entry >> 9;
+}
+
+/* Send a symbol, giving the same result as Huff_offsetTransmit */
+void Huff_tableTransmit( const huffTables_t *tables, int ch, byte *fout, int *offset )
+{
+	Huff_putBits( tables->code[ ch ], tables->length[ ch ], fout, offset );
+}
+
 void Huff_Decompress( msg_t *mbuf, int offset )
 {
 	int    ch, cch, i, j, size;
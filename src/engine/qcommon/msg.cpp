@@ -37,6 +37,7 @@ Maryland 20850 USA.
 #include "qcommon.h"
 
 static huffman_t msgHuff;
+static huffTables_t msgHuffTables;
 static bool  msgInit = false;
 
 /*
@@ -190,34 +191,95 @@ void MSG_WriteBits( msg_t *msg, int value, int bits )
 	}
 	else
 	{
-		value &= ( 0xffffffff >> ( 32 - bits ) );
+		unsigned int uvalue = value & ( 0xffffffff >> ( 32 - bits ) );
 
-		if ( bits & 7 )
-		{
-			int nbits;
+		// the raw low bits and the codes of the bytes are gathered
+		// in an accumulator, written out when it can't take more
+		int      nbits = bits & 7;
+		uint64_t accumulator = uvalue & ( ( 1 << nbits ) - 1 );
+		int      count = nbits;
+
+		uvalue >>= nbits;
 
-			nbits = bits & 7;
+		for ( i = nbits; i < bits; i += 8 )
+		{
+			int length = msgHuffTables.length[ uvalue & 0xff ];
 
-			for ( i = 0; i < nbits; i++ )
+			if ( count + length > HUFF_MAX_CODE_LENGTH )
 			{
-				Huff_putBit( ( value & 1 ), msg->data, &msg->bit );
-				value = ( value >> 1 );
+				Huff_putBits( accumulator, count, msg->data, &msg->bit );
+				accumulator = 0;
+				count = 0;
 			}
 
-			bits = bits - nbits;
+			accumulator |= msgHuffTables.code[ uvalue & 0xff ] << count;
+			count += length;
+			uvalue >>= 8;
 		}
 
-		if ( bits )
+		Huff_putBits( accumulator, count, msg->data, &msg->bit );
+
+		msg->cursize = ( msg->bit >> 3 ) + 1;
+	}
+}
+
+/*
+=================
+MSG_WriteEncodedBits
+
+Appends bits written by the MSG_Write functions to another non-oob
+message, starting at its first bit, as if the same calls had been made
+on msg. uncompressedBits is what they added to the other uncompsize.
+=================
+*/
+void MSG_WriteEncodedBits( msg_t *msg, const byte *data, int bits, int uncompressedBits )
+{
+	msg->uncompsize += uncompressedBits;
+
+	if ( !bits )
+	{
+		return;
+	}
+
+	// this isn't an exact overflow check, but close enough
+	if ( msg->maxsize - ( ( msg->bit + bits ) >> 3 ) - 1 < 32 )
+	{
+		msg->overflowed = true;
+		return;
+	}
+
+	if ( msg->oob )
+	{
+		Sys::Drop( "MSG_WriteEncodedBits: can't append to an oob message" );
+	}
+
+	// the bits past msg->bit in its last byte are always clear,
+	// as the Huffman code clears every byte when starting it
+	for ( int i = 0; i < bits; i += 8 )
+	{
+		int n = std::min( 8, bits - i );
+		int value = data[ i >> 3 ] & ( ( 1 << n ) - 1 );
+		int x = msg->bit >> 3;
+		int y = msg->bit & 7;
+
+		if ( !y )
 		{
-			for ( i = 0; i < bits; i += 8 )
+			msg->data[ x ] = value;
+		}
+		else
+		{
+			msg->data[ x ] |= value << y;
+
+			if ( y + n > 8 )
 			{
-				Huff_offsetTransmit( &msgHuff.compressor, ( value & 0xff ), msg->data, &msg->bit );
-				value = ( value >> 8 );
+				msg->data[ x + 1 ] = value >> ( 8 - y );
 			}
 		}
 
-		msg->cursize = ( msg->bit >> 3 ) + 1;
+		msg->bit += n;
 	}
+
+	msg->cursize = ( msg->bit >> 3 ) + 1;
 }
 
 int MSG_ReadBits( msg_t *msg, int bits )
@@ -270,14 +332,11 @@ int MSG_ReadBits( msg_t *msg, int bits )
 	}
 	else
 	{
-		for ( i = 0; i < ( bits & 7 ); i++ )
-		{
-			value |= ( Huff_getBit( msg->data, &msg->bit ) << i );
-		}
+		value = Huff_getBits( msg->data, msg->maxsize, bits & 7, &msg->bit );
 
-		for ( ; i < bits; i += 8 )
+		for ( i = bits & 7; i < bits; i += 8 )
 		{
-			Huff_offsetReceive( msgHuff.decompressor.tree, &get, msg->data, &msg->bit );
+			Huff_tableReceive( &msgHuffTables, &get, msg->data, msg->maxsize, &msg->bit );
 			value |= get << i;
 		}
 
@@ -491,7 +550,7 @@ float MSG_ReadFloat( msg_t *msg )
 
 char           *MSG_ReadString( msg_t *msg )
 {
-	static char string[ MAX_STRING_CHARS ];
+	static thread_local char string[ MAX_STRING_CHARS ];
 	unsigned l;
     int c;
 
@@ -518,7 +577,7 @@ char           *MSG_ReadString( msg_t *msg )
 
 char           *MSG_ReadBigString( msg_t *msg )
 {
-	static char string[ BIG_INFO_STRING ];
+	static thread_local char string[ BIG_INFO_STRING ];
 	unsigned l;
     int c;
 
@@ -545,7 +604,7 @@ char           *MSG_ReadBigString( msg_t *msg )
 
 char           *MSG_ReadStringLine( msg_t *msg )
 {
-	static char string[ MAX_STRING_CHARS ];
+	static thread_local char string[ MAX_STRING_CHARS ];
 	unsigned l;
     int c;
 
@@ -1047,6 +1106,82 @@ void MSG_WriteDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, b
 	*/
 }
 
+/*
+==================
+MSG_DeltaEntityBits
+
+The number of bits MSG_WriteDeltaEntity would write for a delta, before the
+Huffman compression, without writing it
+==================
+*/
+int MSG_DeltaEntityBits( const entityState_t *from, const entityState_t *to, bool force )
+{
+	const netField_t *field;
+	const int        *fromF, *toF;
+	const int        numFields = ARRAY_LEN( entityStateFields );
+	int              i, lc = 0;
+
+	for ( i = 0, field = entityStateFields; i < numFields; i++, field++ )
+	{
+		fromF = ( const int * )( ( const byte * ) from + field->offset );
+		toF = ( const int * )( ( const byte * ) to + field->offset );
+
+		if ( *fromF != *toF )
+		{
+			lc = i + 1;
+		}
+	}
+
+	if ( lc == 0 )
+	{
+		return force ? GENTITYNUM_BITS + 2 : 0;
+	}
+
+	// number, not removed, has a delta, # of changes
+	int bits = GENTITYNUM_BITS + 2 + 8;
+
+	for ( i = 0, field = entityStateFields; i < lc; i++, field++ )
+	{
+		fromF = ( const int * )( ( const byte * ) from + field->offset );
+		toF = ( const int * )( ( const byte * ) to + field->offset );
+
+		// changed, and zero or not
+		bits += *fromF == *toF ? 1 : 2;
+
+		if ( *fromF == *toF || *toF == 0 )
+		{
+			continue;
+		}
+
+		if ( field->bits == 0 )
+		{
+			float fullFloat = * ( const float * ) toF;
+			int   trunc = ( int ) fullFloat;
+
+			if ( fullFloat == 0.0f )
+			{
+				// -0.0f
+				continue;
+			}
+
+			if ( trunc == fullFloat && trunc + FLOAT_INT_BIAS >= 0 && trunc + FLOAT_INT_BIAS < ( 1 << FLOAT_INT_BITS ) )
+			{
+				bits += 1 + FLOAT_INT_BITS;
+			}
+			else
+			{
+				bits += 1 + 32;
+			}
+		}
+		else
+		{
+			bits += field->bits;
+		}
+	}
+
+	return bits;
+}
+
 /*
 ==================
 MSG_ReadDeltaEntity
@@ -1256,6 +1391,10 @@ void MSG_InitNetcodeTables(NetcodeTable playerStateTable, int psSize) {
 	playerStateFields = std::move(playerStateTable);
 	playerStateSize = psSize;
 }
+
+bool MSG_HaveNetcodeTables() {
+	return !playerStateFields.empty();
+}
 // TODO: add function to clear
 
 
@@ -1884,6 +2023,9 @@ void MSG_initHuffman()
 			Huff_addRef( &msgHuff.decompressor, ( byte ) i );  /* Do update */
 		}
 	}
+
+	// both trees got the same updates, so the codes are the same
+	Huff_BuildTables( &msgHuffTables, msgHuff.decompressor.tree );
 }
 
 //===========================================================================
@@ -0,0 +1,497 @@
+/*
+===========================================================================
+Daemon BSD Source Code
+Copyright (c) 2024, Daemon Developers
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Daemon developers nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DAEMON DEVELOPERS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================
+*/
+
+#include <chrono>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "common/Common.h"
+#include "qcommon/qcommon.h"
+
+namespace {
+
+struct bitWrite_t
+{
+    int value;
+    int bits;
+};
+
+std::vector<bitWrite_t> RandomWrites(std::mt19937 &rng, int count)
+{
+    std::vector<bitWrite_t> writes;
+
+    for (int i = 0; i < count; i++)
+    {
+        int bits = std::uniform_int_distribution<int>(1, 32)(rng);
+        writes.push_back({ static_cast<int>(rng()), bits });
+    }
+
+    return writes;
+}
+
+void Write(msg_t *msg, const std::vector<bitWrite_t> &writes)
+{
+    for (const bitWrite_t &write : writes)
+    {
+        MSG_WriteBits(msg, write.value, write.bits);
+    }
+}
+
+TEST(MsgTest, EncodedBitsMatchDirectWrites)
+{
+    std::mt19937 rng(42);
+
+    for (int iteration = 0; iteration < 200; iteration++)
+    {
+        std::vector<bitWrite_t> prefix = RandomWrites(rng, iteration % 9);
+        std::vector<bitWrite_t> middle = RandomWrites(rng, iteration % 13);
+        std::vector<bitWrite_t> suffix = RandomWrites(rng, 3);
+
+        // zeroed, as the last byte counted by cursize isn't written when the bits end with a byte
+        byte directBuffer[1024]{}, encodedBuffer[1024]{}, copiedBuffer[1024]{};
+        msg_t direct, encoded, copied;
+
+        MSG_Init(&direct, directBuffer, sizeof(directBuffer));
+        Write(&direct, prefix);
+        Write(&direct, middle);
+        Write(&direct, suffix);
+
+        MSG_Init(&encoded, encodedBuffer, sizeof(encodedBuffer));
+        Write(&encoded, middle);
+
+        MSG_Init(&copied, copiedBuffer, sizeof(copiedBuffer));
+        Write(&copied, prefix);
+        MSG_WriteEncodedBits(&copied, encodedBuffer, encoded.bit, encoded.uncompsize);
+        Write(&copied, suffix);
+
+        ASSERT_EQ(direct.bit, copied.bit);
+        ASSERT_EQ(direct.cursize, copied.cursize);
+        ASSERT_EQ(direct.uncompsize, copied.uncompsize);
+        ASSERT_EQ(0, memcmp(directBuffer, copiedBuffer, direct.cursize));
+    }
+}
+
+uint32_t Hash(const byte *data, int size)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+TEST(MsgTest, BitsRoundTrip)
+{
+    std::mt19937 rng(3);
+    std::vector<bitWrite_t> writes = RandomWrites(rng, 2000);
+    std::vector<byte> buffer(16384);
+    msg_t msg;
+
+    MSG_Init(&msg, buffer.data(), buffer.size());
+    Write(&msg, writes);
+    ASSERT_FALSE(msg.overflowed);
+
+    // the wire format must not change
+    EXPECT_EQ(3962579590u, Hash(buffer.data(), msg.cursize));
+
+    MSG_BeginReading(&msg);
+    for (const bitWrite_t &write : writes)
+    {
+        int mask = write.bits == 32 ? -1 : (1 << write.bits) - 1;
+        ASSERT_EQ(write.value & mask, MSG_ReadBits(&msg, write.bits) & mask);
+    }
+}
+
+// A stream of entities moving around
+struct snapshotStream_t
+{
+    std::vector<std::vector<entityState_t>> frames;
+
+    snapshotStream_t(int numEntities, int numFrames)
+    {
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<float> step(-16.0f, 16.0f);
+        std::vector<entityState_t> entities(numEntities);
+
+        for (int i = 0; i < numEntities; i++)
+        {
+            entityState_t &es = entities[i];
+            memset(&es, 0, sizeof(es));
+            es.number = i;
+            es.eType = static_cast<entityType_t>(rng() % 4);
+            es.modelindex = rng() % 256;
+            es.pos.trType = trType_t::TR_LINEAR;
+            for (int j = 0; j < 3; j++)
+            {
+                es.origin[j] = es.pos.trBase[j] = std::uniform_int_distribution<int>(-4096, 4096)(rng);
+            }
+        }
+
+        for (int frame = 0; frame < numFrames; frame++)
+        {
+            for (entityState_t &es : entities)
+            {
+                // a third of them stays still
+                if (es.number % 3 == 0)
+                {
+                    continue;
+                }
+
+                es.pos.trTime = frame * 50;
+                for (int j = 0; j < 3; j++)
+                {
+                    es.pos.trBase[j] += step(rng);
+                    es.pos.trDelta[j] = step(rng) * 20;
+                    es.origin[j] = es.pos.trBase[j];
+                }
+                es.apos.trBase[YAW] = std::uniform_real_distribution<float>(0, 360)(rng);
+                es.frame = (es.frame + 1) % 64;
+
+                if (rng() % 16 == 0)
+                {
+                    es.event = rng() % 64;
+                    es.eventParm = rng() % 256;
+                }
+            }
+
+            frames.push_back(entities);
+        }
+    }
+
+    // Writes every frame delta compressed from the previous one
+    int Write(msg_t *msg, int frame) const
+    {
+        for (size_t i = 0; i < frames[frame].size(); i++)
+        {
+            entityState_t from = frame ? frames[frame - 1][i] : entityState_t{};
+            entityState_t to = frames[frame][i];
+            MSG_WriteDeltaEntity(msg, &from, &to, true);
+        }
+        return msg->cursize;
+    }
+};
+
+TEST(MsgTest, SnapshotStreamRoundTrip)
+{
+    snapshotStream_t stream(128, 20);
+    std::vector<byte> buffer(MAX_MSGLEN);
+    uint32_t hash = 0;
+
+    for (size_t frame = 0; frame < stream.frames.size(); frame++)
+    {
+        msg_t msg;
+        MSG_Init(&msg, buffer.data(), buffer.size());
+        stream.Write(&msg, frame);
+        ASSERT_FALSE(msg.overflowed);
+        hash = hash * 31 + Hash(buffer.data(), msg.cursize);
+
+        MSG_BeginReading(&msg);
+        for (size_t i = 0; i < stream.frames[frame].size(); i++)
+        {
+            entityState_t from = frame ? stream.frames[frame - 1][i] : entityState_t{};
+            entityState_t to;
+            int number = MSG_ReadBits(&msg, GENTITYNUM_BITS);
+            ASSERT_EQ(static_cast<int>(i), number);
+            MSG_ReadDeltaEntity(&msg, &from, &to, number);
+            ASSERT_EQ(0, memcmp(&to, &stream.frames[frame][i], sizeof(to)));
+        }
+    }
+
+    // the wire format must not change
+    EXPECT_EQ(163389972u, hash);
+}
+
+TEST(MsgTest, DeltaEntityBitsMatchWrites)
+{
+    snapshotStream_t stream(128, 20);
+    std::vector<byte> buffer(MAX_MSGLEN);
+
+    for (size_t frame = 1; frame < stream.frames.size(); frame++)
+    {
+        for (size_t i = 0; i < stream.frames[frame].size(); i++)
+        {
+            for (bool force : { false, true })
+            {
+                entityState_t from = stream.frames[frame - 1][i];
+                entityState_t to = stream.frames[frame][i];
+                msg_t msg;
+                MSG_Init(&msg, buffer.data(), buffer.size());
+                MSG_WriteDeltaEntity(&msg, &from, &to, force);
+                ASSERT_EQ(msg.uncompsize, MSG_DeltaEntityBits(&from, &to, force));
+            }
+        }
+    }
+}
+
+// Run with GTEST_ALSO_RUN_DISABLED_TESTS=1
+TEST(MsgTest, DISABLED_SnapshotStreamBenchmark)
+{
+    snapshotStream_t stream(256, 100);
+    std::vector<byte> buffer(MAX_MSGLEN * 4);
+    const int rounds = 20;
+    size_t bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (size_t frame = 0; frame < stream.frames.size(); frame++)
+        {
+            msg_t msg;
+            MSG_Init(&msg, buffer.data(), buffer.size());
+            bytes += stream.Write(&msg, frame);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("encode %8.1f MB/s\n", bytes / elapsed.count() / 1e6);
+    EXPECT_NE(0u, bytes);
+}
+
+// The entity deltas of a frame for 48 clients, each having acked one of the
+// last 4 frames, encoded for every client or once and copied like the
+// delta cache of sv_snapshot.cpp does.
+// Run with GTEST_ALSO_RUN_DISABLED_TESTS=1
+TEST(MsgTest, DISABLED_DeltaEntityCacheBenchmark)
+{
+    const int numClients = 48, numEntities = 256, acks = 4;
+    snapshotStream_t stream(numEntities, 100);
+    std::vector<byte> buffer(MAX_MSGLEN);
+    std::vector<std::vector<byte>> cached(acks * numEntities, std::vector<byte>(MAX_MSGLEN));
+    std::vector<msg_t> cachedMsgs(acks * numEntities);
+    size_t bytes[2] = {};
+
+    for (bool cache : { false, true })
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t frame = acks; frame < stream.frames.size(); frame++)
+        {
+            for (int i = 0; i < acks * numEntities; i++)
+            {
+                cachedMsgs[i].bit = -1;
+            }
+
+            for (int client = 0; client < numClients; client++)
+            {
+                int ack = client % acks;
+                msg_t msg;
+                MSG_Init(&msg, buffer.data(), buffer.size());
+
+                for (int i = 0; i < numEntities; i++)
+                {
+                    entityState_t from = stream.frames[frame - 1 - ack][i];
+                    entityState_t to = stream.frames[frame][i];
+                    msg_t &delta = cachedMsgs[ack * numEntities + i];
+
+                    if (!cache)
+                    {
+                        MSG_WriteDeltaEntity(&msg, &from, &to, false);
+                        continue;
+                    }
+
+                    if (delta.bit < 0)
+                    {
+                        MSG_Init(&delta, cached[ack * numEntities + i].data(), MAX_MSGLEN);
+                        MSG_WriteDeltaEntity(&delta, &from, &to, false);
+                    }
+                    else
+                    {
+                        // the cache compares the states it is given
+                        EXPECT_EQ(0, memcmp(&to, &stream.frames[frame][i], sizeof(to)));
+                    }
+                    MSG_WriteEncodedBits(&msg, delta.data, delta.bit, delta.uncompsize);
+                }
+
+                bytes[cache] += msg.cursize;
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf("cache %d %8.3f ms per frame\n", cache, elapsed.count() * 1e3 / (stream.frames.size() - acks));
+    }
+
+    EXPECT_EQ(bytes[0], bytes[1]);
+}
+
+// Adaptive Huffman trees like the one of msg.cpp, from random weights
+// skewed enough to have codes longer than HUFF_LOOKUP_BITS
+std::unique_ptr<huffman_t> RandomHuffman(std::mt19937 &rng, std::vector<int> &symbols)
+{
+    auto huff = Util::make_unique<huffman_t>();
+    Huff_Init(huff.get());
+    symbols.clear();
+
+    for (int ch = 0; ch < 256; ch++)
+    {
+        // leave some symbols out of the tree
+        if (rng() % 8 == 0)
+        {
+            continue;
+        }
+
+        int weight = 1 + (rng() % 4 == 0 ? rng() % 4000 : rng() % 20);
+
+        for (int i = 0; i < weight; i++)
+        {
+            Huff_addRef(&huff->compressor, ch);
+            Huff_addRef(&huff->decompressor, ch);
+        }
+
+        symbols.push_back(ch);
+    }
+
+    return huff;
+}
+
+TEST(MsgTest, HuffmanTablesMatchTree)
+{
+    std::mt19937 rng(7);
+    std::vector<int> symbols;
+    int longestCode = 0;
+
+    for (int iteration = 0; iteration < 20; iteration++)
+    {
+        auto huff = RandomHuffman(rng, symbols);
+        auto tables = Util::make_unique<huffTables_t>();
+        Huff_BuildTables(tables.get(), huff->decompressor.tree);
+
+        std::vector<int> message;
+        for (int i = 0; i < 2000; i++)
+        {
+            message.push_back(symbols[rng() % symbols.size()]);
+        }
+        for (int ch : symbols)
+        {
+            message.push_back(ch);
+            longestCode = std::max(longestCode, int(tables->length[ch]));
+        }
+
+        // odd starting offsets, and garbage which should be cleared past
+        // the started byte, which is always clear past the offset
+        int start = rng() % 8;
+        std::vector<byte> treeBuffer(32768, 0xaa), tableBuffer(32768, 0xaa);
+        treeBuffer[0] = tableBuffer[0] = 0x5a & ((1 << start) - 1);
+        int treeBit = start, tableBit = start;
+
+        for (int ch : message)
+        {
+            Huff_offsetTransmit(&huff->compressor, ch, treeBuffer.data(), &treeBit);
+            Huff_tableTransmit(tables.get(), ch, tableBuffer.data(), &tableBit);
+            ASSERT_EQ(treeBit, tableBit);
+        }
+
+        ASSERT_EQ(0, memcmp(treeBuffer.data(), tableBuffer.data(), (treeBit + 7) >> 3));
+
+        treeBit = tableBit = start;
+        for (int ch : message)
+        {
+            int treeCh, tableCh;
+            Huff_offsetReceive(huff->decompressor.tree, &treeCh, treeBuffer.data(), &treeBit);
+            Huff_tableReceive(tables.get(), &tableCh, treeBuffer.data(), treeBuffer.size(), &tableBit);
+            ASSERT_EQ(ch, treeCh);
+            ASSERT_EQ(ch, tableCh);
+            ASSERT_EQ(treeBit, tableBit);
+        }
+
+        // arbitrary bits up to the end of the buffer must decode the same too
+        for (int bit = 0; bit < 4000; bit++)
+        {
+            int treeCh, tableCh;
+            treeBit = tableBit = bit;
+            Huff_offsetReceive(huff->decompressor.tree, &treeCh, tableBuffer.data(), &treeBit);
+            Huff_tableReceive(tables.get(), &tableCh, tableBuffer.data(), tableBuffer.size(), &tableBit);
+            ASSERT_EQ(treeCh, tableCh);
+            ASSERT_EQ(treeBit, tableBit);
+        }
+    }
+
+    EXPECT_GT(longestCode, HUFF_LOOKUP_BITS);
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(MsgTest, DISABLED_HuffmanBenchmark)
+{
+    std::mt19937 rng(1);
+    std::vector<int> symbols;
+    auto huff = RandomHuffman(rng, symbols);
+    auto tables = Util::make_unique<huffTables_t>();
+    Huff_BuildTables(tables.get(), huff->decompressor.tree);
+
+    const int size = 16384, rounds = 200;
+    std::vector<int> message;
+    for (int i = 0; i < size; i++)
+    {
+        message.push_back(symbols[rng() % symbols.size()]);
+    }
+    std::vector<byte> buffer(size * 8);
+    int bit = 0, sum = 0;
+
+    auto measure = [&](const char *name, std::function<void()> run) {
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++)
+        {
+            run();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        printf("%-12s %8.1f MB/s\n", name, size * rounds / elapsed.count() / 1e6);
+    };
+
+    measure("tree encode", [&] {
+        bit = 0;
+        for (int ch : message) Huff_offsetTransmit(&huff->compressor, ch, buffer.data(), &bit);
+    });
+    measure("table encode", [&] {
+        bit = 0;
+        for (int ch : message) Huff_tableTransmit(tables.get(), ch, buffer.data(), &bit);
+    });
+    measure("tree decode", [&] {
+        bit = 0;
+        for (int i = 0; i < size; i++)
+        {
+            int ch;
+            Huff_offsetReceive(huff->decompressor.tree, &ch, buffer.data(), &bit);
+            sum += ch;
+        }
+    });
+    measure("table decode", [&] {
+        bit = 0;
+        for (int i = 0; i < size; i++)
+        {
+            int ch;
+            Huff_tableReceive(tables.get(), &ch, buffer.data(), buffer.size(), &bit);
+            sum += ch;
+        }
+    });
+
+    EXPECT_NE(0, sum);
+}
+
+} // namespace
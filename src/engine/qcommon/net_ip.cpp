@@ -38,6 +38,11 @@ Maryland 20850 USA.
 #include "engine/framework/Network.h"
 #include "server/server.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #ifdef _WIN32
 #       include <winsock2.h>
 #       include <ws2tcpip.h>
@@ -99,6 +104,11 @@ static bool winsockInitialized = false;
 #               include <sys/filio.h>
 #       endif
 
+// recvmmsg and sendmmsg
+#       ifdef __linux__
+#               define USE_MMSG
+#       endif
+
 using SOCKET = int;
 constexpr SOCKET INVALID_SOCKET{-1};
 constexpr SOCKET SOCKET_ERROR{-1};
@@ -567,6 +577,225 @@ bool        NET_IsLocalAddress( const netadr_t& adr )
 
 //=============================================================================
 
+/*
+==================
+NET_ReceivedPacket
+
+Fills net_from and net_message for a packet of length ret
+received on sock and copied to net_message->data
+==================
+*/
+static bool NET_ReceivedPacket( SOCKET sock, struct sockaddr_storage *from, socklen_t fromlen, int ret,
+                                netadr_t *net_from, msg_t *net_message )
+{
+	if ( sock == ip_socket )
+	{
+		memset( ( ( struct sockaddr_in * ) from )->sin_zero, 0, 8 );
+	}
+
+	if ( sock == ip_socket && usingSocks && memcmp( from, &socksRelayAddr, fromlen ) == 0 )
+	{
+		if ( ret < 10 || net_message->data[ 0 ] != 0 || net_message->data[ 1 ] != 0 || net_message->data[ 2 ] != 0 || net_message->data[ 3 ] != 1 )
+		{
+			return false;
+		}
+
+		net_from->type = netadrtype_t::NA_IP;
+		net_from->ip[ 0 ] = net_message->data[ 4 ];
+		net_from->ip[ 1 ] = net_message->data[ 5 ];
+		net_from->ip[ 2 ] = net_message->data[ 6 ];
+		net_from->ip[ 3 ] = net_message->data[ 7 ];
+		net_from->port = * ( short * ) &net_message->data[ 8 ];
+		net_message->readcount = 10;
+	}
+	else
+	{
+		SockadrToNetadr( ( struct sockaddr * ) from, net_from );
+		net_message->readcount = 0;
+	}
+
+	if ( ret == net_message->maxsize )
+	{
+		Log::Notice( "Oversize packet from %s", Net::AddressToString( *net_from ) );
+		return false;
+	}
+
+	net_message->cursize = ret;
+	return true;
+}
+
+/*
+==================
+NET_ReceiveError
+==================
+*/
+static void NET_ReceiveError()
+{
+	int err = socketError;
+
+	if ( err != net::errc::resource_unavailable_try_again && err != net::errc::connection_reset )
+	{
+		Log::Notice( "NET_GetPacket: %s", NET_ErrorString() );
+	}
+}
+
+#ifdef USE_MMSG
+
+/*
+=============================================================================
+
+Batched packet IO, receiving and sending several packets per system call
+
+=============================================================================
+*/
+
+static Cvar::Cvar<bool> net_batchIO("net_batchIO",
+	"receive and send several packets per system call with recvmmsg and sendmmsg", Cvar::NONE, true);
+
+static const int NET_RECEIVE_BATCH = 16;
+static const int NET_SEND_BATCH = 64;
+
+// cleared if the kernel doesn't support the calls, by the receive thread too
+static std::atomic<bool> mmsgSupported{ true };
+
+struct receivedPacket_t
+{
+	SOCKET                  sock;
+	struct sockaddr_storage from;
+	socklen_t               fromlen;
+	int                     length;
+	bool                    truncated;
+	byte                    data[ MAX_MSGLEN ];
+};
+
+static std::unique_ptr<receivedPacket_t[]> receivedPackets; // [NET_RECEIVE_BATCH]
+static int                                 numReceivedPackets;
+static int                                 nextReceivedPacket;
+
+struct queuedPacket_t
+{
+	netadrtype_t            type;
+	struct sockaddr_storage addr;
+	socklen_t               addrlen;
+	size_t                  offset; // into queuedPacketData
+	int                     length;
+};
+
+static bool                        sendBatchActive;
+static std::vector<queuedPacket_t> queuedPackets;
+static std::vector<byte>           queuedPacketData;
+
+/*
+==================
+NET_ReceiveBatch
+
+Appends the packets waiting on sock to receivedPackets
+==================
+*/
+static void NET_ReceiveBatch( SOCKET sock )
+{
+	struct mmsghdr msgs[ NET_RECEIVE_BATCH ];
+	struct iovec   iovecs[ NET_RECEIVE_BATCH ];
+	int            count = NET_RECEIVE_BATCH - numReceivedPackets;
+
+	if ( count <= 0 )
+	{
+		return;
+	}
+
+	for ( int i = 0; i < count; i++ )
+	{
+		receivedPacket_t &packet = receivedPackets[ numReceivedPackets + i ];
+
+		iovecs[ i ].iov_base = packet.data;
+		iovecs[ i ].iov_len = sizeof( packet.data );
+		memset( &msgs[ i ], 0, sizeof( msgs[ i ] ) );
+		msgs[ i ].msg_hdr.msg_name = &packet.from;
+		msgs[ i ].msg_hdr.msg_namelen = sizeof( packet.from );
+		msgs[ i ].msg_hdr.msg_iov = &iovecs[ i ];
+		msgs[ i ].msg_hdr.msg_iovlen = 1;
+	}
+
+	int ret = recvmmsg( sock, msgs, count, MSG_DONTWAIT, nullptr );
+
+	if ( ret == SOCKET_ERROR )
+	{
+		if ( errno == ENOSYS )
+		{
+			mmsgSupported = false;
+			return;
+		}
+
+		NET_ReceiveError();
+		return;
+	}
+
+	for ( int i = 0; i < ret; i++ )
+	{
+		receivedPacket_t &packet = receivedPackets[ numReceivedPackets + i ];
+
+		packet.sock = sock;
+		packet.fromlen = msgs[ i ].msg_hdr.msg_namelen;
+		packet.length = msgs[ i ].msg_len;
+		packet.truncated = msgs[ i ].msg_hdr.msg_flags & MSG_TRUNC;
+	}
+
+	numReceivedPackets += ret;
+}
+
+/*
+==================
+NET_GetBatchedPacket
+
+Returns the next packet from receivedPackets, receiving a new batch
+from all the sockets when they have all been handled
+==================
+*/
+static bool NET_GetBatchedPacket( netadr_t *net_from, msg_t *net_message )
+{
+	if ( !receivedPackets )
+	{
+		receivedPackets.reset( new receivedPacket_t[ NET_RECEIVE_BATCH ] );
+	}
+
+	if ( nextReceivedPacket == numReceivedPackets )
+	{
+		numReceivedPackets = 0;
+		nextReceivedPacket = 0;
+
+		if ( ip_socket != INVALID_SOCKET )
+		{
+			NET_ReceiveBatch( ip_socket );
+		}
+
+		if ( ip6_socket != INVALID_SOCKET )
+		{
+			NET_ReceiveBatch( ip6_socket );
+		}
+
+		if ( multicast6_socket != INVALID_SOCKET && multicast6_socket != ip6_socket )
+		{
+			NET_ReceiveBatch( multicast6_socket );
+		}
+
+		if ( nextReceivedPacket == numReceivedPackets )
+		{
+			return false;
+		}
+	}
+
+	receivedPacket_t &packet = receivedPackets[ nextReceivedPacket++ ];
+
+	// an oversize packet is rejected in NET_ReceivedPacket, like
+	// when recvfrom fills the whole buffer
+	int length = packet.truncated ? net_message->maxsize : std::min( packet.length, net_message->maxsize );
+
+	memcpy( net_message->data, packet.data, length );
+
+	return NET_ReceivedPacket( packet.sock, &packet.from, packet.fromlen, length, net_from, net_message );
+}
+#endif
+
 /*
 ==================
 Sys_GetPacket
@@ -580,7 +809,13 @@ bool Sys_GetPacket( netadr_t *net_from, msg_t *net_message )
 	struct sockaddr_storage from;
 
 	socklen_t               fromlen;
-	int                     err;
+
+#ifdef USE_MMSG
+	if ( mmsgSupported && net_batchIO.Get() )
+	{
+		return NET_GetBatchedPacket( net_from, net_message );
+	}
+#endif
 
 	if ( ip_socket != INVALID_SOCKET )
 	{
@@ -589,46 +824,11 @@ bool Sys_GetPacket( netadr_t *net_from, msg_t *net_message )
 
 		if ( ret == SOCKET_ERROR )
 		{
-			err = socketError;
-
-			if ( err != net::errc::resource_unavailable_try_again && err != net::errc::connection_reset )
-			{
-				Log::Notice( "NET_GetPacket: %s", NET_ErrorString() );
-			}
+			NET_ReceiveError();
 		}
 		else
 		{
-			memset( ( ( struct sockaddr_in * ) &from )->sin_zero, 0, 8 );
-
-			if ( usingSocks && memcmp( &from, &socksRelayAddr, fromlen ) == 0 )
-			{
-				if ( ret < 10 || net_message->data[ 0 ] != 0 || net_message->data[ 1 ] != 0 || net_message->data[ 2 ] != 0 || net_message->data[ 3 ] != 1 )
-				{
-					return false;
-				}
-
-				net_from->type = netadrtype_t::NA_IP;
-				net_from->ip[ 0 ] = net_message->data[ 4 ];
-				net_from->ip[ 1 ] = net_message->data[ 5 ];
-				net_from->ip[ 2 ] = net_message->data[ 6 ];
-				net_from->ip[ 3 ] = net_message->data[ 7 ];
-				net_from->port = * ( short * ) &net_message->data[ 8 ];
-				net_message->readcount = 10;
-			}
-			else
-			{
-				SockadrToNetadr( ( struct sockaddr * ) &from, net_from );
-				net_message->readcount = 0;
-			}
-
-			if ( ret == net_message->maxsize )
-			{
-				Log::Notice( "Oversize packet from %s", NET_AdrToString( *net_from ) );
-				return false;
-			}
-
-			net_message->cursize = ret;
-			return true;
+			return NET_ReceivedPacket( ip_socket, &from, fromlen, ret, net_from, net_message );
 		}
 	}
 
@@ -639,26 +839,11 @@ bool Sys_GetPacket( netadr_t *net_from, msg_t *net_message )
 
 		if ( ret == SOCKET_ERROR )
 		{
-			err = socketError;
-
-			if ( err != net::errc::resource_unavailable_try_again && err != net::errc::connection_reset )
-			{
-				Log::Notice( "NET_GetPacket: %s", NET_ErrorString() );
-			}
+			NET_ReceiveError();
 		}
 		else
 		{
-			SockadrToNetadr( ( struct sockaddr * ) &from, net_from );
-			net_message->readcount = 0;
-
-			if ( ret == net_message->maxsize )
-			{
-				Log::Notice( "Oversize packet from %s", NET_AdrToString( *net_from ) );
-				return false;
-			}
-
-			net_message->cursize = ret;
-			return true;
+			return NET_ReceivedPacket( ip6_socket, &from, fromlen, ret, net_from, net_message );
 		}
 	}
 
@@ -669,26 +854,11 @@ bool Sys_GetPacket( netadr_t *net_from, msg_t *net_message )
 
 		if ( ret == SOCKET_ERROR )
 		{
-			err = socketError;
-
-			if ( err != net::errc::resource_unavailable_try_again && err != net::errc::connection_reset )
-			{
-				Log::Notice( "NET_GetPacket: %s", NET_ErrorString() );
-			}
+			NET_ReceiveError();
 		}
 		else
 		{
-			SockadrToNetadr( ( struct sockaddr * ) &from, net_from );
-			net_message->readcount = 0;
-
-			if ( ret == net_message->maxsize )
-			{
-				Log::Notice( "Oversize packet from %s", NET_AdrToString( *net_from ) );
-				return false;
-			}
-
-			net_message->cursize = ret;
-			return true;
+			return NET_ReceivedPacket( multicast6_socket, &from, fromlen, ret, net_from, net_message );
 		}
 	}
 
@@ -699,6 +869,150 @@ bool Sys_GetPacket( netadr_t *net_from, msg_t *net_message )
 
 static char socksBuf[ 4096 ];
 
+/*
+==================
+NET_SendError
+==================
+*/
+static void NET_SendError( netadrtype_t type, sa_family_t family )
+{
+	int err = socketError;
+
+	// wouldblock is silent
+	if ( err == net::errc::resource_unavailable_try_again )
+	{
+		return;
+	}
+
+	// some PPP links do not allow broadcasts and return an error
+	if ( ( err == net::errc::address_not_available ) && ( ( type == netadrtype_t::NA_BROADCAST ) ) )
+	{
+		return;
+	}
+
+	if ( family == AF_INET )
+	{
+		Log::Notice( "Sys_SendPacket (ipv4): %s", NET_ErrorString() );
+	}
+	else if ( family == AF_INET6 )
+	{
+		Log::Notice( "Sys_SendPacket (ipv6): %s", NET_ErrorString() );
+	}
+	else
+	{
+		Log::Notice( "Sys_SendPacket (%i): %s", family, NET_ErrorString() );
+	}
+}
+
+#ifdef USE_MMSG
+/*
+==================
+NET_SendQueuedPackets
+
+Sends the queued packets of one address family on its socket
+==================
+*/
+static void NET_SendQueuedPackets( SOCKET sock, sa_family_t family )
+{
+	struct mmsghdr msgs[ NET_SEND_BATCH ];
+	struct iovec   iovecs[ NET_SEND_BATCH ];
+	int            indexes[ NET_SEND_BATCH ];
+	int            count = 0;
+
+	for ( size_t i = 0; i < queuedPackets.size(); i++ )
+	{
+		queuedPacket_t &packet = queuedPackets[ i ];
+
+		if ( packet.addr.ss_family != family )
+		{
+			continue;
+		}
+
+		iovecs[ count ].iov_base = &queuedPacketData[ packet.offset ];
+		iovecs[ count ].iov_len = packet.length;
+		memset( &msgs[ count ], 0, sizeof( msgs[ count ] ) );
+		msgs[ count ].msg_hdr.msg_name = &packet.addr;
+		msgs[ count ].msg_hdr.msg_namelen = packet.addrlen;
+		msgs[ count ].msg_hdr.msg_iov = &iovecs[ count ];
+		msgs[ count ].msg_hdr.msg_iovlen = 1;
+		indexes[ count ] = i;
+		count++;
+	}
+
+	for ( int sent = 0; sent < count; )
+	{
+		int ret = sendmmsg( sock, msgs + sent, count - sent, 0 );
+
+		if ( ret == SOCKET_ERROR && errno == ENOSYS )
+		{
+			mmsgSupported = false;
+			ret = sendto( sock, msgs[ sent ].msg_hdr.msg_iov->iov_base, msgs[ sent ].msg_hdr.msg_iov->iov_len, 0,
+			              ( struct sockaddr * ) msgs[ sent ].msg_hdr.msg_name, msgs[ sent ].msg_hdr.msg_namelen );
+		}
+
+		if ( ret == SOCKET_ERROR )
+		{
+			// skip the packet that failed, like sendto would have
+			NET_SendError( queuedPackets[ indexes[ sent ] ].type, family );
+			sent++;
+			continue;
+		}
+
+		if ( !mmsgSupported )
+		{
+			ret = 1;
+		}
+
+		sent += ret;
+	}
+}
+#endif
+
+/*
+==================
+NET_BeginSendBatch
+
+Queues the following packets until NET_FlushSendBatch, to send them
+with as few system calls as possible
+==================
+*/
+void NET_BeginSendBatch()
+{
+#ifdef USE_MMSG
+	sendBatchActive = mmsgSupported && net_batchIO.Get();
+#endif
+}
+
+/*
+==================
+NET_FlushSendBatch
+==================
+*/
+void NET_FlushSendBatch()
+{
+#ifdef USE_MMSG
+	sendBatchActive = false;
+
+	if ( queuedPackets.empty() )
+	{
+		return;
+	}
+
+	if ( ip_socket != INVALID_SOCKET )
+	{
+		NET_SendQueuedPackets( ip_socket, AF_INET );
+	}
+
+	if ( ip6_socket != INVALID_SOCKET )
+	{
+		NET_SendQueuedPackets( ip6_socket, AF_INET6 );
+	}
+
+	queuedPackets.clear();
+	queuedPacketData.clear();
+#endif
+}
+
 /*
 ==================
 Sys_SendPacket
@@ -730,6 +1044,30 @@ void Sys_SendPacket( int length, const void *data, const netadr_t& to )
 	memset( &addr, 0, sizeof( addr ) );
 	NetadrToSockadr( &to, ( struct sockaddr * ) &addr );
 
+#ifdef USE_MMSG
+	if ( sendBatchActive && !usingSocks && ( addr.ss_family == AF_INET || addr.ss_family == AF_INET6 ) )
+	{
+		queuedPacket_t packet;
+
+		packet.type = to.type;
+		packet.addr = addr;
+		packet.addrlen = addr.ss_family == AF_INET ? sizeof( struct sockaddr_in ) : sizeof( struct sockaddr_in6 );
+		packet.offset = queuedPacketData.size();
+		packet.length = length;
+
+		queuedPackets.push_back( packet );
+		queuedPacketData.insert( queuedPacketData.end(), ( const byte * ) data, ( const byte * ) data + length );
+
+		if ( queuedPackets.size() == NET_SEND_BATCH )
+		{
+			NET_FlushSendBatch();
+			sendBatchActive = true;
+		}
+
+		return;
+	}
+#endif
+
 	if ( usingSocks && addr.ss_family == AF_INET /*to.type == NA_IP*/ )
 	{
 		socksBuf[ 0 ] = 0; // reserved
@@ -755,34 +1093,9 @@ void Sys_SendPacket( int length, const void *data, const netadr_t& to )
 
 	if ( ret == SOCKET_ERROR )
 	{
-		int err = socketError;
-
-		// wouldblock is silent
-		if ( err == net::errc::resource_unavailable_try_again )
-		{
-			return;
-		}
-
-		// some PPP links do not allow broadcasts and return an error
-		if ( ( err == net::errc::address_not_available ) && ( ( to.type == netadrtype_t::NA_BROADCAST ) ) )
-		{
-			return;
-		}
-
-		if ( addr.ss_family == AF_INET )
-		{
-			Log::Notice( "Sys_SendPacket (ipv4): %s", NET_ErrorString() );
-		}
-		else if ( addr.ss_family == AF_INET6 )
-		{
-			Log::Notice( "Sys_SendPacket (ipv6): %s", NET_ErrorString() );
-		}
-		else
-		{
-			Log::Notice( "Sys_SendPacket (%i): %s", addr.ss_family , NET_ErrorString() );
-		}
-	}
-}
+		NET_SendError( to.type, addr.ss_family );
+	}
+}
 
 //=============================================================================
 
@@ -1739,6 +2052,380 @@ static bool NET_GetCvars()
 	return modified ? true : false;
 }
 
+/*
+====================
+NET_Select
+
+Waits for the timeout or until a packet can be read
+====================
+*/
+static void NET_Select( std::chrono::microseconds timeout )
+{
+	struct timeval tv;
+
+	fd_set         fdset;
+	SOCKET         highestfd = INVALID_SOCKET;
+
+	if ( ip_socket == INVALID_SOCKET && ip6_socket == INVALID_SOCKET )
+	{
+		return;
+	}
+
+	if ( timeout.count() < 0 )
+	{
+		return;
+	}
+
+	FD_ZERO( &fdset );
+
+	if ( ip_socket != INVALID_SOCKET )
+	{
+		FD_SET( ip_socket, &fdset );
+
+		highestfd = ip_socket;
+	}
+
+	if ( ip6_socket != INVALID_SOCKET )
+	{
+		FD_SET( ip6_socket, &fdset );
+
+		if ( highestfd == INVALID_SOCKET || ip6_socket > highestfd )
+		{
+			highestfd = ip6_socket;
+		}
+	}
+
+	tv.tv_sec = timeout.count() / 1000000;
+	tv.tv_usec = timeout.count() % 1000000;
+	select( highestfd + 1, &fdset, nullptr, nullptr, &tv );
+}
+
+/*
+=============================================================================
+
+Network receive thread, reading the sockets as soon as packets arrive so
+that they are timestamped on arrival rather than when the main thread
+gets to them. The packets are passed to the main thread through a
+preallocated single producer, single consumer ring.
+
+=============================================================================
+*/
+
+static Cvar::Cvar<bool> net_receiveThread("net_receiveThread",
+	"read the network sockets on a separate thread (takes effect on net_restart)", Cvar::NONE, false);
+
+static const int NET_RING_SIZE = 64; // must be a power of two
+static const int NET_RING_MASK = NET_RING_SIZE - 1;
+static const int NET_THREAD_POLL_MSEC = 100; // how often the thread checks if it must stop
+
+struct ringPacket_t
+{
+	netadr_t from;
+	int      time;
+	int      readcount;
+	int      cursize;
+	byte     data[ MAX_MSGLEN ];
+};
+
+// All functions in this class besides ReceiverMain are intended to be called
+// by the engine main thread only.
+class PacketReceiver
+{
+public:
+	~PacketReceiver()
+	{
+		Stop();
+	}
+
+	bool Running() const
+	{
+		return receiverThread_.joinable();
+	}
+
+	// The sockets must not be closed or opened while it runs
+	void Start()
+	{
+		if ( Running() )
+		{
+			return;
+		}
+
+		if ( !ring_ )
+		{
+			ring_.reset( new ringPacket_t[ NET_RING_SIZE ] );
+		}
+
+		head_ = 0;
+		tail_ = 0;
+		halt_ = false;
+		receiverThread_ = std::thread( &PacketReceiver::ReceiverMain, this );
+	}
+
+	// Drops the packets that haven't been handled yet
+	void Stop()
+	{
+		if ( !Running() )
+		{
+			return;
+		}
+
+		halt_ = true;
+		receiverThread_.join();
+		head_ = 0;
+		tail_ = 0;
+	}
+
+	bool GetPacket( netadr_t *from, msg_t *msg, int *time )
+	{
+		unsigned tail = tail_.load( std::memory_order_relaxed );
+
+		if ( tail == head_.load( std::memory_order_acquire ) )
+		{
+			return false;
+		}
+
+		const ringPacket_t &packet = ring_[ tail & NET_RING_MASK ];
+		int length = packet.cursize - packet.readcount;
+		bool fits = length <= msg->maxsize;
+
+		if ( fits )
+		{
+			*from = packet.from;
+			*time = packet.time;
+			memcpy( msg->data, packet.data + packet.readcount, length );
+			msg->cursize = length;
+			msg->readcount = 0;
+		}
+
+		tail_.store( tail + 1, std::memory_order_release );
+
+		if ( !fits )
+		{
+			Log::Notice( "NET_GetThreadPacket: oversize packet" );
+		}
+
+		return fits;
+	}
+
+	// Waits for the timeout or until a packet is available
+	void Wait( Sys::SteadyClock::duration timeout )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+
+		arrived_.wait_for( lock, timeout, [ this ] {
+			return head_.load() != tail_.load();
+		} );
+	}
+
+private:
+	std::unique_ptr<ringPacket_t[]> ring_; // [NET_RING_SIZE]
+	std::atomic<unsigned> head_{ 0 }; // only written by the receive thread while it runs
+	std::atomic<unsigned> tail_{ 0 }; // only written by the main thread while the receive thread runs
+	std::atomic<bool> halt_{ false };
+	std::thread receiverThread_;
+	std::mutex mutex_; // only used to wake up the main thread in Wait
+	std::condition_variable arrived_;
+
+	void ReceiverMain()
+	{
+		while ( !halt_ )
+		{
+			unsigned head = head_.load( std::memory_order_relaxed );
+
+			// the main thread is behind, leave the packets in the socket buffers
+			if ( head - tail_.load( std::memory_order_acquire ) == NET_RING_SIZE )
+			{
+				std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+				continue;
+			}
+
+			ringPacket_t &packet = ring_[ head & NET_RING_MASK ];
+			msg_t msg{};
+
+			msg.data = packet.data;
+			msg.maxsize = sizeof( packet.data );
+			packet.from.type = netadrtype_t::NA_UNSPEC;
+
+			if ( !Sys_GetPacket( &packet.from, &msg ) )
+			{
+				NET_Select( std::chrono::milliseconds( NET_THREAD_POLL_MSEC ) );
+				continue;
+			}
+
+			packet.time = Sys::Milliseconds();
+			packet.readcount = msg.readcount;
+			packet.cursize = msg.cursize;
+
+			head_.store( head + 1, std::memory_order_release );
+
+			{
+				// the lock makes sure the main thread is either not waiting yet
+				// or already waiting, so the notification isn't lost
+				std::lock_guard<std::mutex> lock( mutex_ );
+			}
+
+			arrived_.notify_one();
+		}
+	}
+};
+
+static PacketReceiver packetReceiver;
+
+/*
+====================
+NET_ReceiveThreadRunning
+====================
+*/
+bool NET_ReceiveThreadRunning()
+{
+	return packetReceiver.Running();
+}
+
+/*
+====================
+NET_GetThreadPacket
+
+Gets the next packet read by the receive thread, and the
+Sys::Milliseconds() time it arrived at
+====================
+*/
+bool NET_GetThreadPacket( netadr_t *net_from, msg_t *net_message, int *time )
+{
+	if ( !packetReceiver.Running() )
+	{
+		return false;
+	}
+
+	return packetReceiver.GetPacket( net_from, net_message, time );
+}
+
+/*
+=============================================================================
+
+Client sockets, each bound to its own ephemeral port so that a server sees
+them as separate connections, used by the load test clients. They aren't
+read by Sys_GetPacket, their owner polls them and may do so from another
+thread. Only IPv4 is supported.
+
+=============================================================================
+*/
+
+/*
+====================
+NET_OpenClientSocket
+
+Returns -1 if the socket couldn't be opened
+====================
+*/
+intptr_t NET_OpenClientSocket()
+{
+	int err;
+	SOCKET sock = NET_IPSocket( nullptr, 0, nullptr, &err );
+
+	if ( sock == INVALID_SOCKET )
+	{
+		return -1;
+	}
+
+	return static_cast<intptr_t>( sock );
+}
+
+/*
+====================
+NET_CloseClientSocket
+====================
+*/
+void NET_CloseClientSocket( intptr_t sock )
+{
+	if ( sock != -1 )
+	{
+		closesocket( static_cast<SOCKET>( sock ) );
+	}
+}
+
+/*
+====================
+NET_SendClientPacket
+====================
+*/
+void NET_SendClientPacket( intptr_t sock, int length, const void *data, const netadr_t& to )
+{
+	struct sockaddr_storage addr;
+
+	if ( to.type != netadrtype_t::NA_IP )
+	{
+		return;
+	}
+
+	memset( &addr, 0, sizeof( addr ) );
+	NetadrToSockadr( &to, ( struct sockaddr * ) &addr );
+
+	if ( sendto( static_cast<SOCKET>( sock ), ( const char * ) data, length, 0, ( struct sockaddr * ) &addr, sizeof( struct sockaddr_in ) ) == SOCKET_ERROR )
+	{
+		NET_SendError( to.type, AF_INET );
+	}
+}
+
+/*
+====================
+NET_GetClientPacket
+====================
+*/
+bool NET_GetClientPacket( intptr_t sock, netadr_t *net_from, msg_t *net_message )
+{
+	struct sockaddr_storage from;
+	socklen_t               fromlen = sizeof( from );
+
+	int ret = recvfrom( static_cast<SOCKET>( sock ), ( char * ) net_message->data, net_message->maxsize, 0, ( struct sockaddr * ) &from, &fromlen );
+
+	if ( ret == SOCKET_ERROR )
+	{
+		NET_ReceiveError();
+		return false;
+	}
+
+	return NET_ReceivedPacket( static_cast<SOCKET>( sock ), &from, fromlen, ret, net_from, net_message );
+}
+
+/*
+====================
+NET_SelectClientSockets
+
+Waits for the timeout or until a packet can be read from one of the sockets
+====================
+*/
+void NET_SelectClientSockets( const intptr_t *sockets, int count, std::chrono::microseconds timeout )
+{
+	struct timeval tv;
+
+	fd_set         fdset;
+	SOCKET         highestfd = 0;
+
+	if ( timeout.count() < 0 )
+	{
+		return;
+	}
+
+	FD_ZERO( &fdset );
+
+	for ( int i = 0; i < count; i++ )
+	{
+		SOCKET sock = static_cast<SOCKET>( sockets[ i ] );
+
+		if ( sockets[ i ] == -1 )
+		{
+			continue;
+		}
+
+		FD_SET( sock, &fdset );
+		highestfd = std::max( highestfd, sock );
+	}
+
+	tv.tv_sec = timeout.count() / 1000000;
+	tv.tv_usec = timeout.count() % 1000000;
+	select( highestfd + 1, &fdset, nullptr, nullptr, &tv );
+}
+
 /*
 ====================
 NET_Config
@@ -1788,6 +2475,15 @@ void NET_Config( bool enableNetworking )
 
 	if ( stop )
 	{
+		NET_FlushSendBatch();
+		packetReceiver.Stop();
+
+#ifdef USE_MMSG
+		// don't hand out packets from the old sockets
+		numReceivedPackets = 0;
+		nextReceivedPacket = 0;
+#endif
+
 		if ( ip_socket != INVALID_SOCKET )
 		{
 			closesocket( ip_socket );
@@ -1824,6 +2520,11 @@ void NET_Config( bool enableNetworking )
 			NET_OpenIP();
 			NET_SetMulticast6();
 			SV_NET_Config();
+
+			if ( net_receiveThread.Get() )
+			{
+				packetReceiver.Start();
+			}
 		}
 	}
 }
@@ -1884,43 +2585,62 @@ Sleeps msec or until something happens on the network
 */
 void NET_Sleep( int msec )
 {
-	struct timeval timeout;
+	NET_FlushSendBatch();
 
-	fd_set         fdset;
-	SOCKET         highestfd = INVALID_SOCKET;
-
-	if ( ip_socket == INVALID_SOCKET && ip6_socket == INVALID_SOCKET )
+	if ( packetReceiver.Running() )
 	{
+		if ( msec > 0 )
+		{
+			packetReceiver.Wait( std::chrono::milliseconds( msec ) );
+		}
+
 		return;
 	}
 
-	if ( msec < 0 )
+	NET_Select( std::chrono::milliseconds( msec ) );
+}
+
+/*
+====================
+NET_SleepUntil
+
+Sleeps until the deadline or until something happens on the network,
+with the precision of the clock rather than whole milliseconds
+====================
+*/
+void NET_SleepUntil( Sys::SteadyClock::time_point deadline )
+{
+	NET_FlushSendBatch();
+
+	Sys::SteadyClock::duration remaining = deadline - Sys::SteadyClock::now();
+
+	if ( remaining <= Sys::SteadyClock::duration::zero() )
 	{
 		return;
 	}
 
-	FD_ZERO( &fdset );
-
-	if ( ip_socket != INVALID_SOCKET )
+	if ( packetReceiver.Running() )
 	{
-		FD_SET( ip_socket, &fdset );
-
-		highestfd = ip_socket;
+		packetReceiver.Wait( remaining );
+		return;
 	}
 
-	if ( ip6_socket != INVALID_SOCKET )
+	// nothing can wake us up early
+	if ( ip_socket == INVALID_SOCKET && ip6_socket == INVALID_SOCKET )
 	{
-		FD_SET( ip6_socket, &fdset );
+		Sys::SleepUntil( deadline );
+		return;
+	}
 
-		if ( highestfd == INVALID_SOCKET || ip6_socket > highestfd )
-		{
-			highestfd = ip6_socket;
-		}
+	// round up, waking up early would only mean sleeping again
+	auto timeout = std::chrono::duration_cast<std::chrono::microseconds>( remaining );
+
+	if ( timeout < remaining )
+	{
+		timeout += std::chrono::microseconds( 1 );
 	}
 
-	timeout.tv_sec = msec / 1000;
-	timeout.tv_usec = ( msec % 1000 ) * 1000;
-	select( highestfd + 1, &fdset, nullptr, nullptr, &timeout );
+	NET_Select( timeout );
 }
 
 /*
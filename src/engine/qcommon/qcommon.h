@@ -65,6 +65,7 @@ struct usercmd_t;
 struct entityState_t;
 
 void  MSG_WriteBits( msg_t *msg, int value, int bits );
+void  MSG_WriteEncodedBits( msg_t *msg, const byte *data, int bits, int uncompressedBits );
 
 void  MSG_WriteChar( msg_t *sb, int c );
 void  MSG_WriteByte( msg_t *sb, int c );
@@ -94,8 +95,10 @@ void  MSG_ReadDeltaUsercmd( msg_t *msg, usercmd_t *from, usercmd_t *to );
 
 void  MSG_WriteDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, bool force );
 void  MSG_ReadDeltaEntity( msg_t *msg, const entityState_t *from, entityState_t *to, int number );
+int   MSG_DeltaEntityBits( const entityState_t *from, const entityState_t *to, bool force );
 
 void MSG_InitNetcodeTables(NetcodeTable playerStateTable, int playerStateSize);
+bool MSG_HaveNetcodeTables();
 void  MSG_WriteDeltaPlayerstate( msg_t *msg, OpaquePlayerState *from, OpaquePlayerState *to );
 void  MSG_ReadDeltaPlayerstate( msg_t *msg, OpaquePlayerState *from, OpaquePlayerState *to );
 
@@ -164,6 +167,16 @@ void       NET_JoinMulticast6();
 void       NET_LeaveMulticast6();
 
 void       NET_Sleep( int msec );
+void       NET_SleepUntil( Sys::SteadyClock::time_point deadline );
+void       NET_BeginSendBatch();
+void       NET_FlushSendBatch();
+bool       NET_ReceiveThreadRunning();
+bool       NET_GetThreadPacket( netadr_t *net_from, msg_t *net_message, int *time );
+intptr_t   NET_OpenClientSocket();
+void       NET_CloseClientSocket( intptr_t sock );
+void       NET_SendClientPacket( intptr_t sock, int length, const void *data, const netadr_t& to );
+bool       NET_GetClientPacket( intptr_t sock, netadr_t *net_from, msg_t *net_message );
+void       NET_SelectClientSockets( const intptr_t *sockets, int count, std::chrono::microseconds timeout );
 
 //----(SA)  increased for larger submodel entity counts
 #define MAX_MSGLEN           32768 // max length of a message, which may
@@ -662,7 +675,7 @@ void     SV_Init();
 void     SV_Shutdown( const char *finalmsg );
 void     SV_QuickShutdown( const char *finalmsg );
 void     SV_Frame( int msec );
-void     SV_PacketEvent( const netadr_t& from, msg_t *msg );
+void     SV_PacketEvent( const netadr_t& from, msg_t *msg, int time );
 int      SV_FrameMsec();
 
 /*
@@ -752,6 +765,23 @@ struct huffman_t
     huff_t decompressor;
 };
 
+#define HUFF_LOOKUP_BITS 11 /* bits decoded by one lookup */
+#define HUFF_MAX_CODE_LENGTH 57 /* so that a code can be shifted by 7 in 64 bits */
+
+/* Lookup tables compiled from a tree which doesn't change anymore */
+struct huffTables_t
+{
+    uint64_t code[ HMAX + 1 ]; /* bits in the order they are written, starting from the lowest */
+    byte     length[ HMAX + 1 ]; /* 0 if the symbol isn't in the tree */
+
+    /* indexed by the next HUFF_LOOKUP_BITS bits, symbol | length << 9,
+     * or 0 if the code is longer and the tree must be walked */
+    unsigned short lookup[ 1 << HUFF_LOOKUP_BITS ];
+
+    /* where to continue the walk after HUFF_LOOKUP_BITS bits for the longer codes */
+    node_t *subtree[ 1 << HUFF_LOOKUP_BITS ];
+};
+
 void             Huff_Compress( msg_t *buf, int offset );
 void             Huff_Decompress( msg_t *buf, int offset );
 void             Huff_Init( huffman_t *huff );
@@ -762,6 +792,11 @@ void             Huff_offsetReceive( node_t *node, int *ch, byte *fin, int *offs
 void             Huff_offsetTransmit( huff_t *huff, int ch, byte *fout, int *offset );
 void             Huff_putBit( int bit, byte *fout, int *offset );
 int              Huff_getBit( byte *fout, int *offset );
+void             Huff_putBits( uint64_t bits, int count, byte *fout, int *offset );
+uint32_t         Huff_getBits( const byte *fin, int size, int count, int *offset );
+void             Huff_BuildTables( huffTables_t *tables, node_t *tree );
+void             Huff_tableReceive( const huffTables_t *tables, int *ch, const byte *fin, int size, int *offset );
+void             Huff_tableTransmit( const huffTables_t *tables, int ch, byte *fout, int *offset );
 
 void Trans_LoadDefaultLanguage();
 #endif // QCOMMON_H_
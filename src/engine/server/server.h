@@ -51,7 +51,6 @@ Maryland 20850 USA.
 struct svEntity_t
 {
 	entityState_t        baseline; // for delta compression of initial sighting
-	int                  snapshotCounter; // used to prevent double adding from portal views
 };
 
 enum class serverState_t
@@ -67,8 +66,8 @@ struct server_t
 	bool      restarting; // if true, send configstring changes during SS_LOADING
 	int           serverId; // changes each server start
 	int           restartedServerId; // serverId before a map_restart
-	int             snapshotCounter; // incremented for each snapshot built
 	int             timeResidual; // <= 1000 / sv_frame->value
+	Sys::SteadyClock::time_point frameDeadline; // when the next frame is due, with sv_preciseFrames
 	int             nextFrameTime; // when time > nextFrameTime, process world
 
 	char            *configstrings[ MAX_CONFIGSTRINGS ];
@@ -113,7 +112,9 @@ struct clientSnapshot_t
 	byte          areabits[ MAX_MAP_AREA_BYTES ]; // portalarea visibility bits
 	OpaquePlayerState ps;
 	int           num_entities;
-	int           first_entity; // into the circular sv_packet_entities[]
+	int           first_entity; // into the entity list of its frame of the snapshot state pool
+	int           stateFrame; // frame of the snapshot state pool holding the entity states
+	int           entityGeneration; // snapshot generation the entity states were copied in
 	// the entities MUST be in increasing state number
 	// order, otherwise the delta compression will fail
 	int messageSent; // time the message was transmitted
@@ -143,7 +144,7 @@ struct client_t
 	clientState_t  state;
 	char           userinfo[ MAX_INFO_STRING ]; // name, etc
 
-	char           reliableCommands[ MAX_RELIABLE_COMMANDS ][ MAX_STRING_CHARS ];
+	int            reliableCommands[ MAX_RELIABLE_COMMANDS ]; // handles in the server command ring, see SV_ReliableCommand
 	int            reliableSequence; // last added reliable message, not necessarily sent or acknowledged yet
 	int            reliableAcknowledge; // last acknowledged reliable message
 	int            reliableSent; // last sent reliable message, not necessarily acknowledged yet
@@ -213,16 +214,15 @@ struct svstats_t
 	double idle;
 	int    count;
 	int    packets;
+	double lateness; // in milliseconds, summed over the scheduled frames
+	double maxLateness;
+	int    scheduledFrames;
 
 	double latched_active;
 	double latched_idle;
 	int    latched_packets;
-};
-
-struct receipt_t
-{
-	netadr_t adr;
-	int      time;
+	double latched_lateness; // average
+	double latched_maxLateness;
 };
 
 // MAX_INFO_RECEIPTS is the maximum number of getstatus+getinfo responses that we send
@@ -240,14 +240,11 @@ struct serverStatic_t
 	bool warnedNetworkScopeNotAdvertisable;
 
 	int           time; // will be strictly increasing across level changes
+	int           packetTime; // Sys::Milliseconds() when the packet being handled arrived
 
 	int           snapFlagServerBit; // ^= SNAPFLAG_SERVERCOUNT every SV_SpawnServer()
 
 	client_t      *clients; // [sv_maxclients->integer];
-	int           numSnapshotEntities; // sv_maxclients->integer*PACKET_BACKUP*MAX_PACKET_ENTITIES
-	int           nextSnapshotEntities; // next snapshotEntities to use
-	std::unique_ptr<entityState_t[]> snapshotEntities; // [numSnapshotEntities]
-	receipt_t     infoReceipts[ MAX_INFO_RECEIPTS ];
 
 	int       sampleTimes[ SERVER_PERFORMANCECOUNTER_SAMPLES ];
 	int       currentSampleIndex;
@@ -276,11 +273,21 @@ public:
 	void GameRunFrame(int levelTime);
 	NORETURN void BotAIStartFrame(int levelTime);
 
+	// Runs the usercmd of a client, batched with the others until the next call into the game
+	void QueueClientThink(int clientNum, const usercmd_t& cmd);
+	void FlushClientThinks();
+
 private:
 	virtual void Syscall(uint32_t id, Util::Reader reader, IPC::Channel& channel) override final;
 	void QVMSyscall(int syscallNum, Util::Reader& reader, IPC::Channel& channel);
 
 	IPC::SharedMemory shmRegion;
+	IPC::SharedMemory usercmdRegion;
+
+	// set when the game module handles GAME_CLIENT_THINK_BATCH
+	bool clientThinkBatch;
+	std::vector<int> pendingThinkClients;
+	std::vector<usercmd_t> pendingThinkCmds;
 
 	std::unique_ptr<VM::CommonVMServices> services;
 };
@@ -329,6 +336,9 @@ extern Cvar::Range<Cvar::Cvar<int>> sv_networkScope;
 //
 void       SV_FinalCommand( char *cmd, bool disconnect );  // ydnar: added disconnect flag so map changes can use this function as well
 void       SV_SendServerCommand( client_t *cl, const char *fmt, ... ) PRINTF_LIKE(2);
+const char *SV_ReliableCommand( const client_t *client, int sequence );
+void       SV_FreeServerCommands( client_t *client );
+void       SV_ShutdownServerCommands();
 void       SV_PrintTranslatedText( const char *text, bool broadcast, bool plural );
 
 void       SV_AddOperatorCommands();
@@ -339,6 +349,8 @@ void       SV_NET_Config();
 void       SV_Heartbeat_f();
 void       SV_MasterHeartbeat( const char *hbname );
 void       SV_MasterShutdown();
+void       SV_InvalidateInfoResponses();
+int        SV_PingTime();
 
 //
 // sv_init.c
@@ -382,13 +394,45 @@ void SV_WriteDownloadToClient( client_t *cl, msg_t *msg );
 //
 void SV_AddServerCommand( client_t *client, const char *cmd );
 void SV_UpdateServerCommandsToClient( client_t *client, msg_t *msg );
+int  SV_RateMsec( client_t *client, int messageSize );
 void SV_SendMessageToClient( msg_t *msg, client_t *client );
 void SV_SendClientMessages();
 void SV_SendClientSnapshot( client_t *client );
+int  SV_BotGetSnapshotEntity( int client, int sequence );
+void SV_ShutdownSnapshotWorkers();
+void SV_InvalidateSnapshotStates();
 
 //bani
 void SV_SendClientIdle( client_t *client );
 
+//
+// sv_profiler.cpp
+//
+enum class profilePhase_t
+{
+	PACKETS, // handling the packets of a client
+	PINGS,
+	GAME, // running the game frames
+	SNAPSHOTS, // all of SV_SendClientMessages
+	SNAPSHOT_BUILD, // finding the entities of a client's snapshot
+	SNAPSHOT_ENCODE, // delta encoding, which Huffman compresses at the same time
+	TRANSMIT, // sending through the netchan
+	FRAME, // all of SV_Frame
+	NUM_PHASES
+};
+
+Sys::SteadyClock::time_point SV_ProfileStart();
+void SV_ProfilePhase( profilePhase_t phase, Sys::SteadyClock::time_point start );
+void SV_ProfileClient( const client_t *client, profilePhase_t phase, Sys::SteadyClock::time_point start );
+void SV_ProfileResetClient( const client_t *client );
+void SV_ProfileEndFrame();
+void SV_ShutdownProfiler();
+
+//
+// sv_loadtest.cpp
+//
+void SV_StopLoadTest();
+
 //
 // sv_sgame.c
 //
@@ -399,6 +443,7 @@ svEntity_t     *SV_SvEntityForGentity( sharedEntity_t *gEnt );
 void           SV_InitGameProgs();
 void           SV_ShutdownGameProgs();
 void           SV_RestartGameProgs();
+void           SV_PublishUsercmd( int clientNum, const usercmd_t *cmd );
 
 //
 // sv_bot.c
@@ -415,6 +460,15 @@ int  SV_BotGetConsoleMessage( int client, char *buf, int size );
 void     SV_Netchan_Transmit( client_t *client, msg_t *msg );
 void     SV_Netchan_TransmitNextFragment( client_t *client );
 void     SV_Netchan_FreeQueue( client_t *client );
+void     SV_Netchan_BeginPacing();
+void     SV_Netchan_EndPacing( Sys::SteadyClock::time_point end );
+void     SV_Netchan_PacedTransmit( client_t *client, msg_t *msg );
+void     SV_Netchan_PacedTransmitNextFragment( client_t *client );
+Sys::SteadyClock::time_point SV_Netchan_TransmitPaced();
+void     SV_Netchan_FlushPaced( client_t *client );
+void     SV_Netchan_FlushAllPaced();
+void     SV_Netchan_DropPaced( client_t *client );
+void     SV_Netchan_ShutdownPacing();
 
 //bani - cl->downloadnotify
 #define DLNOTIFY_REDIRECT 0x00000001 // "Redirecting client ..."
@@ -50,6 +50,9 @@ enum gameImport_t
   BOT_FREE_CLIENT,
   BOT_GET_CONSOLE_MESSAGE,
   BOT_DEBUG_DRAW,
+
+  G_ENABLE_CLIENT_THINK_BATCH,
+  G_LOCATE_USERCMDS,
 };
 
 using LocateGameDataMsg1 = IPC::Message<IPC::Id<VM::QVM, G_LOCATE_GAME_DATA1>, IPC::SharedMemory, int, int, int>;
@@ -115,6 +118,28 @@ using BotGetConsoleMessageMsg = IPC::SyncMessage<
 // HACK: sgame message that only works when running in a client
 using BotDebugDrawMsg = IPC::Message<IPC::Id<VM::QVM, BOT_DEBUG_DRAW>, std::vector<char>>;
 
+// tells the engine that the game module handles GAME_CLIENT_THINK_BATCH
+using EnableClientThinkBatchMsg = IPC::Message<IPC::Id<VM::QVM, G_ENABLE_CLIENT_THINK_BATCH>>;
+
+// The latest usercmd of each client, written by the engine in a region shared
+// with the game module so that it doesn't need a GetUsercmdMsg to read them.
+// The sequence is odd while the engine writes the usercmd, a reader copies the
+// usercmd and tries again if the sequence changed meanwhile.
+struct sharedUsercmd_t
+{
+	std::atomic<uint32_t> sequence;
+	usercmd_t cmd;
+};
+
+struct sharedUsercmds_t
+{
+	sharedUsercmd_t clients[ MAX_CLIENTS ];
+};
+
+using LocateUsercmdsMsg = IPC::SyncMessage<
+	IPC::Message<IPC::Id<VM::QVM, G_LOCATE_USERCMDS>, IPC::SharedMemory>
+>;
+
 
 
 
@@ -155,6 +180,10 @@ enum gameExport_t
   BOT_VISIBLEFROMPOS, // bool ()( vec3_t srcOrig, int srcNum, dstOrig, int dstNum, bool isDummy );
   BOT_CHECKATTACKATPOS, // bool ()( int entityNum, int enemyNum, vec3_t position,
   //              bool ducking, bool allowWorldHit );
+
+  GAME_CLIENT_THINK_BATCH, // void ()( std::vector<int> clientNums, std::vector<usercmd_t> cmds );
+  // the same as a GAME_CLIENT_THINK for each of the usercmds, in order,
+  //  only sent after the game module sent G_ENABLE_CLIENT_THINK_BATCH
 };
 
 using GameStaticInitMsg = IPC::SyncMessage<
@@ -185,6 +214,9 @@ using GameClientCommandMsg = IPC::SyncMessage<
 using GameClientThinkMsg = IPC::SyncMessage<
 	IPC::Message<IPC::Id<VM::QVM, GAME_CLIENT_THINK>, int>
 >;
+using GameClientThinkBatchMsg = IPC::SyncMessage<
+	IPC::Message<IPC::Id<VM::QVM, GAME_CLIENT_THINK_BATCH>, std::vector<int>, std::vector<usercmd_t>>
+>;
 using GameRunFrameMsg = IPC::SyncMessage<
 	IPC::Message<IPC::Id<VM::QVM, GAME_RUN_FRAME>, int>
 >;
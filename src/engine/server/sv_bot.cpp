@@ -55,12 +55,14 @@ int SV_BotAllocateClient()
 	}
 
 	client_t* cl = svs.clients + i;
+	SV_ProfileResetClient(cl);
 	cl->gentity = SV_GentityNum(i);
 	cl->gentity->s.number = i;
 	cl->state = clientState_t::CS_ACTIVE;
 	cl->lastPacketTime = svs.time;
 	cl->netchan.remoteAddress.type = netadrtype_t::NA_BOT;
 	cl->rate = 16384;
+	SV_InvalidateInfoResponses();
 
 	return i;
 }
@@ -82,6 +84,7 @@ void SV_BotFreeClient( int clientNum )
 	cl = &svs.clients[ clientNum ];
 	cl->state = clientState_t::CS_FREE;
 	cl->name[ 0 ] = 0;
+	SV_InvalidateInfoResponses();
 }
 
 /*
@@ -106,7 +109,6 @@ SV_BotGetConsoleMessage
 int SV_BotGetConsoleMessage( int client, char*, int )
 {
 	client_t *cl;
-	int      index;
 
 	cl = &svs.clients[ client ];
 	cl->lastPacketTime = svs.time;
@@ -117,9 +119,8 @@ int SV_BotGetConsoleMessage( int client, char*, int )
 	}
 
 	cl->reliableAcknowledge++;
-	index = cl->reliableAcknowledge & ( MAX_RELIABLE_COMMANDS - 1 );
 
-	if ( !cl->reliableCommands[ index ][ 0 ] )
+	if ( !*SV_ReliableCommand( cl, cl->reliableAcknowledge ) )
 	{
 		return false;
 	}
@@ -297,6 +297,7 @@ public:
 			"version:  %s\n"
 			"protocol: %d\n"
 			"cpu:      %.0f%%\n"
+			"late:     %.2f ms average, %.2f ms max\n"
 			"time:     %s\n"
 			"map:      %s\n"
 			"players:  %d / %d\n"
@@ -306,6 +307,8 @@ public:
 			Q3_VERSION " on " Q3_ENGINE,
 			PROTOCOL_VERSION,
 			cpu,
+			svs.stats.latched_lateness,
+			svs.stats.latched_maxLateness,
 			time_string,
 			sv_mapname->string,
 			players,
@@ -185,7 +185,10 @@ void SV_DirectConnect( const netadr_t& from, const Cmd::Args& args )
 	// build a new connection
 	// accept the new client
 	// this is the only place a client_t is ever initialized
+	// a reconnecting client wasn't freed
+	SV_FreeServerCommands( new_client );
 	ResetStruct( *new_client );
+	SV_ProfileResetClient( new_client );
 	int clientNum = new_client - svs.clients;
 
 	Log::Notice( "Client %i connecting", clientNum );
@@ -221,6 +224,7 @@ void SV_DirectConnect( const netadr_t& from, const Cmd::Args& args )
 
 	new_client->state = clientState_t::CS_CONNECTED;
 	new_client->nextSnapshotTime = svs.time;
+	SV_InvalidateInfoResponses();
 	new_client->lastPacketTime = svs.time;
 	new_client->lastConnectTime = svs.time;
 
@@ -252,6 +256,8 @@ Destructor for data allocated in a client structure
 void SV_FreeClient( client_t *client )
 {
 	SV_Netchan_FreeQueue( client );
+	SV_Netchan_DropPaced( client );
+	SV_FreeServerCommands( client );
 	SV_CloseDownload( client );
 }
 
@@ -274,10 +280,12 @@ void SV_DropClient( client_t *drop, const char *reason )
 
 	Log::Debug( "Going to CS_ZOMBIE for %s", drop->name );
 	drop->state = clientState_t::CS_ZOMBIE; // become free in a few seconds
+	SV_InvalidateInfoResponses();
 
 	// call the prog function for removing a client
 	// this will remove the body, among other things
 	gvm.GameClientDisconnect( drop - svs.clients );
+	SV_InvalidateSnapshotStates();
 
 	if ( isBot )
 	{
@@ -420,6 +428,7 @@ void SV_ClientEnterWorld( client_t *client, usercmd_t *cmd )
 	client->deltaMessage = -1;
 	client->nextSnapshotTime = svs.time; // generate a snapshot immediately
 	client->lastUsercmd = *cmd;
+	SV_PublishUsercmd( clientNum, cmd );
 
 	// call the game begin function
 	gvm.GameClientBegin( client - svs.clients );
@@ -1018,6 +1027,7 @@ void SV_UserinfoChanged( client_t *cl )
 
 	// name for C code
 	Q_strncpyz( cl->name, Info_ValueForKey( cl->userinfo, "name" ), sizeof( cl->name ) );
+	SV_InvalidateInfoResponses();
 
 	// rate command
 
@@ -1243,19 +1253,21 @@ static bool SV_ClientCommand( client_t *cl, msg_t *msg, bool premaprestart )
 ==================
 SV_ClientThink
 
-Also called by bot code
+Also called by bot code. The game may run the usercmd later,
+batched with the others, see GameVM::QueueClientThink
 ==================
 */
 void SV_ClientThink( client_t *cl, usercmd_t *cmd )
 {
 	cl->lastUsercmd = *cmd;
+	SV_PublishUsercmd( cl - svs.clients, cmd );
 
 	if ( cl->state != clientState_t::CS_ACTIVE )
 	{
 		return; // may have been kicked during the last usercmd
 	}
 
-	gvm.GameClientThink( cl - svs.clients );
+	gvm.QueueClientThink( cl - svs.clients, *cmd );
 }
 
 /*
@@ -1311,8 +1323,8 @@ static void SV_UserMove( client_t *cl, msg_t *msg, bool delta )
 		oldcmd = cmd;
 	}
 
-	// save time for ping calculation
-	cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked = svs.time;
+	// save time for ping calculation, see SV_PingTime
+	cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked = NET_ReceiveThreadRunning() ? svs.packetTime : svs.time;
 
 	// if this is the first usercmd we have received
 	// this gamestate, put the client into the world
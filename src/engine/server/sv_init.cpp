@@ -339,8 +339,6 @@ void SV_Startup()
 	// RF, avoid trying to allocate large chunk on a fragmented zone
 	svs.clients = ( client_t * ) Z_Calloc( sizeof( client_t ) * sv_maxclients->integer );
 
-	svs.numSnapshotEntities = sv_maxclients->integer * PACKET_BACKUP * 64;
-
 	svs.initialized = true;
 
 	Cvar_Set( "sv_running", "1" );
@@ -394,12 +392,19 @@ void SV_ChangeMaxClients()
 		{
 			svs.clients[ i ] = oldClients[ i ];
 		}
+		else
+		{
+			SV_FreeServerCommands( &oldClients[ i ] );
+		}
+	}
+
+	for ( int i = count; i < oldMaxClients; i++ )
+	{
+		SV_FreeServerCommands( &oldClients[ i ] );
 	}
 
 	// free the old clients
 	Z_Free( oldClients );
-
-	svs.numSnapshotEntities = sv_maxclients->integer * PACKET_BACKUP * 64;
 }
 
 /*
@@ -454,9 +459,6 @@ void SV_SpawnServer(std::string pakname, std::string mapname)
 	// also print some status stuff
 	CL_MapLoading();
 
-	// clear collision map data
-	CM_ClearMap();
-
 	// wipe the entire per-level structure
 	SV_ClearServer();
 
@@ -467,7 +469,7 @@ void SV_SpawnServer(std::string pakname, std::string mapname)
 		sv.configstringsmodified[ i ] = false;
 	}
 
-	// init client structures and svs.numSnapshotEntities
+	// init client structures
 	if ( !Cvar_VariableValue( "sv_running" ) )
 	{
 		SV_Startup();
@@ -481,10 +483,6 @@ void SV_SpawnServer(std::string pakname, std::string mapname)
 		}
 	}
 
-	// allocate the snapshot entities
-	svs.snapshotEntities.reset(new entityState_t[svs.numSnapshotEntities]);
-	svs.nextSnapshotEntities = 0;
-
 	// toggle the server bit so clients can detect that a
 	// server has changed
 	svs.snapFlagServerBit ^= SNAPFLAG_SERVERCOUNT;
@@ -590,6 +588,7 @@ void SV_SpawnServer(std::string pakname, std::string mapname)
 
 	SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO, false ) );
 	cvar_modifiedFlags &= ~CVAR_SERVERINFO;
+	SV_InvalidateInfoResponses();
 
 	// any media configstring setting now should issue a warning
 	// and any configstring changes should be reliably transmitted
@@ -741,6 +740,10 @@ void SV_Shutdown( const char *finalmsg )
 
 	SV_RemoveOperatorCommands();
 
+	SV_ShutdownSnapshotWorkers();
+	SV_Netchan_ShutdownPacing();
+	SV_ShutdownProfiler();
+
 	// free current level
 	SV_ClearServer();
 
@@ -760,6 +763,7 @@ void SV_Shutdown( const char *finalmsg )
 		Z_Free( svs.clients );
 	}
 
+	SV_ShutdownServerCommands();
 	ResetStruct( svs );
 
 	svs.serverLoad = -1;
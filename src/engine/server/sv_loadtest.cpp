@@ -0,0 +1,1041 @@
+/*
+===========================================================================
+Daemon BSD Source Code
+Copyright (c) 2024, Daemon Developers
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Daemon developers nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DAEMON DEVELOPERS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================
+*/
+
+// sv_loadtest.cpp -- synthetic clients measuring how a server copes with load
+
+#include "server.h"
+#include "qcommon/crypto.h"
+#include "framework/CommandSystem.h"
+#include "framework/Network.h"
+
+/*
+=============================================================================
+
+The load test connects synthetic clients to a server, each with its own
+socket so that the server sees separate players, and has them send
+scripted usercmds at a fixed rate. They speak the protocol of the real
+client: challenge, connect, netchan, gamestate, delta compressed usercmds
+and snapshots.
+
+Everything runs on a separate thread, so that the arrival times of the
+snapshots aren't quantized by the frames of this process and so that the
+server may be tested from its own process. Decoding the playerstates needs
+the netcode table of the game, so when the game isn't loaded in this
+process only the snapshot headers are parsed. In that case the rest of the
+message is skipped, which is fine as the snapshot is the last thing the
+server writes.
+
+=============================================================================
+*/
+
+static const int LOADTEST_RESEND_MSEC = 3000; // same as the client's RETRANSMIT_TIMEOUT
+static const int LOADTEST_POLL_MSEC = 100; // how often the thread checks if it must stop
+static const int LOADTEST_DISCONNECT_PACKETS = 3; // the disconnect command is sent several times in case of loss
+
+enum class loadTestState_t
+{
+	GENERATING_KEY,
+	CHALLENGING,
+	CONNECTING,
+	CONNECTED, // waiting for the gamestate
+	ACTIVE,
+	DROPPED
+};
+
+struct loadTestSnapshot_t
+{
+	bool                       valid;
+	int                        messageNum;
+	OpaquePlayerState          ps;
+	std::vector<entityState_t> entities;
+};
+
+struct loadTestClient_t
+{
+	intptr_t                   socket = -1;
+	int                        qport;
+	loadTestState_t            state = loadTestState_t::GENERATING_KEY;
+	std::string                pubkey;
+	std::string                challenge;
+	Sys::SteadyClock::time_point lastConnectPacket;
+
+	std::unique_ptr<netchan_t> netchan;
+	int                        serverId;
+	int                        serverMessageSequence;
+	int                        serverCommandSequence;
+	int                        reliableSequence; // the client commands sent
+	int                        reliableAcknowledge; // the client commands the server got
+
+	usercmd_t                  lastCmd;
+
+	bool                       haveSnapshot;
+	int                        snapshotServerTime; // of the latest snapshot
+	Sys::SteadyClock::time_point snapshotArrival;
+	loadTestSnapshot_t         snapshot; // the latest valid snapshot when decoding
+	std::vector<loadTestSnapshot_t> snapshots; // [PACKET_BACKUP] when decoding
+
+	std::vector<int64_t>       delays; // arrival minus server time of each snapshot, in microseconds
+};
+
+struct loadTestStats_t
+{
+	int64_t          packetsSent;
+	int64_t          bytesSent;
+	int64_t          packetsReceived;
+	int64_t          bytesReceived;
+	int64_t          snapshots;
+	int64_t          droppedPackets; // server packets the netchan saw missing
+	int64_t          invalidDeltas; // snapshots delta compressed from one we don't have
+	std::vector<int> intervals; // between the snapshots of a client, in microseconds
+	std::vector<int> frameSteps; // server time between the snapshots of a client, in milliseconds
+};
+
+/*
+==================
+LT_Percentile
+==================
+*/
+static int LT_Percentile( std::vector<int> values, double fraction )
+{
+	if ( values.empty() )
+	{
+		return 0;
+	}
+
+	size_t rank = static_cast<size_t>( fraction * ( values.size() - 1 ) );
+	std::nth_element( values.begin(), values.begin() + rank, values.end() );
+	return values[ rank ];
+}
+
+/*
+==================
+LT_StdDev
+==================
+*/
+static double LT_StdDev( const std::vector<int> &values )
+{
+	if ( values.size() < 2 )
+	{
+		return 0.0;
+	}
+
+	double sum = 0.0, squares = 0.0;
+
+	for ( int value : values )
+	{
+		sum += value;
+		squares += double( value ) * value;
+	}
+
+	double mean = sum / values.size();
+	return sqrt( std::max( 0.0, squares / values.size() - mean * mean ) );
+}
+
+class LoadTest
+{
+public:
+	~LoadTest()
+	{
+		quiet_ = true;
+		Stop();
+	}
+
+	bool Running() const
+	{
+		return thread_.joinable() && !finished_;
+	}
+
+	bool Start( const netadr_t &server, int numClients, int seconds, int cmdRate )
+	{
+		// collect a test which ended by itself
+		Stop();
+
+		server_ = server;
+		duration_ = std::chrono::seconds( seconds );
+		cmdInterval_ = std::chrono::microseconds( 1000000 / cmdRate );
+		decode_ = MSG_HaveNetcodeTables();
+		clients_.clear();
+		clients_.resize( numClients );
+		sockets_.clear();
+		stats_ = {};
+		baselines_.clear();
+		start_ = Sys::SteadyClock::now();
+
+		int qport = rand();
+
+		for ( int i = 0; i < numClients; i++ )
+		{
+			loadTestClient_t &client = clients_[ i ];
+
+			client.socket = NET_OpenClientSocket();
+
+			if ( client.socket == -1 )
+			{
+				CloseSockets();
+				return false;
+			}
+
+			// the server tells apart the clients from the same address by their qport
+			client.qport = ( qport + i ) & 0xffff;
+			client.netchan.reset( new netchan_t );
+			sockets_.push_back( client.socket );
+
+			if ( decode_ )
+			{
+				client.snapshots.resize( PACKET_BACKUP );
+			}
+		}
+
+		if ( decode_ )
+		{
+			baselines_.resize( MAX_GENTITIES );
+		}
+
+		// makes sure the Huffman tables are built before the thread uses them
+		msg_t dummy;
+		MSG_Init( &dummy, nullptr, 0 );
+
+		halt_ = false;
+		finished_ = false;
+		quiet_ = false;
+		thread_ = std::thread( &LoadTest::Main, this );
+		return true;
+	}
+
+	void Stop()
+	{
+		if ( !thread_.joinable() )
+		{
+			return;
+		}
+
+		halt_ = true;
+		thread_.join();
+	}
+
+	void PrintReport() const
+	{
+		std::lock_guard<std::mutex> lock( statsMutex_ );
+		Report();
+	}
+
+private:
+	netadr_t                       server_;
+	Sys::SteadyClock::duration     duration_;
+	Sys::SteadyClock::duration     cmdInterval_;
+	bool                           decode_;
+	std::vector<loadTestClient_t>  clients_;
+	std::vector<intptr_t>          sockets_;
+	std::vector<entityState_t>     baselines_; // [MAX_GENTITIES] when decoding, shared as the gamestate is the same for all
+	Sys::SteadyClock::time_point   start_;
+
+	mutable std::mutex             statsMutex_; // protects stats_ and the client states while the thread runs
+	loadTestStats_t                stats_;
+
+	std::thread                    thread_;
+	std::atomic<bool>              halt_{ false };
+	std::atomic<bool>              finished_{ false };
+	std::atomic<bool>              quiet_{ false };
+
+	void CloseSockets()
+	{
+		for ( loadTestClient_t &client : clients_ )
+		{
+			NET_CloseClientSocket( client.socket );
+			client.socket = -1;
+		}
+
+		sockets_.clear();
+	}
+
+	void Main()
+	{
+		Sys::SteadyClock::time_point end = start_ + duration_;
+		Sys::SteadyClock::time_point nextCmd = start_;
+
+		while ( !halt_ )
+		{
+			auto now = Sys::SteadyClock::now();
+
+			if ( now >= end )
+			{
+				break;
+			}
+
+			GenerateKey();
+
+			auto wait = std::min( { nextCmd, end, now + std::chrono::milliseconds( LOADTEST_POLL_MSEC ) } ) - now;
+			NET_SelectClientSockets( sockets_.data(), static_cast<int>( sockets_.size() ), std::chrono::duration_cast<std::chrono::microseconds>( wait ) );
+
+			ReceivePackets();
+
+			now = Sys::SteadyClock::now();
+
+			for ( loadTestClient_t &client : clients_ )
+			{
+				SendConnectPacket( client, now );
+			}
+
+			if ( now >= nextCmd )
+			{
+				for ( loadTestClient_t &client : clients_ )
+				{
+					SendCmdPacket( client, now );
+				}
+
+				nextCmd += cmdInterval_;
+
+				// don't send a burst of packets after a stall
+				if ( now - nextCmd > std::chrono::seconds( 1 ) )
+				{
+					nextCmd = now;
+				}
+			}
+		}
+
+		Disconnect();
+
+		{
+			std::lock_guard<std::mutex> lock( statsMutex_ );
+
+			if ( !quiet_ )
+			{
+				Report();
+			}
+
+			CloseSockets();
+		}
+
+		finished_ = true;
+	}
+
+	/*
+	The keys are generated one at a time as it takes a while, which spreads
+	the connections of the clients.
+	*/
+	void GenerateKey()
+	{
+		for ( loadTestClient_t &client : clients_ )
+		{
+			if ( client.state != loadTestState_t::GENERATING_KEY )
+			{
+				continue;
+			}
+
+			struct rsa_public_key publicKey;
+			struct rsa_private_key privateKey;
+			char key[ RSA_STRING_LENGTH ];
+
+			rsa_public_key_init( &publicKey );
+			rsa_private_key_init( &privateKey );
+			mpz_set_ui( publicKey.e, RSA_PUBLIC_EXPONENT );
+
+			bool generated = rsa_generate_keypair( &publicKey, &privateKey, nullptr, qnettle_random, nullptr, nullptr, RSA_KEY_LENGTH, 0 );
+
+			if ( generated )
+			{
+				mpz_get_str( key, 16, publicKey.n );
+			}
+
+			rsa_public_key_clear( &publicKey );
+			rsa_private_key_clear( &privateKey );
+
+			std::lock_guard<std::mutex> lock( statsMutex_ );
+
+			if ( !generated )
+			{
+				Log::Warn( "loadTest: couldn't generate a RSA keypair" );
+				client.state = loadTestState_t::DROPPED;
+				return;
+			}
+
+			client.pubkey = key;
+			client.state = loadTestState_t::CHALLENGING;
+			client.lastConnectPacket = {};
+			return;
+		}
+	}
+
+	void SendPacket( loadTestClient_t &client, const byte *data, int length )
+	{
+		NET_SendClientPacket( client.socket, length, data, server_ );
+
+		std::lock_guard<std::mutex> lock( statsMutex_ );
+		stats_.packetsSent++;
+		stats_.bytesSent += length;
+	}
+
+	void SendOutOfBand( loadTestClient_t &client, const std::string &text )
+	{
+		byte data[ MAX_MSGLEN ];
+		msg_t msg;
+
+		msg.data = data;
+		msg.cursize = Net::OOBHeader().size() + text.size();
+		memcpy( data, Net::OOBHeader().data(), Net::OOBHeader().size() );
+		memcpy( data + Net::OOBHeader().size(), text.data(), text.size() );
+
+		// the server expects the connect packets to be compressed, see Net::OutOfBandData
+		if ( Str::IsPrefix( "connect ", text ) )
+		{
+			Huff_Compress( &msg, 12 );
+		}
+
+		SendPacket( client, msg.data, msg.cursize );
+	}
+
+	/*
+	Resends the handshake packets which didn't get an answer, like CL_CheckForResend
+	*/
+	void SendConnectPacket( loadTestClient_t &client, Sys::SteadyClock::time_point now )
+	{
+		if ( client.state != loadTestState_t::CHALLENGING && client.state != loadTestState_t::CONNECTING )
+		{
+			return;
+		}
+
+		if ( now - client.lastConnectPacket < std::chrono::milliseconds( LOADTEST_RESEND_MSEC ) )
+		{
+			return;
+		}
+
+		client.lastConnectPacket = now;
+
+		if ( client.state == loadTestState_t::CHALLENGING )
+		{
+			SendOutOfBand( client, "getchallenge" );
+			return;
+		}
+
+		int clientNum = &client - clients_.data();
+		InfoMap info;
+
+		info[ "name" ] = Str::Format( "loadtest%d", clientNum );
+		// let the server send a snapshot every frame as fast as it wants
+		info[ "rate" ] = "90000";
+		info[ "snaps" ] = "1000";
+		info[ "protocol" ] = std::to_string( PROTOCOL_VERSION );
+		info[ "qport" ] = std::to_string( client.qport );
+		info[ "challenge" ] = client.challenge;
+		info[ "pubkey" ] = client.pubkey;
+
+		SendOutOfBand( client, "connect " + Cmd::Escape( InfoMapToString( info ) ) );
+	}
+
+	/*
+	Like CL_WritePacket, with one new scripted usercmd per packet and the
+	previous one again in case of loss
+	*/
+	void SendCmdPacket( loadTestClient_t &client, Sys::SteadyClock::time_point now )
+	{
+		if ( client.state != loadTestState_t::CONNECTED && client.state != loadTestState_t::ACTIVE )
+		{
+			return;
+		}
+
+		msg_t buf;
+		byte  data[ MAX_MSGLEN ];
+
+		MSG_Init( &buf, data, sizeof( data ) );
+		MSG_Bitstream( &buf );
+		MSG_WriteLong( &buf, client.serverId );
+		MSG_WriteLong( &buf, client.serverMessageSequence );
+		MSG_WriteLong( &buf, client.serverCommandSequence );
+
+		for ( int i = client.reliableAcknowledge + 1; i <= client.reliableSequence; i++ )
+		{
+			MSG_WriteByte( &buf, clc_clientCommand );
+			MSG_WriteLong( &buf, i );
+			MSG_WriteString( &buf, "disconnect" );
+		}
+
+		if ( client.state == loadTestState_t::ACTIVE )
+		{
+			usercmd_t cmd = ScriptedCmd( client, now );
+			usercmd_t nullcmd{};
+
+			// without decoding we can't know if the server deltas from a snapshot
+			// we have, but we don't use them anyway
+			bool delta = client.haveSnapshot && ( !decode_ || client.snapshot.messageNum == client.serverMessageSequence );
+
+			MSG_WriteByte( &buf, delta ? clc_move : clc_moveNoDelta );
+			MSG_WriteByte( &buf, 2 );
+			MSG_WriteDeltaUsercmd( &buf, &nullcmd, &client.lastCmd );
+			MSG_WriteDeltaUsercmd( &buf, &client.lastCmd, &cmd );
+			client.lastCmd = cmd;
+		}
+
+		MSG_WriteByte( &buf, clc_EOF );
+
+		// like Netchan_Transmit, the messages of the clients are never fragmented
+		byte  packet[ MAX_MSGLEN ];
+		msg_t send;
+
+		MSG_InitOOB( &send, packet, sizeof( packet ) );
+		MSG_WriteLong( &send, client.netchan->outgoingSequence++ );
+		MSG_WriteShort( &send, client.qport );
+		MSG_WriteData( &send, buf.data, buf.cursize );
+
+		SendPacket( client, send.data, send.cursize );
+	}
+
+	/*
+	Runs in circles while strafing from side to side and jumping now and
+	then, with a different phase for every client
+	*/
+	usercmd_t ScriptedCmd( const loadTestClient_t &client, Sys::SteadyClock::time_point now ) const
+	{
+		usercmd_t cmd{};
+		int clientNum = &client - clients_.data();
+		int msec = std::chrono::duration_cast<std::chrono::milliseconds>( now - start_ ).count() + clientNum * 397;
+
+		// the server time is estimated from the latest snapshot
+		if ( client.haveSnapshot )
+		{
+			cmd.serverTime = client.snapshotServerTime + std::chrono::duration_cast<std::chrono::milliseconds>( now - client.snapshotArrival ).count();
+		}
+
+		cmd.angles[ YAW ] = ANGLE2SHORT( msec * 0.09f );
+		cmd.forwardmove = 127;
+		cmd.rightmove = ( msec / 2000 ) & 1 ? 127 : -127;
+		cmd.upmove = msec % 3000 < 100 ? 127 : 0;
+
+		return cmd;
+	}
+
+	/*
+	Asks the server to drop the clients, like CL_Disconnect
+	*/
+	void Disconnect()
+	{
+		for ( loadTestClient_t &client : clients_ )
+		{
+			if ( client.state != loadTestState_t::CONNECTED && client.state != loadTestState_t::ACTIVE )
+			{
+				continue;
+			}
+
+			client.reliableSequence = client.reliableAcknowledge + 1;
+
+			for ( int i = 0; i < LOADTEST_DISCONNECT_PACKETS; i++ )
+			{
+				SendCmdPacket( client, Sys::SteadyClock::now() );
+			}
+		}
+	}
+
+	void ReceivePackets()
+	{
+		byte  data[ MAX_MSGLEN ];
+		msg_t msg;
+
+		for ( loadTestClient_t &client : clients_ )
+		{
+			netadr_t from;
+
+			MSG_Init( &msg, data, sizeof( data ) );
+
+			while ( NET_GetClientPacket( client.socket, &from, &msg ) )
+			{
+				auto arrival = Sys::SteadyClock::now();
+
+				{
+					std::lock_guard<std::mutex> lock( statsMutex_ );
+					stats_.packetsReceived++;
+					stats_.bytesReceived += msg.cursize;
+				}
+
+				if ( NET_CompareAdr( from, server_ ) )
+				{
+					if ( msg.cursize >= 4 && *reinterpret_cast<int *>( msg.data ) == -1 )
+					{
+						ConnectionlessPacket( client, &msg );
+					}
+					else
+					{
+						SequencedPacket( client, &msg, arrival );
+					}
+				}
+
+				MSG_Init( &msg, data, sizeof( data ) );
+			}
+		}
+	}
+
+	/*
+	Like CL_ConnectionlessPacket
+	*/
+	void ConnectionlessPacket( loadTestClient_t &client, msg_t *msg )
+	{
+		MSG_BeginReadingOOB( msg );
+		MSG_ReadLong( msg ); // skip the -1
+
+		Cmd::Args args( MSG_ReadStringLine( msg ) );
+
+		if ( args.Argc() < 1 )
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock( statsMutex_ );
+
+		if ( args.Argv( 0 ) == "challengeResponse" && client.state == loadTestState_t::CHALLENGING && args.Argc() >= 2 )
+		{
+			client.challenge = args.Argv( 1 );
+			client.state = loadTestState_t::CONNECTING;
+			client.lastConnectPacket = {};
+		}
+		else if ( args.Argv( 0 ) == "connectResponse" && client.state == loadTestState_t::CONNECTING )
+		{
+			Netchan_Setup( netsrc_t::NS_CLIENT, client.netchan.get(), server_, client.qport );
+			client.state = loadTestState_t::CONNECTED;
+		}
+		else if ( args.Argv( 0 ) == "print" && client.state < loadTestState_t::CONNECTED )
+		{
+			// a rejected connection, the message is on the next line
+			Log::Notice( "loadTest: client %d: %s", &client - clients_.data(), MSG_ReadString( msg ) );
+		}
+		else if ( args.Argv( 0 ) == "disconnect" && client.state >= loadTestState_t::CONNECTED )
+		{
+			client.state = loadTestState_t::DROPPED;
+		}
+	}
+
+	/*
+	Like CL_PacketEvent and CL_ParseServerMessage
+	*/
+	void SequencedPacket( loadTestClient_t &client, msg_t *msg, Sys::SteadyClock::time_point arrival )
+	{
+		if ( client.state != loadTestState_t::CONNECTED && client.state != loadTestState_t::ACTIVE )
+		{
+			return;
+		}
+
+		if ( msg->cursize < 4 || !Netchan_Process( client.netchan.get(), msg ) )
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock( statsMutex_ );
+
+		stats_.droppedPackets += std::max( client.netchan->dropped, 0 );
+		client.serverMessageSequence = LittleLong( *reinterpret_cast<int *>( msg->data ) );
+
+		MSG_Bitstream( msg );
+		client.reliableAcknowledge = MSG_ReadLong( msg );
+
+		if ( client.reliableAcknowledge < client.reliableSequence - MAX_RELIABLE_COMMANDS )
+		{
+			client.reliableAcknowledge = client.reliableSequence;
+		}
+
+		while ( client.state != loadTestState_t::DROPPED )
+		{
+			if ( msg->readcount > msg->cursize )
+			{
+				Log::Warn( "loadTest: read past end of server message" );
+				return;
+			}
+
+			int cmd = MSG_ReadByte( msg );
+
+			if ( cmd < 0 || cmd == svc_EOF )
+			{
+				return;
+			}
+
+			switch ( cmd )
+			{
+				case svc_nop:
+					break;
+
+				case svc_serverCommand:
+					ParseCommandString( client, msg );
+					break;
+
+				case svc_gamestate:
+					if ( !ParseGamestate( client, msg ) )
+					{
+						return;
+					}
+					break;
+
+				case svc_snapshot:
+					ParseSnapshot( client, msg, arrival );
+
+					if ( !decode_ )
+					{
+						// the rest of the message can't be found without the playerstate
+						return;
+					}
+					break;
+
+				default:
+					Log::Warn( "loadTest: illegible server message %d", cmd );
+					return;
+			}
+		}
+	}
+
+	/*
+	Like CL_ParseCommandString, but the commands are only looked at for a disconnection
+	*/
+	void ParseCommandString( loadTestClient_t &client, msg_t *msg )
+	{
+		int seq = MSG_ReadLong( msg );
+		const char *s = MSG_ReadString( msg );
+
+		if ( client.serverCommandSequence >= seq )
+		{
+			return;
+		}
+
+		client.serverCommandSequence = seq;
+
+		if ( Str::IsPrefix( "disconnect", s ) )
+		{
+			Log::Notice( "loadTest: client %d dropped: %s", &client - clients_.data(), s );
+			client.state = loadTestState_t::DROPPED;
+		}
+	}
+
+	/*
+	Like CL_ParseGamestate
+	*/
+	bool ParseGamestate( loadTestClient_t &client, msg_t *msg )
+	{
+		client.serverCommandSequence = MSG_ReadLong( msg );
+
+		while ( true )
+		{
+			int cmd = MSG_ReadByte( msg );
+
+			if ( cmd == svc_EOF )
+			{
+				break;
+			}
+
+			if ( cmd == svc_configstring )
+			{
+				int i = MSG_ReadShort( msg );
+				const char *str = MSG_ReadBigString( msg );
+
+				if ( i == CS_SYSTEMINFO )
+				{
+					client.serverId = atoi( Info_ValueForKey( str, "sv_serverid" ) );
+				}
+			}
+			else if ( cmd == svc_baseline )
+			{
+				int newnum = MSG_ReadBits( msg, GENTITYNUM_BITS );
+				entityState_t nullstate{};
+				entityState_t baseline;
+
+				MSG_ReadDeltaEntity( msg, &nullstate, &baseline, newnum );
+
+				if ( decode_ )
+				{
+					baselines_[ newnum ] = baseline;
+				}
+			}
+			else
+			{
+				Log::Warn( "loadTest: bad command byte in the gamestate" );
+				return false;
+			}
+		}
+
+		MSG_ReadLong( msg ); // clientNum
+
+		client.state = loadTestState_t::ACTIVE;
+		client.haveSnapshot = false;
+		client.snapshot = {};
+
+		for ( loadTestSnapshot_t &snapshot : client.snapshots )
+		{
+			snapshot.valid = false;
+		}
+
+		return true;
+	}
+
+	/*
+	Like CL_ParseSnapshot
+	*/
+	void ParseSnapshot( loadTestClient_t &client, msg_t *msg, Sys::SteadyClock::time_point arrival )
+	{
+		loadTestSnapshot_t newSnap{};
+		byte areamask[ MAX_MAP_AREA_BYTES ];
+
+		int serverTime = MSG_ReadLong( msg );
+		int deltaNum = MSG_ReadByte( msg );
+		MSG_ReadByte( msg ); // snapFlags
+
+		int len = MSG_ReadByte( msg );
+
+		if ( len > static_cast<int>( sizeof( areamask ) ) )
+		{
+			Log::Warn( "loadTest: invalid size %d for the areamask", len );
+			return;
+		}
+
+		MSG_ReadData( msg, areamask, len );
+
+		if ( decode_ )
+		{
+			loadTestSnapshot_t *old = nullptr;
+
+			newSnap.messageNum = client.serverMessageSequence;
+
+			if ( !deltaNum )
+			{
+				newSnap.valid = true;
+			}
+			else
+			{
+				old = &client.snapshots[ ( newSnap.messageNum - deltaNum ) & PACKET_MASK ];
+				newSnap.valid = old->valid && old->messageNum == newSnap.messageNum - deltaNum;
+			}
+
+			MSG_ReadDeltaPlayerstate( msg, old ? &old->ps : nullptr, &newSnap.ps );
+			ParsePacketEntities( msg, old, &newSnap );
+
+			if ( !newSnap.valid )
+			{
+				stats_.invalidDeltas++;
+				return;
+			}
+
+			client.snapshot = newSnap;
+			client.snapshots[ newSnap.messageNum & PACKET_MASK ] = std::move( newSnap );
+		}
+
+		stats_.snapshots++;
+
+		if ( client.haveSnapshot )
+		{
+			stats_.intervals.push_back( std::chrono::duration_cast<std::chrono::microseconds>( arrival - client.snapshotArrival ).count() );
+			stats_.frameSteps.push_back( serverTime - client.snapshotServerTime );
+		}
+
+		client.delays.push_back( std::chrono::duration_cast<std::chrono::microseconds>( arrival - start_ ).count() - serverTime * int64_t( 1000 ) );
+		client.haveSnapshot = true;
+		client.snapshotServerTime = serverTime;
+		client.snapshotArrival = arrival;
+	}
+
+	/*
+	Like CL_ParsePacketEntities
+	*/
+	void ParsePacketEntities( msg_t *msg, const loadTestSnapshot_t *oldSnapshot, loadTestSnapshot_t *newSnapshot ) const
+	{
+		static const std::vector<entityState_t> noEntities;
+		const std::vector<entityState_t> &oldEntities = oldSnapshot ? oldSnapshot->entities : noEntities;
+		std::vector<entityState_t> &newEntities = newSnapshot->entities;
+		size_t oldIndex = 0;
+
+		newEntities.reserve( MSG_ReadShort( msg ) );
+
+		while ( true )
+		{
+			int newEntityNum = MSG_ReadBits( msg, GENTITYNUM_BITS );
+
+			if ( msg->readcount > msg->cursize )
+			{
+				Log::Warn( "loadTest: unexpected end of snapshot" );
+				newSnapshot->valid = false;
+				return;
+			}
+
+			if ( newEntityNum == MAX_GENTITIES - 1 )
+			{
+				break;
+			}
+
+			// the unchanged entities before this one
+			while ( oldIndex < oldEntities.size() && oldEntities[ oldIndex ].number < newEntityNum )
+			{
+				newEntities.push_back( oldEntities[ oldIndex++ ] );
+			}
+
+			// a delta from the old snapshot or from the baseline
+			const entityState_t *from = &baselines_[ newEntityNum ];
+
+			if ( oldIndex < oldEntities.size() && oldEntities[ oldIndex ].number == newEntityNum )
+			{
+				from = &oldEntities[ oldIndex++ ];
+			}
+
+			entityState_t entity;
+			MSG_ReadDeltaEntity( msg, from, &entity, newEntityNum );
+
+			if ( entity.number != MAX_GENTITIES - 1 )
+			{
+				newEntities.push_back( entity );
+			}
+		}
+
+		newEntities.insert( newEntities.end(), oldEntities.begin() + oldIndex, oldEntities.end() );
+	}
+
+	void Report() const
+	{
+		int active = 0;
+		std::vector<int> delays;
+
+		for ( const loadTestClient_t &client : clients_ )
+		{
+			if ( client.state == loadTestState_t::ACTIVE )
+			{
+				active++;
+			}
+
+			if ( client.delays.empty() )
+			{
+				continue;
+			}
+
+			// the clocks of the client and server aren't synchronized, so
+			// the delays are relative to the shortest one
+			int64_t shortest = *std::min_element( client.delays.begin(), client.delays.end() );
+
+			for ( int64_t delay : client.delays )
+			{
+				delays.push_back( static_cast<int>( delay - shortest ) );
+			}
+		}
+
+		double seconds = std::chrono::duration<double>( std::min( Sys::SteadyClock::now() - start_, duration_ ) ).count();
+		double perClient = std::max( seconds, 0.001 ) * std::max<size_t>( clients_.size(), 1 );
+
+		Log::Notice( "loadTest: %d/%d clients active after %.1f s%s", active, clients_.size(), seconds,
+		             decode_ ? "" : ", snapshots not decoded as the game isn't loaded" );
+		Log::Notice( "sent %d packets, %d bytes, %.1f kB/s per client", stats_.packetsSent, stats_.bytesSent,
+		             stats_.bytesSent / perClient / 1000.0 );
+		Log::Notice( "received %d packets, %d bytes, %.1f kB/s per client, %d lost", stats_.packetsReceived,
+		             stats_.bytesReceived, stats_.bytesReceived / perClient / 1000.0, stats_.droppedPackets );
+		Log::Notice( "%d snapshots, %.1f per second per client, %d delta compressed from a snapshot not received",
+		             stats_.snapshots, stats_.snapshots / perClient, stats_.invalidDeltas );
+		Log::Notice( "%-24s %8s %8s %8s %8s", "milliseconds", "p50", "p99", "max", "stddev" );
+		Log::Notice( "%-24s %8.2f %8.2f %8.2f %8.2f", "snapshot interval", LT_Percentile( stats_.intervals, 0.5 ) / 1000.0,
+		             LT_Percentile( stats_.intervals, 0.99 ) / 1000.0, LT_Percentile( stats_.intervals, 1.0 ) / 1000.0,
+		             LT_StdDev( stats_.intervals ) / 1000.0 );
+		Log::Notice( "%-24s %8d %8d %8d %8.2f", "server frame step", LT_Percentile( stats_.frameSteps, 0.5 ),
+		             LT_Percentile( stats_.frameSteps, 0.99 ), LT_Percentile( stats_.frameSteps, 1.0 ),
+		             LT_StdDev( stats_.frameSteps ) );
+		Log::Notice( "%-24s %8.2f %8.2f %8.2f %8.2f", "snapshot delay", LT_Percentile( delays, 0.5 ) / 1000.0,
+		             LT_Percentile( delays, 0.99 ) / 1000.0, LT_Percentile( delays, 1.0 ) / 1000.0,
+		             LT_StdDev( delays ) / 1000.0 );
+	}
+};
+
+static LoadTest loadTest;
+
+/*
+==================
+SV_StopLoadTest
+
+Called before the netcode table of the game changes, as the load test
+may be decoding playerstates with it
+==================
+*/
+void SV_StopLoadTest()
+{
+	if ( loadTest.Running() )
+	{
+		Log::Notice( "Stopping the load test as the game restarts" );
+	}
+
+	loadTest.Stop();
+}
+
+class LoadTestCmd: public Cmd::StaticCmd
+{
+public:
+	LoadTestCmd():
+		StaticCmd("loadTest", Cmd::SYSTEM, "Connects synthetic clients to a server and measures its snapshots")
+	{}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		if ( args.Argc() == 1 && loadTest.Running() )
+		{
+			loadTest.PrintReport();
+			return;
+		}
+
+		if ( args.Argc() == 2 && args.Argv( 1 ) == "stop" )
+		{
+			loadTest.Stop();
+			return;
+		}
+
+		if ( args.Argc() < 3 || args.Argc() > 5 )
+		{
+			PrintUsage( args, "<server> <clients> [seconds] [cmdRate]", "or \"loadTest stop\", or \"loadTest\" to show the results so far" );
+			return;
+		}
+
+		if ( loadTest.Running() )
+		{
+			Print( "A load test is already running" );
+			return;
+		}
+
+		netadr_t server;
+
+		if ( !NET_StringToAdr( args.Argv( 1 ).c_str(), &server, netadrtype_t::NA_IP ) || server.type != netadrtype_t::NA_IP )
+		{
+			Print( "Bad IPv4 server address: %s", args.Argv( 1 ) );
+			return;
+		}
+
+		int clients = 0, seconds = 60, cmdRate = 60;
+
+		if ( !Str::ParseInt( clients, args.Argv( 2 ) )
+		     || ( args.Argc() > 3 && !Str::ParseInt( seconds, args.Argv( 3 ) ) )
+		     || ( args.Argc() > 4 && !Str::ParseInt( cmdRate, args.Argv( 4 ) ) )
+		     || clients < 1 || clients > MAX_CLIENTS || seconds < 1 || cmdRate < 1 || cmdRate > 1000 )
+		{
+			Print( "There must be 1 to %d clients, 1 or more seconds and 1 to 1000 usercmds per second", MAX_CLIENTS );
+			return;
+		}
+
+		if ( !loadTest.Start( server, clients, seconds, cmdRate ) )
+		{
+			Print( "Couldn't open the sockets of the clients" );
+			return;
+		}
+
+		Print( "Connecting %d clients to %s for %d seconds", clients, Net::AddressToString( server, true ), seconds );
+	}
+};
+
+static LoadTestCmd LoadTestCmdRegistration;
@@ -58,6 +58,12 @@ GameVM         gvm; // game virtual machine
 // is based on real time, disregarding timescale.
 cvar_t         *sv_fps;
 
+static Cvar::Cvar<bool> sv_preciseFrames("sv_preciseFrames",
+	"schedule the frames of dedicated servers on a nanosecond clock instead of in whole milliseconds", Cvar::NONE, true);
+static Cvar::Cvar<bool> sv_pacedSnapshots("sv_pacedSnapshots",
+	"spread the messages to the clients over the time until the next frame instead of sending them in one burst, "
+	"needs sv_preciseFrames", Cvar::NONE, false);
+
 cvar_t         *sv_timeout; // seconds without any message
 cvar_t         *sv_zombietime; // seconds to sink messages after disconnect
 cvar_t         *sv_privatePassword; // password for the privateClient slots
@@ -155,15 +161,134 @@ EVENT MESSAGES
 =============================================================================
 */
 
+/*
+=============================================================================
+
+The reliable command strings are kept once in a server-wide ring, with
+the number of client slots referencing them, so that a broadcast is one
+copy whatever the number of clients. The clients only keep handles, the
+indexes in the ring plus one so that a cleared client_t references none.
+A string is released when its slot in the client is reused, or when the
+client is freed.
+
+=============================================================================
+*/
+
+struct serverCommand_t
+{
+	int         refs;
+	std::string text;
+};
+
+static std::vector<serverCommand_t> serverCommands;
+static size_t                       serverCommandNext; // where to look for a free string first
+
 /*
 ======================
-SV_AddServerCommand
+SV_AllocServerCommand
 
-The given command will be transmitted to the client, and is guaranteed to
-not have future snapshot_t executed before it is executed
+Returns the handle of a new string, with one reference held by the caller
 ======================
 */
-void SV_AddServerCommand( client_t *client, const char *cmd )
+static int SV_AllocServerCommand( const char *cmd )
+{
+	size_t size = serverCommands.size();
+	size_t i;
+
+	// the strings are mostly released in the order they were added
+	for ( i = 0; i < size; i++ )
+	{
+		if ( !serverCommands[ ( serverCommandNext + i ) % size ].refs )
+		{
+			break;
+		}
+	}
+
+	if ( i < size )
+	{
+		i = ( serverCommandNext + i ) % size;
+	}
+	else
+	{
+		serverCommands.resize( std::max<size_t>( size * 2, MAX_RELIABLE_COMMANDS ) );
+		i = size;
+	}
+
+	serverCommand_t &command = serverCommands[ i ];
+
+	command.refs = 1;
+	command.text.assign( cmd, std::min<size_t>( strlen( cmd ), MAX_STRING_CHARS - 1 ) );
+	serverCommandNext = i + 1;
+
+	return i + 1;
+}
+
+/*
+======================
+SV_ReleaseServerCommand
+======================
+*/
+static void SV_ReleaseServerCommand( int handle )
+{
+	if ( handle > 0 && handle <= static_cast<int>( serverCommands.size() ) && serverCommands[ handle - 1 ].refs > 0 )
+	{
+		serverCommands[ handle - 1 ].refs--;
+	}
+}
+
+/*
+======================
+SV_ReliableCommand
+
+The text of the client's reliable command of that sequence, empty if none
+======================
+*/
+const char *SV_ReliableCommand( const client_t *client, int sequence )
+{
+	int handle = client->reliableCommands[ sequence & ( MAX_RELIABLE_COMMANDS - 1 ) ];
+
+	if ( handle <= 0 || handle > static_cast<int>( serverCommands.size() ) )
+	{
+		return "";
+	}
+
+	return serverCommands[ handle - 1 ].text.c_str();
+}
+
+/*
+======================
+SV_FreeServerCommands
+
+Releases the strings referenced by the client
+======================
+*/
+void SV_FreeServerCommands( client_t *client )
+{
+	for ( int &handle : client->reliableCommands )
+	{
+		SV_ReleaseServerCommand( handle );
+		handle = 0;
+	}
+}
+
+/*
+======================
+SV_ShutdownServerCommands
+======================
+*/
+void SV_ShutdownServerCommands()
+{
+	serverCommands.clear();
+	serverCommands.shrink_to_fit();
+	serverCommandNext = 0;
+}
+
+/*
+======================
+SV_AddServerCommandHandle
+======================
+*/
+static void SV_AddServerCommandHandle( client_t *client, int handle )
 {
 	int index, i;
 
@@ -179,16 +304,34 @@ void SV_AddServerCommand( client_t *client, const char *cmd )
 
 		for ( i = client->reliableAcknowledge + 1; i <= client->reliableSequence; i++ )
 		{
-			Log::Debug( "cmd %5d: %s", i, client->reliableCommands[ i & ( MAX_RELIABLE_COMMANDS - 1 ) ] );
+			Log::Debug( "cmd %5d: %s", i, SV_ReliableCommand( client, i ) );
 		}
 
-		Log::Debug( "cmd %5d: %s", i, cmd );
+		Log::Debug( "cmd %5d: %s", i, serverCommands[ handle - 1 ].text );
 		SV_DropClient( client, "Server command overflow" );
 		return;
 	}
 
 	index = client->reliableSequence & ( MAX_RELIABLE_COMMANDS - 1 );
-	Q_strncpyz( client->reliableCommands[ index ], cmd, sizeof( client->reliableCommands[ index ] ) );
+	SV_ReleaseServerCommand( client->reliableCommands[ index ] );
+	client->reliableCommands[ index ] = handle;
+	serverCommands[ handle - 1 ].refs++;
+}
+
+/*
+======================
+SV_AddServerCommand
+
+The given command will be transmitted to the client, and is guaranteed to
+not have future snapshot_t executed before it is executed
+======================
+*/
+void SV_AddServerCommand( client_t *client, const char *cmd )
+{
+	int handle = SV_AllocServerCommand( cmd );
+
+	SV_AddServerCommandHandle( client, handle );
+	SV_ReleaseServerCommand( handle );
 }
 
 /*
@@ -244,7 +387,9 @@ void PRINTF_LIKE(2) SV_SendServerCommand( client_t *cl, const char *fmt, ... )
 		}
 	}
 
-	// send the data to all relevent clients
+	// send the data to all relevent clients, sharing the string
+	int handle = SV_AllocServerCommand( ( char * ) message );
+
 	for ( j = 0, client = svs.clients; j < sv_maxclients->integer; j++, client++ )
 	{
 		if ( client->state < clientState_t::CS_PRIMED )
@@ -259,8 +404,10 @@ void PRINTF_LIKE(2) SV_SendServerCommand( client_t *cl, const char *fmt, ... )
 		}
 
 		// done.
-		SV_AddServerCommand( client, ( char * ) message );
+		SV_AddServerCommandHandle( client, handle );
 	}
+
+	SV_ReleaseServerCommand( handle );
 }
 
 /*
@@ -463,6 +610,60 @@ CONNECTIONLESS COMMANDS
 ==============================================================================
 */
 
+/*
+================
+Cached getinfo/getstatus responses
+
+Populating an info map from the cvars is the costly part of the responses,
+so it is done again only when the serverinfo or the player list changed.
+The scores and pings of the status are refreshed at most every
+STATUS_REFRESH_MSEC, and the challenges are appended to the cached strings.
+================
+*/
+static const int STATUS_REFRESH_MSEC = 1000;
+
+struct infoResponse_t
+{
+	bool        valid;
+	int         time; // svs.time when the status players were listed
+	int         serverLoad;
+	std::string info; // without the challenges
+	std::string players;
+};
+
+static infoResponse_t statusResponse, infoResponse;
+
+/*
+================
+SV_InvalidateInfoResponses
+
+Called when the serverinfo or the player list change
+================
+*/
+void SV_InvalidateInfoResponses()
+{
+	statusResponse.valid = false;
+	infoResponse.valid = false;
+}
+
+/*
+================
+SV_InfoChallenge
+
+The info string item echoing the challenge of the query, which master
+servers use to prevent timed spoofed reply packets adding ghost servers
+================
+*/
+static std::string SV_InfoChallenge( const Cmd::Args& args )
+{
+	if ( args.Argc() > 1 && InfoValidItem( args.Argv( 1 ) ) && !args.Argv( 1 ).empty() )
+	{
+		return INFO_SEPARATOR + std::string( "challenge" ) + INFO_SEPARATOR + args.Argv( 1 );
+	}
+
+	return "";
+}
+
 /*
 ================
 SVC_Status
@@ -479,30 +680,42 @@ static void SVC_Status( const netadr_t& from, const Cmd::Args& args )
 		return;
 	}
 
-	InfoMap info_map;
-	Cvar::PopulateInfoMap(CVAR_SERVERINFO, info_map);
+	// the serverinfo cvars changed since the last frame
+	if ( cvar_modifiedFlags & CVAR_SERVERINFO )
+	{
+		SV_InvalidateInfoResponses();
+	}
 
-	if ( args.Argc() > 1 && InfoValidItem(args.Argv(1)) )
+	if ( !statusResponse.valid )
 	{
-		// echo back the parameter to status. so master servers can use it as a challenge
-		// to prevent timed spoofed reply packets that add ghost servers
-		info_map["challenge"] = args.Argv(1);
+		InfoMap info_map;
+		Cvar::PopulateInfoMap(CVAR_SERVERINFO, info_map);
+
+		statusResponse.info = InfoMapToString( info_map );
+		statusResponse.time = svs.time - STATUS_REFRESH_MSEC;
+		statusResponse.valid = true;
 	}
 
-	std::string status;
-	for ( int i = 0; i < sv_maxclients->integer; i++ )
+	if ( svs.time - statusResponse.time >= STATUS_REFRESH_MSEC || svs.time < statusResponse.time )
 	{
-		client_t* cl = &svs.clients[ i ];
+		statusResponse.players.clear();
 
-		if ( cl->state >= clientState_t::CS_CONNECTED )
+		for ( int i = 0; i < sv_maxclients->integer; i++ )
 		{
-			OpaquePlayerState* ps = SV_GameClientNum( i );
-			status +=  Str::Format( "%i %i \"%s\"\n", ps->persistant[ PERS_SCORE ], cl->ping, cl->name );
+			client_t* cl = &svs.clients[ i ];
+
+			if ( cl->state >= clientState_t::CS_CONNECTED )
+			{
+				OpaquePlayerState* ps = SV_GameClientNum( i );
+				statusResponse.players +=  Str::Format( "%i %i \"%s\"\n", ps->persistant[ PERS_SCORE ], cl->ping, cl->name );
+			}
 		}
+
+		statusResponse.time = svs.time;
 	}
 
-	Net::OutOfBandPrint( netsrc_t::NS_SERVER, from, "statusResponse\n%s\n%s",
-		InfoMapToString( info_map ), status );
+	Net::OutOfBandPrint( netsrc_t::NS_SERVER, from, "statusResponse\n%s%s\n%s",
+		statusResponse.info, SV_InfoChallenge( args ), statusResponse.players );
 }
 
 /*
@@ -520,37 +733,65 @@ static void SVC_Info( const netadr_t& from, const Cmd::Args& args )
 		return;
 	}
 
-	int bots = 0; // Bots always use public slots.
-	int publicSlotHumans = 0;
-	int privateSlotHumans = 0;
+	if ( cvar_modifiedFlags & CVAR_SERVERINFO )
+	{
+		SV_InvalidateInfoResponses();
+	}
 
-	for ( int i = 0; i < sv_maxclients->integer; i++ )
+	if ( !infoResponse.valid || infoResponse.serverLoad != svs.serverLoad )
 	{
-		if ( svs.clients[ i ].state >= clientState_t::CS_CONNECTED )
+		int bots = 0; // Bots always use public slots.
+		int publicSlotHumans = 0;
+		int privateSlotHumans = 0;
+
+		for ( int i = 0; i < sv_maxclients->integer; i++ )
 		{
-			if (i < sv_privateClients.Get())
-			{
-				++privateSlotHumans;
-			}
-			else if ( SV_IsBot(&svs.clients[ i ]) )
-			{
-				++bots;
-			}
-			else
+			if ( svs.clients[ i ].state >= clientState_t::CS_CONNECTED )
 			{
-				++publicSlotHumans;
+				if (i < sv_privateClients.Get())
+				{
+					++privateSlotHumans;
+				}
+				else if ( SV_IsBot(&svs.clients[ i ]) )
+				{
+					++bots;
+				}
+				else
+				{
+					++publicSlotHumans;
+				}
 			}
 		}
+
+		InfoMap info_map;
+
+		info_map["protocol"] = std::to_string( PROTOCOL_VERSION );
+		info_map["hostname"] = sv_hostname->string;
+		info_map["serverload"] = std::to_string( svs.serverLoad );
+		info_map["mapname"] = sv_mapname->string;
+		info_map["clients"] = std::to_string( publicSlotHumans + privateSlotHumans );
+		info_map["bots"] = std::to_string( bots );
+		// Satisfies (number of open public slots) = (displayed max clients) - (number of clients).
+		info_map["sv_maxclients"] = std::to_string(
+		    std::max( 0, sv_maxclients->integer - sv_privateClients.Get() ) + privateSlotHumans );
+
+		if ( sv_statsURL->string[0] )
+		{
+			info_map["stats"] = sv_statsURL->string;
+		}
+
+		info_map["gamename"] = GAMENAME_STRING;  // Arnout: to be able to filter out Quake servers
+
+		infoResponse.info = InfoMapToString( info_map );
+		infoResponse.serverLoad = svs.serverLoad;
+		infoResponse.valid = true;
 	}
 
-	InfoMap info_map;
+	std::string challenges = SV_InfoChallenge( args );
 
-	if ( args.Argc() > 1 && InfoValidItem(args.Argv(1)) )
+	if ( !challenges.empty() )
 	{
-		std::string  challenge = args.Argv(1);
-		// echo back the parameter to status. so master servers can use it as a challenge
-		// to prevent timed spoofed reply packets that add ghost servers
-		info_map["challenge"] = challenge;
+		std::string challenge = args.Argv(1);
 
 		// If the master server listens on IPv4 and IPv6, we want to send the
 		// most recent challenge received from it over the OTHER protocol
@@ -569,7 +810,11 @@ static void SVC_Info( const netadr_t& from, const Cmd::Args& args )
 			{
 				if ( master.challenge_address_type != from.type )
 				{
-					info_map["challenge2"] = master.challenge;
+					if ( !master.challenge.empty() )
+					{
+						challenges += INFO_SEPARATOR + std::string( "challenge2" ) + INFO_SEPARATOR + master.challenge;
+					}
+
 					master.challenge_address_type = from.type;
 					master.challenge = challenge;
 					break;
@@ -582,24 +827,7 @@ static void SVC_Info( const netadr_t& from, const Cmd::Args& args )
 		}
 	}
 
-	info_map["protocol"] = std::to_string( PROTOCOL_VERSION );
-	info_map["hostname"] = sv_hostname->string;
-	info_map["serverload"] = std::to_string( svs.serverLoad );
-	info_map["mapname"] = sv_mapname->string;
-	info_map["clients"] = std::to_string( publicSlotHumans + privateSlotHumans );
-	info_map["bots"] = std::to_string( bots );
-	// Satisfies (number of open public slots) = (displayed max clients) - (number of clients).
-	info_map["sv_maxclients"] = std::to_string(
-	    std::max( 0, sv_maxclients->integer - sv_privateClients.Get() ) + privateSlotHumans );
-
-	if ( sv_statsURL->string[0] )
-	{
-		info_map["stats"] = sv_statsURL->string;
-	}
-
-	info_map["gamename"] = GAMENAME_STRING;  // Arnout: to be able to filter out Quake servers
-
-	Net::OutOfBandPrint( netsrc_t::NS_SERVER, from, "infoResponse\n%s", InfoMapToString( info_map ) );
+	Net::OutOfBandPrint( netsrc_t::NS_SERVER, from, "infoResponse\n%s%s", infoResponse.info, challenges );
 }
 
 /*
@@ -616,6 +844,92 @@ static void SVC_Ping( const netadr_t& from, const Cmd::Args& )
 	Net::OutOfBandPrint( netsrc_t::NS_SERVER, from, "ack\n" );
 }
 
+/*
+=================
+getinfo/getstatus rate limiting
+
+Token buckets refilled over INFO_RECEIPT_MSEC: a global one allowing
+MAX_INFO_RECEIPTS responses and one per address block allowing
+MAX_ADDRESS_RECEIPTS. The blocks are kept in a hashed set associative
+table, so checking a packet costs the same however many are coming; when
+a set is full, the block closest to a full bucket is forgotten.
+=================
+*/
+static const int INFO_RECEIPT_MSEC = 2000;
+static const int MAX_ADDRESS_RECEIPTS = 5;
+static const int INFO_RECEIPT_SETS = 256; // must be a power of two
+static const int INFO_RECEIPT_WAYS = 4;
+
+struct infoReceipt_t
+{
+	bool     used;
+	netadr_t adr; // masked to the address block
+	int      time; // svs.time when tokens was refilled
+	float    tokens;
+};
+
+static infoReceipt_t infoReceipts[ INFO_RECEIPT_SETS ][ INFO_RECEIPT_WAYS ];
+static infoReceipt_t globalInfoReceipts;
+static uint32_t      infoReceiptSeed;
+
+/*
+=================
+SV_RefillInfoReceipts
+
+Returns the tokens of the bucket at svs.time
+=================
+*/
+static float SV_RefillInfoReceipts( const infoReceipt_t &receipt, int capacity )
+{
+	// svs.time may start over after a map change
+	if ( !receipt.used || svs.time < receipt.time )
+	{
+		return capacity;
+	}
+
+	return std::min<float>( capacity, receipt.tokens + float( svs.time - receipt.time ) * capacity / INFO_RECEIPT_MSEC );
+}
+
+/*
+=================
+SV_InfoReceiptSet
+=================
+*/
+static infoReceipt_t *SV_InfoReceiptSet( const netadr_t &adr )
+{
+	const byte *bytes;
+	int        length;
+
+	if ( adr.type == netadrtype_t::NA_IP )
+	{
+		bytes = adr.ip;
+		length = 3;
+	}
+	else
+	{
+		bytes = adr.ip6;
+		length = 7;
+	}
+
+	if ( !infoReceiptSeed )
+	{
+		Sys::GenRandomBytes( &infoReceiptSeed, sizeof( infoReceiptSeed ) );
+		infoReceiptSeed |= 1;
+	}
+
+	// FNV-1a, seeded so that the collisions can't be picked from outside
+	uint32_t hash = 2166136261u ^ infoReceiptSeed;
+
+	for ( int i = 0; i < length; i++ )
+	{
+		hash = ( hash ^ bytes[ i ] ) * 16777619u;
+	}
+
+	hash ^= hash >> 16;
+
+	return infoReceipts[ hash & ( INFO_RECEIPT_SETS - 1 ) ];
+}
+
 /*
 =================
 SV_CheckDRDoS
@@ -629,13 +943,7 @@ If the address isn't NA_IP, it's automatically denied.
 */
 bool SV_CheckDRDoS( netadr_t from )
 {
-	int        i;
-	int        globalCount;
-	int        specificCount;
-	receipt_t  *receipt;
 	netadr_t   exactFrom;
-	int        oldest;
-	int        oldestTime;
 	static int lastGlobalLogTime = 0;
 	static int lastSpecificLogTime = 0;
 
@@ -663,67 +971,62 @@ bool SV_CheckDRDoS( netadr_t from )
 		return true;
 	}
 
-	// Count receipts in last 2 seconds.
-	globalCount = 0;
-	specificCount = 0;
-	receipt = &svs.infoReceipts[ 0 ];
-	oldest = 0;
-	oldestTime = 0x7fffffff;
+	float globalTokens = SV_RefillInfoReceipts( globalInfoReceipts, MAX_INFO_RECEIPTS );
 
-	for ( i = 0; i < MAX_INFO_RECEIPTS; i++, receipt++ )
+	if ( globalTokens < 1.0f )
 	{
-		if ( receipt->time + 2000 > svs.time )
+		if ( lastGlobalLogTime + 1000 <= svs.time ) // Limit one log every second.
 		{
-			if ( receipt->time )
-			{
-				// When the server starts, all receipt times are at zero.  Furthermore,
-				// svs.time is close to zero.  We check that the receipt time is already
-				// set so that during the first two seconds after server starts, queries
-				// from the master servers don't get ignored.  As a consequence a potentially
-				// unlimited number of getinfo+getstatus responses may be sent during the
-				// first frame of a server's life.
-				globalCount++;
-			}
-
-			if ( NET_CompareBaseAdr( from, receipt->adr ) )
-			{
-				specificCount++;
-			}
+			netLog.Notice( "Detected flood of getinfo/getstatus connectionless packets" );
+			lastGlobalLogTime = svs.time;
 		}
 
-		if ( receipt->time < oldestTime )
-		{
-			oldestTime = receipt->time;
-			oldest = i;
-		}
+		return true;
 	}
 
-	if ( globalCount == MAX_INFO_RECEIPTS ) // All receipts happened in last 2 seconds.
+	infoReceipt_t *set = SV_InfoReceiptSet( from );
+	infoReceipt_t *receipt = nullptr;
+	float         tokens = -1.0f;
+	bool          found = false;
+
+	for ( int i = 0; i < INFO_RECEIPT_WAYS && !found; i++ )
 	{
-		if ( lastGlobalLogTime + 1000 <= svs.time ) // Limit one log every second.
+		found = set[ i ].used && NET_CompareBaseAdr( from, set[ i ].adr );
+
+		// otherwise replace the block which would lose the least
+		float refilled = SV_RefillInfoReceipts( set[ i ], MAX_ADDRESS_RECEIPTS );
+
+		if ( found || refilled > tokens )
 		{
-			netLog.Notice( "Detected flood of getinfo/getstatus connectionless packets" );
-			lastGlobalLogTime = svs.time;
+			receipt = &set[ i ];
+			tokens = refilled;
 		}
+	}
 
-		return true;
+	if ( !found )
+	{
+		receipt->used = true;
+		receipt->adr = from;
+		tokens = MAX_ADDRESS_RECEIPTS;
 	}
 
-	if ( specificCount >= 5 ) // Already sent 5 to this IP address in last 2 seconds.
+	if ( tokens < 1.0f ) // Already sent 5 to this IP address in last 2 seconds.
 	{
 		if ( lastSpecificLogTime + 1000 <= svs.time ) // Limit one log every second.
 		{
-			netLog.Notice( "Possible DRDoS attack to address %i.%i.%i.%i, ignoring getinfo/getstatus connectionless packet",
-			               exactFrom.ip[ 0 ], exactFrom.ip[ 1 ], exactFrom.ip[ 2 ], exactFrom.ip[ 3 ] );
+			netLog.Notice( "Possible DRDoS attack to address %s, ignoring getinfo/getstatus connectionless packet",
+			               Net::AddressToString( exactFrom ) );
 			lastSpecificLogTime = svs.time;
 		}
 
 		return true;
 	}
 
-	receipt = &svs.infoReceipts[ oldest ];
-	receipt->adr = from;
+	receipt->tokens = tokens - 1.0f;
 	receipt->time = svs.time;
+	globalInfoReceipts.used = true;
+	globalInfoReceipts.tokens = globalTokens - 1.0f;
+	globalInfoReceipts.time = svs.time;
 	return false;
 }
 
@@ -1072,12 +1375,14 @@ static bool SV_IsAllowedNetwork( const netadr_t& address )
 SV_PacketEvent
 =================
 */
-void SV_PacketEvent( const netadr_t& from, msg_t *msg )
+void SV_PacketEvent( const netadr_t& from, msg_t *msg, int time )
 {
 	int      i;
 	client_t *cl;
 	int      qport;
 
+	svs.packetTime = time;
+
 	if ( !SV_IsAllowedNetwork( from ) )
 	{
 		return;
@@ -1133,8 +1438,11 @@ void SV_PacketEvent( const netadr_t& from, msg_t *msg )
 			// reliable message, but they don't do any other processing
 			if ( cl->state != clientState_t::CS_ZOMBIE )
 			{
+				auto profileStart = SV_ProfileStart();
+
 				cl->lastPacketTime = svs.time; // don't timeout
 				SV_ExecuteClientMessage( cl, msg );
+				SV_ProfileClient( cl, profilePhase_t::PACKETS, profileStart );
 			}
 		}
 
@@ -1146,6 +1454,21 @@ void SV_PacketEvent( const netadr_t& from, msg_t *msg )
 	Net::OutOfBandPrint( netsrc_t::NS_SERVER, from, "disconnect" );
 }
 
+/*
+===================
+SV_PingTime
+
+The time a message is sent at for the ping calculation. When the receive
+thread timestamps the packets on arrival, it is the real time so that the
+wait until the next frame doesn't count in the pings. Otherwise it stays
+the server time, as the acknowledges are handled in the frames anyway.
+===================
+*/
+int SV_PingTime()
+{
+	return NET_ReceiveThreadRunning() ? Sys::Milliseconds() : svs.time;
+}
+
 /*
 ===================
 SV_CalcPings
@@ -1279,6 +1602,62 @@ void SV_CheckTimeouts()
 	}
 }
 
+/*
+==================
+SV_PreciseFrames
+
+Whether the frames are scheduled by SV_ScheduleFrames
+==================
+*/
+static bool SV_PreciseFrames()
+{
+	return Com_IsDedicatedServer() && sv_preciseFrames.Get() && com_timescale->value == 1.0f;
+}
+
+/*
+==================
+SV_ScheduleFrames
+
+Drift-free scheduling of the frames of dedicated servers: each frame is
+due one frame duration after the previous one, on the nanosecond clock,
+however late the previous one ran. Returns false after sleeping until the
+next frame is due or a packet arrives, otherwise adds the frames due to
+sv.timeResidual.
+==================
+*/
+static bool SV_ScheduleFrames( int frameMsec )
+{
+	Sys::SteadyClock::time_point now = Sys::SteadyClock::now();
+
+	// after a map change or a long hitch, start again from now
+	// rather than running all the missed frames at once
+	if ( now - sv.frameDeadline > std::chrono::seconds( 5 ) )
+	{
+		sv.frameDeadline = now;
+	}
+
+	if ( now < sv.frameDeadline )
+	{
+		// wake up for the paced messages too
+		NET_SleepUntil( std::min( sv.frameDeadline, SV_Netchan_TransmitPaced() ) );
+		return false;
+	}
+
+	double lateness = std::chrono::duration<double, std::milli>( now - sv.frameDeadline ).count();
+
+	svs.stats.lateness += lateness;
+	svs.stats.maxLateness = std::max( svs.stats.maxLateness, lateness );
+	svs.stats.scheduledFrames++;
+
+	while ( sv.frameDeadline <= now )
+	{
+		sv.frameDeadline += std::chrono::milliseconds( frameMsec );
+		sv.timeResidual += frameMsec;
+	}
+
+	return true;
+}
+
 /*
 ==================
 SV_FrameMsec
@@ -1287,6 +1666,12 @@ Return time in milliseconds until processing of the next server frame.
 */
 int SV_FrameMsec()
 {
+	// SV_Frame does the waiting
+	if ( SV_PreciseFrames() )
+	{
+		return 0;
+	}
+
 	if( sv_fps )
 	{
 		const int frameMsec = static_cast<int>(1000.0f / sv_fps->value);
@@ -1349,16 +1734,28 @@ void SV_Frame( int msec )
 
 	frameMsec = 1000 / sv_fps->integer;
 
-	sv.timeResidual += msec;
-
-	if ( Com_IsDedicatedServer() && sv.timeResidual < frameMsec )
+	if ( SV_PreciseFrames() )
 	{
-		// NET_Sleep will give the OS time slices until either get a packet
-		// or time enough for a server frame has gone by
-		NET_Sleep( frameMsec - sv.timeResidual );
-		return;
+		if ( !SV_ScheduleFrames( frameMsec ) )
+		{
+			return;
+		}
+	}
+	else
+	{
+		sv.timeResidual += msec;
+
+		if ( Com_IsDedicatedServer() && sv.timeResidual < frameMsec )
+		{
+			// NET_Sleep will give the OS time slices until either get a packet
+			// or time enough for a server frame has gone by
+			NET_Sleep( frameMsec - sv.timeResidual );
+			return;
+		}
 	}
 
+	auto profileFrameStart = SV_ProfileStart();
+
 	// if time is about to hit the 32nd bit, kick all clients
 	// and clear sv.time, rather
 	// than checking for negative time wraparound everywhere.
@@ -1376,14 +1773,6 @@ void SV_Frame( int msec )
 		Sys::Drop( "Restarting server due to time wrapping" );
 	}
 
-	// this can happen considerably earlier when lots of clients play and the map doesn't change
-	if ( svs.nextSnapshotEntities >= 0x7FFFFFFE - svs.numSnapshotEntities )
-	{
-		// TTimo see above
-		Cmd::BufferCommandText(Str::Format("map %s", Cmd::Escape(sv_mapname->string)));
-		Sys::Drop( "Restarting server due to numSnapshotEntities wrapping" );
-	}
-
 	if ( sv.restartTime && sv.time >= sv.restartTime )
 	{
 		sv.restartTime = 0;
@@ -1396,6 +1785,7 @@ void SV_Frame( int msec )
 	{
 		SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO, false ) );
 		cvar_modifiedFlags &= ~CVAR_SERVERINFO;
+		SV_InvalidateInfoResponses();
 	}
 
 	if ( cvar_modifiedFlags & CVAR_SYSTEMINFO )
@@ -1414,9 +1804,13 @@ void SV_Frame( int msec )
 	}
 
 	// update ping based on the all received frames
+	auto profileStart = SV_ProfileStart();
 	SV_CalcPings();
+	SV_ProfilePhase( profilePhase_t::PINGS, profileStart );
 
 	// run the game simulation in chunks
+	profileStart = SV_ProfileStart();
+
 	while ( sv.timeResidual >= frameMsec )
 	{
 		sv.timeResidual -= frameMsec;
@@ -1427,6 +1821,8 @@ void SV_Frame( int msec )
 		gvm.GameRunFrame( sv.time );
 	}
 
+	SV_ProfilePhase( profilePhase_t::GAME, profileStart );
+
 	if ( com_speeds->integer )
 	{
 		time_game = Sys::Milliseconds() - startTime;
@@ -1435,9 +1831,28 @@ void SV_Frame( int msec )
 	// check timeouts
 	SV_CheckTimeouts();
 
-	// send messages back to the clients
+	// send messages back to the clients, all at once unless
+	// they are paced until the next frame
+	bool paced = sv_pacedSnapshots.Get() && SV_PreciseFrames();
+
+	profileStart = SV_ProfileStart();
+	NET_BeginSendBatch();
+
+	if ( paced )
+	{
+		SV_Netchan_BeginPacing();
+	}
+
 	SV_SendClientMessages();
 
+	if ( paced )
+	{
+		SV_Netchan_EndPacing( sv.frameDeadline );
+	}
+
+	NET_FlushSendBatch();
+	SV_ProfilePhase( profilePhase_t::SNAPSHOTS, profileStart );
+
 	// send a heartbeat to the master if needed
 	SV_MasterHeartbeat( HEARTBEAT_GAME );
 
@@ -1446,6 +1861,9 @@ void SV_Frame( int msec )
 	svs.totalFrameTime += ( frameEndTime - frameStartTime );
 	svs.currentFrameIndex++;
 
+	SV_ProfilePhase( profilePhase_t::FRAME, profileFrameStart );
+	SV_ProfileEndFrame();
+
 	//if( svs.currentFrameIndex % 50 == 0 )
 	//  Log::Notice( "currentFrameIndex: %i", svs.currentFrameIndex );
 
@@ -1494,9 +1912,14 @@ void SV_Frame( int msec )
 		svs.stats.latched_active = svs.stats.active;
 		svs.stats.latched_idle = svs.stats.idle;
 		svs.stats.latched_packets = svs.stats.packets;
+		svs.stats.latched_lateness = svs.stats.scheduledFrames ? svs.stats.lateness / svs.stats.scheduledFrames : 0;
+		svs.stats.latched_maxLateness = svs.stats.maxLateness;
 		svs.stats.active = 0;
 		svs.stats.idle = 0;
 		svs.stats.packets = 0;
+		svs.stats.lateness = 0;
+		svs.stats.maxLateness = 0;
+		svs.stats.scheduledFrames = 0;
 		svs.stats.count = 0;
 	}
 }
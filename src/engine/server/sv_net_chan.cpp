@@ -139,3 +139,300 @@ void SV_Netchan_Transmit( client_t *client, msg_t *msg )
 	}
 }
 
+
+/*
+=============================================================================
+
+Paced transmission: instead of sending the messages of all the clients in
+one burst at the end of the frame, the messages built by
+SV_SendClientMessages are queued and spread evenly over the time until the
+next frame. Each client also has a token bucket filled at its rate, in
+milliseconds of SV_RateMsec, so that a message isn't sent before the
+previous ones had the time to go through. A queued message is always sent
+before anything else is built for its client, and at the latest at the
+start of the next SV_SendClientMessages, so the netchan sequences and the
+client frames stay in order.
+
+=============================================================================
+*/
+
+struct pacedMessage_t
+{
+	bool                         pending;
+	bool                         fragment; // only the next fragment of the current message
+	msg_t                        msg;
+	std::vector<byte>            buffer;
+	Sys::SteadyClock::time_point due;
+	Sys::SteadyClock::time_point refilled; // when credit was last brought up to date
+	int                          credit; // in milliseconds of the client's rate
+};
+
+static std::vector<pacedMessage_t> pacedMessages; // [sv_maxclients->integer]
+static std::vector<int>            pacedQueue; // clients in the order their message was queued
+static bool                        pacing; // between SV_Netchan_BeginPacing and SV_Netchan_EndPacing
+
+/*
+=================
+SV_Netchan_PacedCost
+
+The milliseconds of the client's rate the queued message takes
+=================
+*/
+static int SV_Netchan_PacedCost( client_t *client, const pacedMessage_t &paced )
+{
+	if ( paced.fragment )
+	{
+		return SV_RateMsec( client, client->netchan.unsentLength - client->netchan.unsentFragmentStart );
+	}
+
+	return SV_RateMsec( client, paced.msg.cursize );
+}
+
+/*
+=================
+SV_Netchan_PacedCredit
+
+The credit of the bucket at time now, which holds at most one frame
+=================
+*/
+static int SV_Netchan_PacedCredit( const pacedMessage_t &paced, Sys::SteadyClock::time_point now )
+{
+	int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>( now - paced.refilled ).count();
+
+	return std::min<int64_t>( paced.credit + elapsed, 1000 / sv_fps->integer );
+}
+
+/*
+=================
+SV_Netchan_SendPaced
+=================
+*/
+static void SV_Netchan_SendPaced( client_t *client, pacedMessage_t &paced )
+{
+	Sys::SteadyClock::time_point now = Sys::SteadyClock::now();
+
+	paced.pending = false;
+	paced.credit = SV_Netchan_PacedCredit( paced, now ) - SV_Netchan_PacedCost( client, paced );
+	paced.refilled = now;
+
+	if ( paced.fragment )
+	{
+		SV_Netchan_TransmitNextFragment( client );
+		return;
+	}
+
+	// with real time pings, the ping is measured from when it really goes out
+	if ( NET_ReceiveThreadRunning() )
+	{
+		client->frames[ client->netchan.outgoingSequence & PACKET_MASK ].messageSent = SV_PingTime();
+	}
+
+	SV_Netchan_Transmit( client, &paced.msg );
+}
+
+/*
+=================
+SV_Netchan_BeginPacing
+
+The messages are queued until SV_Netchan_EndPacing
+=================
+*/
+void SV_Netchan_BeginPacing()
+{
+	if ( static_cast<int>( pacedMessages.size() ) != sv_maxclients->integer )
+	{
+		SV_Netchan_FlushAllPaced();
+		pacedMessages.resize( sv_maxclients->integer );
+	}
+
+	pacing = true;
+}
+
+/*
+=================
+SV_Netchan_EndPacing
+
+Spreads the queued messages until end
+=================
+*/
+void SV_Netchan_EndPacing( Sys::SteadyClock::time_point end )
+{
+	Sys::SteadyClock::time_point now = Sys::SteadyClock::now();
+	Sys::SteadyClock::duration   interval = std::max( end - now, Sys::SteadyClock::duration::zero() );
+	int                          count = pacedQueue.size();
+
+	pacing = false;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		client_t       *client = &svs.clients[ pacedQueue[ i ] ];
+		pacedMessage_t &paced = pacedMessages[ pacedQueue[ i ] ];
+		int            missing = SV_Netchan_PacedCost( client, paced ) - SV_Netchan_PacedCredit( paced, now );
+
+		paced.due = std::max( now + interval * i / count, now + std::chrono::milliseconds( std::max( missing, 0 ) ) );
+	}
+}
+
+/*
+=================
+SV_Netchan_PacedTransmit
+
+SV_Netchan_Transmit, once it is the time when pacing
+=================
+*/
+void SV_Netchan_PacedTransmit( client_t *client, msg_t *msg )
+{
+	if ( !pacing )
+	{
+		SV_Netchan_Transmit( client, msg );
+		return;
+	}
+
+	pacedMessage_t &paced = pacedMessages[ client - svs.clients ];
+
+	if ( paced.pending )
+	{
+		SV_Netchan_SendPaced( client, paced );
+	}
+
+	if ( paced.buffer.empty() )
+	{
+		paced.buffer.resize( MAX_MSGLEN );
+	}
+
+	MSG_Copy( &paced.msg, paced.buffer.data(), paced.buffer.size(), msg );
+	paced.pending = true;
+	paced.fragment = false;
+	pacedQueue.push_back( client - svs.clients );
+}
+
+/*
+=================
+SV_Netchan_PacedTransmitNextFragment
+
+SV_Netchan_TransmitNextFragment, once it is the time when pacing
+=================
+*/
+void SV_Netchan_PacedTransmitNextFragment( client_t *client )
+{
+	if ( !pacing )
+	{
+		SV_Netchan_TransmitNextFragment( client );
+		return;
+	}
+
+	pacedMessage_t &paced = pacedMessages[ client - svs.clients ];
+
+	if ( paced.pending )
+	{
+		SV_Netchan_SendPaced( client, paced );
+	}
+
+	paced.pending = true;
+	paced.fragment = true;
+	pacedQueue.push_back( client - svs.clients );
+}
+
+/*
+=================
+SV_Netchan_TransmitPaced
+
+Sends the queued messages which are due, returns when the next one is
+=================
+*/
+Sys::SteadyClock::time_point SV_Netchan_TransmitPaced()
+{
+	Sys::SteadyClock::time_point now = Sys::SteadyClock::now();
+	Sys::SteadyClock::time_point next = Sys::SteadyClock::time_point::max();
+	size_t                       kept = 0;
+
+	for ( int clientNum : pacedQueue )
+	{
+		pacedMessage_t &paced = pacedMessages[ clientNum ];
+
+		// sent early or dropped
+		if ( !paced.pending )
+		{
+			continue;
+		}
+
+		if ( paced.due <= now )
+		{
+			SV_Netchan_SendPaced( &svs.clients[ clientNum ], paced );
+			continue;
+		}
+
+		next = std::min( next, paced.due );
+		pacedQueue[ kept++ ] = clientNum;
+	}
+
+	pacedQueue.resize( kept );
+	return next;
+}
+
+/*
+=================
+SV_Netchan_FlushPaced
+
+Sends the queued message of the client now, before anything else is
+built for it
+=================
+*/
+void SV_Netchan_FlushPaced( client_t *client )
+{
+	size_t clientNum = client - svs.clients;
+
+	if ( clientNum < pacedMessages.size() && pacedMessages[ clientNum ].pending )
+	{
+		SV_Netchan_SendPaced( client, pacedMessages[ clientNum ] );
+	}
+}
+
+/*
+=================
+SV_Netchan_FlushAllPaced
+=================
+*/
+void SV_Netchan_FlushAllPaced()
+{
+	for ( int clientNum : pacedQueue )
+	{
+		if ( pacedMessages[ clientNum ].pending )
+		{
+			SV_Netchan_SendPaced( &svs.clients[ clientNum ], pacedMessages[ clientNum ] );
+		}
+	}
+
+	pacedQueue.clear();
+}
+
+/*
+=================
+SV_Netchan_DropPaced
+
+Forgets the queued message of a client being freed, it would otherwise go
+out on the netchan of the next client in the slot
+=================
+*/
+void SV_Netchan_DropPaced( client_t *client )
+{
+	size_t clientNum = client - svs.clients;
+
+	if ( clientNum < pacedMessages.size() )
+	{
+		pacedMessages[ clientNum ].pending = false;
+	}
+}
+
+/*
+=================
+SV_Netchan_ShutdownPacing
+=================
+*/
+void SV_Netchan_ShutdownPacing()
+{
+	pacedMessages.clear();
+	pacedMessages.shrink_to_fit();
+	pacedQueue.clear();
+	pacing = false;
+}
@@ -0,0 +1,413 @@
+/*
+===========================================================================
+Daemon BSD Source Code
+Copyright (c) 2024, Daemon Developers
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Daemon developers nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DAEMON DEVELOPERS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================
+*/
+
+// sv_profiler.cpp -- time spent in each phase of the server frames
+
+#include "server.h"
+#include "framework/CommandSystem.h"
+
+/*
+=============================================================================
+
+The time of every phase is summed over a server frame, per client for the
+phases done for each client, then added to histograms which keep the
+distribution with a precision of 1/8th. The per-client phases may run on
+the snapshot worker threads, but only the job of that client touches its
+sums, everything else happens on the main thread.
+
+=============================================================================
+*/
+
+static Cvar::Cvar<bool> sv_profile("sv_profile",
+	"time the phases of the server frames, see /serverProfile", Cvar::NONE, false);
+static Cvar::Cvar<std::string> sv_profileFile("sv_profileFile",
+	"if set, write the time of every phase of every profiled frame to this CSV file in the home path",
+	Cvar::NONE, "");
+
+static const char *const profilePhaseNames[] = {
+	"packets",
+	"pings",
+	"game",
+	"snapshots",
+	"snapshot build",
+	"snapshot encode",
+	"transmit",
+	"frame",
+};
+
+static_assert( ARRAY_LEN( profilePhaseNames ) == Util::ordinal( profilePhase_t::NUM_PHASES ),
+	"profilePhaseNames doesn't match profilePhase_t" );
+
+static const int NUM_PHASES = Util::ordinal( profilePhase_t::NUM_PHASES );
+
+// values below 8 get their own bucket, then each power of two is split in 8
+static const int PROFILE_SUB_BUCKETS = 8;
+static const int PROFILE_BUCKETS = ( 64 - 2 ) * PROFILE_SUB_BUCKETS;
+
+struct profileHistogram_t
+{
+	uint32_t buckets[ PROFILE_BUCKETS ];
+	int64_t  count;
+	int64_t  max;
+
+	static int Bucket( int64_t ns )
+	{
+		if ( ns < PROFILE_SUB_BUCKETS )
+		{
+			return ns;
+		}
+
+		int exponent = 3;
+
+		while ( ns >> ( exponent + 1 ) )
+		{
+			exponent++;
+		}
+
+		return ( exponent - 2 ) * PROFILE_SUB_BUCKETS + ( ( ns >> ( exponent - 3 ) ) & ( PROFILE_SUB_BUCKETS - 1 ) );
+	}
+
+	// the lowest value going into the bucket
+	static int64_t BucketValue( int bucket )
+	{
+		if ( bucket < PROFILE_SUB_BUCKETS )
+		{
+			return bucket;
+		}
+
+		int exponent = bucket / PROFILE_SUB_BUCKETS + 2;
+
+		return int64_t( PROFILE_SUB_BUCKETS + bucket % PROFILE_SUB_BUCKETS ) << ( exponent - 3 );
+	}
+
+	void Add( int64_t ns )
+	{
+		buckets[ Bucket( std::max<int64_t>( ns, 0 ) ) ]++;
+		count++;
+		max = std::max( max, ns );
+	}
+
+	int64_t Percentile( double fraction ) const
+	{
+		int64_t rank = static_cast<int64_t>( fraction * ( count - 1 ) );
+
+		for ( int i = 0; i < PROFILE_BUCKETS; i++ )
+		{
+			if ( rank < buckets[ i ] )
+			{
+				return std::min( BucketValue( i ), max );
+			}
+
+			rank -= buckets[ i ];
+		}
+
+		return max;
+	}
+};
+
+struct profileTimes_t
+{
+	int64_t            frameTimes[ NUM_PHASES ]; // summed over the current frame, in nanoseconds
+	profileHistogram_t histograms[ NUM_PHASES ];
+};
+
+static profileTimes_t              profileFrame; // phase totals of the whole frames
+static std::vector<profileTimes_t> profileClients; // [sv_maxclients->integer]
+static int64_t                     profileFrameNumber;
+static FS::File                    profileCSV;
+static std::string                 profileCSVPath;
+
+/*
+==================
+SV_ProfileStart
+
+The time to pass to SV_ProfilePhase or SV_ProfileClient
+==================
+*/
+Sys::SteadyClock::time_point SV_ProfileStart()
+{
+	return sv_profile.Get() ? Sys::SteadyClock::now() : Sys::SteadyClock::time_point();
+}
+
+/*
+==================
+SV_ProfilePhase
+
+Adds the time since start to a phase of the frame
+==================
+*/
+void SV_ProfilePhase( profilePhase_t phase, Sys::SteadyClock::time_point start )
+{
+	if ( start == Sys::SteadyClock::time_point() )
+	{
+		return;
+	}
+
+	profileFrame.frameTimes[ Util::ordinal( phase ) ] +=
+		std::chrono::duration_cast<std::chrono::nanoseconds>( Sys::SteadyClock::now() - start ).count();
+}
+
+/*
+==================
+SV_ProfileClient
+
+Adds the time since start to a phase done for a client
+==================
+*/
+void SV_ProfileClient( const client_t *client, profilePhase_t phase, Sys::SteadyClock::time_point start )
+{
+	size_t clientNum = client - svs.clients;
+
+	if ( start == Sys::SteadyClock::time_point() || clientNum >= profileClients.size() )
+	{
+		return;
+	}
+
+	profileClients[ clientNum ].frameTimes[ Util::ordinal( phase ) ] +=
+		std::chrono::duration_cast<std::chrono::nanoseconds>( Sys::SteadyClock::now() - start ).count();
+}
+
+/*
+==================
+SV_ProfileResetClient
+
+Forgets the times of the previous client of a slot
+==================
+*/
+void SV_ProfileResetClient( const client_t *client )
+{
+	size_t clientNum = client - svs.clients;
+
+	if ( clientNum < profileClients.size() )
+	{
+		profileClients[ clientNum ] = {};
+	}
+}
+
+/*
+==================
+SV_WriteProfileCSV
+==================
+*/
+static void SV_WriteProfileCSV( const std::string &rows )
+{
+	if ( profileCSVPath != sv_profileFile.Get() )
+	{
+		profileCSV = {};
+		profileCSVPath = sv_profileFile.Get();
+
+		if ( !profileCSVPath.empty() )
+		{
+			std::error_code err;
+			profileCSV = FS::HomePath::OpenWrite( profileCSVPath, err );
+
+			if ( err )
+			{
+				Log::Warn( "Couldn't open %s: %s", profileCSVPath, err.message() );
+				return;
+			}
+
+			std::string header = "frame,phase,client,nanoseconds\n";
+			profileCSV.Write( header.data(), header.size(), err );
+		}
+	}
+
+	if ( profileCSV )
+	{
+		std::error_code err;
+		profileCSV.Write( rows.data(), rows.size(), err );
+	}
+}
+
+/*
+==================
+SV_ProfileEndFrame
+
+Adds the times summed over the frame to the histograms
+==================
+*/
+void SV_ProfileEndFrame()
+{
+	if ( static_cast<int>( profileClients.size() ) != sv_maxclients->integer )
+	{
+		profileClients.resize( sv_maxclients->integer );
+	}
+
+	if ( !sv_profile.Get() )
+	{
+		return;
+	}
+
+	std::string rows;
+	bool csv = !sv_profileFile.Get().empty();
+
+	profileFrameNumber++;
+
+	for ( size_t i = 0; i < profileClients.size(); i++ )
+	{
+		profileTimes_t &client = profileClients[ i ];
+
+		for ( int phase = 0; phase < NUM_PHASES; phase++ )
+		{
+			if ( !client.frameTimes[ phase ] )
+			{
+				continue;
+			}
+
+			client.histograms[ phase ].Add( client.frameTimes[ phase ] );
+			profileFrame.frameTimes[ phase ] += client.frameTimes[ phase ];
+
+			if ( csv )
+			{
+				rows += Str::Format( "%d,%s,%d,%d\n", profileFrameNumber, profilePhaseNames[ phase ], i, client.frameTimes[ phase ] );
+			}
+
+			client.frameTimes[ phase ] = 0;
+		}
+	}
+
+	for ( int phase = 0; phase < NUM_PHASES; phase++ )
+	{
+		if ( !profileFrame.frameTimes[ phase ] )
+		{
+			continue;
+		}
+
+		profileFrame.histograms[ phase ].Add( profileFrame.frameTimes[ phase ] );
+
+		if ( csv )
+		{
+			rows += Str::Format( "%d,%s,-1,%d\n", profileFrameNumber, profilePhaseNames[ phase ], profileFrame.frameTimes[ phase ] );
+		}
+
+		profileFrame.frameTimes[ phase ] = 0;
+	}
+
+	SV_WriteProfileCSV( rows );
+}
+
+/*
+==================
+SV_ResetProfile
+==================
+*/
+static void SV_ResetProfile()
+{
+	profileFrame = {};
+
+	for ( profileTimes_t &client : profileClients )
+	{
+		client = {};
+	}
+
+	profileFrameNumber = 0;
+}
+
+/*
+==================
+SV_ShutdownProfiler
+==================
+*/
+void SV_ShutdownProfiler()
+{
+	SV_ResetProfile();
+	profileClients.clear();
+	profileClients.shrink_to_fit();
+	profileCSV = {};
+	profileCSVPath.clear();
+}
+
+class ServerProfileCmd: public Cmd::StaticCmd
+{
+public:
+	ServerProfileCmd():
+		StaticCmd("serverProfile", Cmd::SYSTEM, "Shows the time spent in each phase of the server frames, see sv_profile")
+	{}
+
+	void Run(const Cmd::Args& args) const override
+	{
+		if ( args.Argc() == 2 && args.Argv( 1 ) == "reset" )
+		{
+			SV_ResetProfile();
+			return;
+		}
+
+		if ( args.Argc() > 2 || ( args.Argc() == 2 && args.Argv( 1 ) != "clients" ) )
+		{
+			PrintUsage( args, "[clients|reset]" );
+			return;
+		}
+
+		if ( !sv_profile.Get() )
+		{
+			Print( "sv_profile is off" );
+		}
+
+		Print( "%d frames, times per frame in microseconds", profileFrameNumber );
+		PrintHistograms( profileFrame );
+
+		if ( args.Argc() != 2 )
+		{
+			return;
+		}
+
+		for ( size_t i = 0; i < profileClients.size() && static_cast<int>( i ) < sv_maxclients->integer; i++ )
+		{
+			if ( svs.clients[ i ].state == clientState_t::CS_FREE )
+			{
+				continue;
+			}
+
+			Print( "client %d %s", i, svs.clients[ i ].name );
+			PrintHistograms( profileClients[ i ] );
+		}
+	}
+
+private:
+	void PrintHistograms( const profileTimes_t &times ) const
+	{
+		Print( "%-16s %8s %10s %10s %10s", "phase", "frames", "p50", "p99", "max" );
+
+		for ( int phase = 0; phase < NUM_PHASES; phase++ )
+		{
+			const profileHistogram_t &histogram = times.histograms[ phase ];
+
+			if ( !histogram.count )
+			{
+				continue;
+			}
+
+			Print( "%-16s %8d %10.1f %10.1f %10.1f", profilePhaseNames[ phase ], histogram.count,
+			       histogram.Percentile( 0.5 ) / 1000.0, histogram.Percentile( 0.99 ) / 1000.0, histogram.max / 1000.0 );
+		}
+	}
+};
+
+static ServerProfileCmd ServerProfileCmdRegistration;
@@ -50,6 +50,10 @@ Maryland 20850 USA.
 #pragma clang diagnostic ignored "-Wunused-lambda-capture"
 #endif
 
+static Cvar::Cvar<bool> sv_batchUsercmds("sv_batchUsercmds",
+	"send the usercmds received between two calls into the game in one message, if the game supports it",
+	Cvar::NONE, true);
+
 // these functions must be used instead of pointer arithmetic, because
 // the game allocates gentities with private information after the server shared part
 
@@ -203,10 +207,13 @@ void SV_LocateGameData( const IPC::SharedMemory& shmRegion, int numGEntities, in
 	sv.gameClientSize = sizeofGameClient;
 }
 
+static sharedUsercmds_t *sharedUsercmds;
+
 static void UnlocateGameData()
 {
 	sv.gentities = nullptr;
 	sv.gameClients = nullptr;
+	sharedUsercmds = nullptr;
 }
 
 /*
@@ -225,6 +232,49 @@ void SV_GetUsercmd( int clientNum, usercmd_t *cmd )
 	*cmd = svs.clients[ clientNum ].lastUsercmd;
 }
 
+/*
+===============
+SV_PublishUsercmd
+
+Makes the last usercmd of a client readable by the game without a GetUsercmdMsg
+===============
+*/
+void SV_PublishUsercmd( int clientNum, const usercmd_t *cmd )
+{
+	if ( !sharedUsercmds )
+	{
+		return;
+	}
+
+	sharedUsercmd_t &shared = sharedUsercmds->clients[ clientNum ];
+	uint32_t sequence = shared.sequence.load( std::memory_order_relaxed );
+
+	shared.sequence.store( sequence + 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+	shared.cmd = *cmd;
+	shared.sequence.store( sequence + 2, std::memory_order_release );
+}
+
+/*
+===============
+SV_LocateUsercmds
+===============
+*/
+static void SV_LocateUsercmds( const IPC::SharedMemory &shmRegion )
+{
+	if ( shmRegion.GetSize() < sizeof( sharedUsercmds_t ) )
+	{
+		Sys::Drop( "SV_LocateUsercmds: Shared memory region too small" );
+	}
+
+	sharedUsercmds = static_cast<sharedUsercmds_t *>( shmRegion.GetBase() );
+
+	for ( int i = 0; i < sv_maxclients->integer; i++ )
+	{
+		SV_PublishUsercmd( i, &svs.clients[ i ].lastUsercmd );
+	}
+}
+
 /*
 ====================
 SV_GetTimeString
@@ -328,11 +378,15 @@ void SV_InitGameProgs()
 	SV_InitGameVM();
 }
 
-GameVM::GameVM(): VM::VMBase("sgame", Cvar::NONE), services(nullptr) {
+GameVM::GameVM(): VM::VMBase("sgame", Cvar::NONE), clientThinkBatch(false), services(nullptr) {
 }
 
 void GameVM::Start()
 {
+	clientThinkBatch = false;
+	pendingThinkClients.clear();
+	pendingThinkCmds.clear();
+
 	services = std::unique_ptr<VM::CommonVMServices>(new VM::CommonVMServices(*this, "SGame", FS::Owner::SGAME, Cmd::SGAME_VM));
 
 	this->Create();
@@ -346,15 +400,23 @@ void GameVM::GameStaticInit()
 
 void GameVM::GameInit(int levelTime, int randomSeed)
 {
+	FlushClientThinks();
 	this->SendMsg<GameInitMsg>(levelTime, randomSeed, Com_AreCheatsAllowed(), Com_IsClient());
 	NetcodeTable psTable;
 	size_t psSize;
 	this->SendMsg<VM::GetNetcodeTablesMsg>(psTable, psSize);
+	// the load test may be decoding playerstates with the current table
+	SV_StopLoadTest();
 	MSG_InitNetcodeTables(std::move(psTable), psSize);
 }
 
 void GameVM::GameShutdown(bool restart)
 {
+	// the clients are gone with the game, don't run their last usercmds
+	clientThinkBatch = false;
+	pendingThinkClients.clear();
+	pendingThinkCmds.clear();
+
 	try {
 		this->SendMsg<GameShutdownMsg>(restart);
 	} catch (Sys::DropErr& err) {
@@ -367,13 +429,19 @@ void GameVM::GameShutdown(bool restart)
 	}
 	services = nullptr;
 
-	// Release the shared memory region
+	// Release the shared memory regions
 	this->shmRegion.Close();
+	this->usercmdRegion.Close();
 	UnlocateGameData();
 }
 
 bool GameVM::GameClientConnect(char* reason, size_t size, int clientNum, bool firstTime, bool isBot)
 {
+	FlushClientThinks();
+
+	// the slot may hold the usercmd of its previous client
+	SV_PublishUsercmd(clientNum, &svs.clients[clientNum].lastUsercmd);
+
 	bool denied;
 	std::string sentReason;
 	this->SendMsg<GameClientConnectMsg>(clientNum, firstTime, isBot, denied, sentReason);
@@ -386,34 +454,66 @@ bool GameVM::GameClientConnect(char* reason, size_t size, int clientNum, bool fi
 
 void GameVM::GameClientBegin(int clientNum)
 {
+	FlushClientThinks();
 	this->SendMsg<GameClientBeginMsg>(clientNum);
 }
 
 void GameVM::GameClientUserInfoChanged(int clientNum)
 {
+	FlushClientThinks();
 	this->SendMsg<GameClientUserinfoChangedMsg>(clientNum);
 }
 
 void GameVM::GameClientDisconnect(int clientNum)
 {
+	FlushClientThinks();
 	this->SendMsg<GameClientDisconnectMsg>(clientNum);
 }
 
 void GameVM::GameClientCommand(int clientNum, const char* command)
 {
+	FlushClientThinks();
 	this->SendMsg<GameClientCommandMsg>(clientNum, command);
 }
 
 void GameVM::GameClientThink(int clientNum)
 {
+	FlushClientThinks();
 	this->SendMsg<GameClientThinkMsg>(clientNum);
 }
 
 void GameVM::GameRunFrame(int levelTime)
 {
+	FlushClientThinks();
 	this->SendMsg<GameRunFrameMsg>(levelTime);
 }
 
+void GameVM::QueueClientThink(int clientNum, const usercmd_t& cmd)
+{
+	if (!clientThinkBatch || !sv_batchUsercmds.Get()) {
+		GameClientThink(clientNum);
+		return;
+	}
+
+	pendingThinkClients.push_back(clientNum);
+	pendingThinkCmds.push_back(cmd);
+}
+
+void GameVM::FlushClientThinks()
+{
+	if (pendingThinkClients.empty()) {
+		return;
+	}
+
+	// the game may call back into the engine and queue or flush again
+	std::vector<int> clientNums = std::move(pendingThinkClients);
+	std::vector<usercmd_t> cmds = std::move(pendingThinkCmds);
+	pendingThinkClients.clear();
+	pendingThinkCmds.clear();
+
+	this->SendMsg<GameClientThinkBatchMsg>(clientNums, cmds);
+}
+
 void GameVM::BotAIStartFrame(int)
 {
 	Sys::Drop("GameVM::BotAIStartFrame not implemented");
@@ -450,6 +550,13 @@ void GameVM::QVMSyscall(int syscallNum, Util::Reader& reader, IPC::Channel& chan
 		});
 		break;
 
+	case G_LOCATE_USERCMDS:
+		IPC::HandleMsg<LocateUsercmdsMsg>(channel, std::move(reader), [this](IPC::SharedMemory shm) {
+			usercmdRegion = std::move(shm);
+			SV_LocateUsercmds(usercmdRegion);
+		});
+		break;
+
 	case G_ADJUST_AREA_PORTAL_STATE:
 		IPC::HandleMsg<AdjustAreaPortalStateMsg>(channel, std::move(reader), [this](int entityNum, bool open) {
 			sharedEntity_t* ent = SV_GentityNum(entityNum);
@@ -585,6 +692,12 @@ void GameVM::QVMSyscall(int syscallNum, Util::Reader& reader, IPC::Channel& chan
 		});
 		break;
 
+	case G_ENABLE_CLIENT_THINK_BATCH:
+		IPC::HandleMsg<EnableClientThinkBatchMsg>(channel, std::move(reader), [this] {
+			clientThinkBatch = true;
+		});
+		break;
+
 	case BOT_DEBUG_DRAW:
 		IPC::HandleMsg<BotDebugDrawMsg>(channel, std::move(reader), [this](std::vector<char> commands) {
 #ifdef BUILD_SERVER
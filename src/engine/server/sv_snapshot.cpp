@@ -35,6 +35,12 @@ Maryland 20850 USA.
 #include "server.h"
 #include "qcommon/sys.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 /*
 =============================================================================
 
@@ -58,6 +64,265 @@ A server packet will look something like:
 */
 
 static Cvar::Cvar<bool> sv_novis("sv_novis", "skip PVS check when transmitting entities", 0, false);
+static Cvar::Range<Cvar::Cvar<int>> sv_snapshotThreads("sv_snapshotThreads",
+	"number of worker threads helping to build and encode client snapshots, 0 to do everything on the main thread",
+	Cvar::NONE, 0, 0, 64);
+static Cvar::Cvar<bool> sv_deltaEntityCache("sv_deltaEntityCache",
+	"reuse the entity deltas encoded for other clients in the same frame", Cvar::NONE, true);
+static Cvar::Cvar<bool> sv_showDeltaEntityStats("sv_showDeltaEntityStats",
+	"periodically print the time spent encoding entity deltas", Cvar::NONE, false);
+static Cvar::Cvar<bool> sv_snapshotBudget("sv_snapshotBudget",
+	"hold back the least important entity updates when a snapshot wouldn't fit in the client's rate",
+	Cvar::NONE, true);
+
+// incremented every time the entity states may have changed since the last snapshot
+static int snapshotGeneration;
+
+/*
+=============================================================================
+
+Cache of the encoded entity deltas, so that clients which acked the same
+frame don't all encode the same changes. The bits written by the MSG
+functions don't depend on where they go in the message, so they are
+appended as is to the messages of the following clients.
+
+Within a generation all the copies of an entity state are usually the
+same, but a client dropped in the middle of SV_SendClientMessages can
+change the entities, so the states are compared too.
+
+=============================================================================
+*/
+
+static const int DELTA_CACHE_LOCKS = 64;
+static const int MAX_ENTITY_DELTA_BYTES = 1024;
+
+struct entityDelta_t
+{
+	int               fromGeneration; // -1 for the baseline
+	bool              force;
+	entityState_t     from, to;
+	int               bits;
+	int               uncompressedBits;
+	std::vector<byte> data;
+};
+
+struct entityDeltaList_t
+{
+	int                        generation; // the deltas past used are left over from older generations
+	int                        used;
+	std::vector<entityDelta_t> deltas;
+};
+
+static std::mutex                     entityDeltaLocks[ DELTA_CACHE_LOCKS ];
+static std::vector<entityDeltaList_t> entityDeltas; // [MAX_GENTITIES] while the cache is enabled
+static bool                           entityDeltaCacheActive; // only while SV_SendClientMessages is running
+static std::atomic<int>               entityDeltaHits, entityDeltaMisses;
+static std::atomic<int64_t>           entityEncodeTime; // in nanoseconds
+static bool                           entityEncodeTimed; // if sv_showDeltaEntityStats needs entityEncodeTime this frame
+static int                            entityDeltaStatFrames;
+
+/*
+=============
+SV_WriteDeltaEntity
+
+MSG_WriteDeltaEntity through the cache, when it is enabled for this frame
+=============
+*/
+static void SV_WriteDeltaEntity( msg_t *msg, entityState_t *from, int fromGeneration, entityState_t *to, bool force )
+{
+	msg_t encoded;
+	byte  encodedBuffer[ MAX_ENTITY_DELTA_BYTES ];
+
+	if ( !entityDeltaCacheActive || to->number < 0 || to->number >= MAX_GENTITIES )
+	{
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock( entityDeltaLocks[ to->number % DELTA_CACHE_LOCKS ] );
+	entityDeltaList_t &list = entityDeltas[ to->number ];
+
+	if ( list.generation != snapshotGeneration )
+	{
+		list.generation = snapshotGeneration;
+		list.used = 0;
+	}
+
+	for ( int i = 0; i < list.used; i++ )
+	{
+		const entityDelta_t &delta = list.deltas[ i ];
+
+		if ( delta.fromGeneration == fromGeneration && delta.force == force &&
+		     !memcmp( &delta.from, from, sizeof( delta.from ) ) && !memcmp( &delta.to, to, sizeof( delta.to ) ) )
+		{
+			entityDeltaHits++;
+			MSG_WriteEncodedBits( msg, delta.data.data(), delta.bits, delta.uncompressedBits );
+			return;
+		}
+	}
+
+	entityDeltaMisses++;
+
+	MSG_Init( &encoded, encodedBuffer, sizeof( encodedBuffer ) );
+	MSG_WriteDeltaEntity( &encoded, from, to, force );
+
+	if ( encoded.overflowed )
+	{
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	if ( list.used == static_cast<int>( list.deltas.size() ) )
+	{
+		list.deltas.emplace_back();
+	}
+
+	entityDelta_t &delta = list.deltas[ list.used++ ];
+
+	delta.fromGeneration = fromGeneration;
+	delta.force = force;
+	delta.from = *from;
+	delta.to = *to;
+	delta.bits = encoded.bit;
+	delta.uncompressedBits = encoded.uncompsize;
+	delta.data.assign( encodedBuffer, encodedBuffer + ( encoded.bit + 7 ) / 8 );
+
+	MSG_WriteEncodedBits( msg, delta.data.data(), delta.bits, delta.uncompressedBits );
+}
+
+/*
+=============================================================================
+
+Pool of the entity states sent in snapshots
+
+Each generation copies the state of every entity sent to any client once,
+and the client frames only keep where their entities are in it. A frame of
+the pool is reused once no client frame references it anymore, which is
+at the latest after PACKET_BACKUP snapshots of each client referencing it.
+
+=============================================================================
+*/
+
+struct snapshotStateFrame_t
+{
+	int                        generation;
+	int                        refs; // client frames using it
+	std::vector<int>           slots; // [sv.num_entities] index in states, -1 if not copied
+	std::vector<entityState_t> states;
+	std::vector<int>           entities; // lists of indexes in states of the client frames
+};
+
+static std::vector<snapshotStateFrame_t> snapshotStates;
+static int                               currentStateFrame = -1; // for snapshotGeneration
+
+/*
+=============
+SV_SnapshotStateFrame
+
+Returns the entity states of a client frame, or nullptr if they were dropped
+=============
+*/
+static snapshotStateFrame_t *SV_SnapshotStateFrame( const clientSnapshot_t *frame )
+{
+	if ( frame->stateFrame < 0 || frame->stateFrame >= static_cast<int>( snapshotStates.size() ) )
+	{
+		return nullptr;
+	}
+
+	snapshotStateFrame_t &states = snapshotStates[ frame->stateFrame ];
+
+	return states.generation == frame->entityGeneration ? &states : nullptr;
+}
+
+/*
+=============
+SV_CountSnapshotStateRefs
+
+Recounts the references from scratch, as the frames of the clients which
+got dropped or reset were never released. The frames left in free slots
+are never read again, so they don't hold their states
+=============
+*/
+static void SV_CountSnapshotStateRefs()
+{
+	for ( snapshotStateFrame_t &states : snapshotStates )
+	{
+		states.refs = 0;
+	}
+
+	for ( int i = 0; i < sv_maxclients->integer; i++ )
+	{
+		// zombies are still sent snapshots delta compressed from their frames
+		if ( svs.clients[ i ].state == clientState_t::CS_FREE )
+		{
+			continue;
+		}
+
+		for ( const clientSnapshot_t &frame : svs.clients[ i ].frames )
+		{
+			if ( snapshotStateFrame_t *states = SV_SnapshotStateFrame( &frame ) )
+			{
+				states->refs++;
+			}
+		}
+	}
+}
+
+/*
+=============
+SV_CurrentSnapshotStateFrame
+
+The frame of the pool for the current generation
+=============
+*/
+static snapshotStateFrame_t &SV_CurrentSnapshotStateFrame()
+{
+	if ( currentStateFrame >= 0 && snapshotStates[ currentStateFrame ].generation == snapshotGeneration )
+	{
+		return snapshotStates[ currentStateFrame ];
+	}
+
+	auto isFree = []( const snapshotStateFrame_t &states ) {
+		return states.refs == 0;
+	};
+	auto it = std::find_if( snapshotStates.begin(), snapshotStates.end(), isFree );
+
+	if ( it == snapshotStates.end() )
+	{
+		SV_CountSnapshotStateRefs();
+		it = std::find_if( snapshotStates.begin(), snapshotStates.end(), isFree );
+	}
+
+	if ( it == snapshotStates.end() )
+	{
+		snapshotStates.emplace_back();
+		it = snapshotStates.end() - 1;
+	}
+
+	// the vectors keep their capacity from the last time the frame was used
+	it->generation = snapshotGeneration;
+	it->refs = 0;
+	it->slots.assign( sv.num_entities, -1 );
+	it->states.clear();
+	it->entities.clear();
+
+	currentStateFrame = it - snapshotStates.begin();
+	return *it;
+}
+
+/*
+=============
+SV_InvalidateSnapshotStates
+
+The entities can change in the middle of SV_SendClientMessages, when a
+client is dropped, so the following snapshots mustn't reuse the states
+copied before
+=============
+*/
+void SV_InvalidateSnapshotStates()
+{
+	snapshotGeneration++;
+}
 
 /*
 =============
@@ -68,23 +333,45 @@ Writes a delta update of an entityState_t list to the message.
 */
 static void SV_EmitPacketEntities( const clientSnapshot_t *from, clientSnapshot_t *to, msg_t *msg )
 {
-	entityState_t *oldent, *newent;
-	int           oldindex, newindex;
-	int           oldnum, newnum;
-	int           from_num_entities;
+	entityState_t        *oldent, *newent;
+	int                  oldindex, newindex;
+	int                  oldnum, newnum;
+	int                  from_num_entities;
+	snapshotStateFrame_t *fromStates, *toStates;
+	Sys::SteadyClock::time_point start;
+
+	if ( entityEncodeTimed )
+	{
+		start = Sys::SteadyClock::now();
+	}
 
     MSG_WriteShort(msg, to->num_entities);
 
+	toStates = SV_SnapshotStateFrame( to );
+
+	if ( !toStates )
+	{
+		Sys::Drop( "SV_EmitPacketEntities: entity states of the new frame dropped" );
+	}
+
 	// generate the delta update
 	if ( !from )
 	{
 		static const clientSnapshot_t nullfrom{};
 
 		from = &nullfrom;
+		fromStates = nullptr;
 		from_num_entities = 0;
 	}
 	else
 	{
+		fromStates = SV_SnapshotStateFrame( from );
+
+		if ( !fromStates )
+		{
+			Sys::Drop( "SV_EmitPacketEntities: entity states of the delta frame dropped" );
+		}
+
 		from_num_entities = from->num_entities;
 	}
 
@@ -101,7 +388,7 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, clientSnapshot_
 		}
 		else
 		{
-			newent = &svs.snapshotEntities[( to->first_entity + newindex ) % svs.numSnapshotEntities ];
+			newent = &toStates->states[ toStates->entities[ to->first_entity + newindex ] ];
 			newnum = newent->number;
 		}
 
@@ -111,7 +398,7 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, clientSnapshot_
 		}
 		else
 		{
-			oldent = &svs.snapshotEntities[( from->first_entity + oldindex ) % svs.numSnapshotEntities ];
+			oldent = &fromStates->states[ fromStates->entities[ from->first_entity + oldindex ] ];
 			oldnum = oldent->number;
 		}
 
@@ -120,7 +407,7 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, clientSnapshot_
 			// delta update from old position
 			// because the force parm is false, this will not result
 			// in any bytes being emitted if the entity has not changed at all
-			MSG_WriteDeltaEntity( msg, oldent, newent, false );
+			SV_WriteDeltaEntity( msg, oldent, from->entityGeneration, newent, false );
 			oldindex++;
 			newindex++;
 			continue;
@@ -129,7 +416,7 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, clientSnapshot_
 		if ( newnum < oldnum )
 		{
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity( msg, &sv.svEntities[ newnum ].baseline, newent, true );
+			SV_WriteDeltaEntity( msg, &sv.svEntities[ newnum ].baseline, -1, newent, true );
 			newindex++;
 			continue;
 		}
@@ -144,50 +431,77 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, clientSnapshot_
 	}
 
 	MSG_WriteBits( msg, ( MAX_GENTITIES - 1 ), GENTITYNUM_BITS );  // end of packetentities
+
+	if ( entityEncodeTimed )
+	{
+		entityEncodeTime += std::chrono::duration_cast<std::chrono::nanoseconds>( Sys::SteadyClock::now() - start ).count();
+	}
 }
 
 /*
 ==================
-SV_WriteSnapshotToClient
+SV_GetDeltaFrame
+
+Picks the previous frame the snapshot being created will be delta
+compressed from, or nullptr if a full snapshot has to be sent.
+The frame to write the snapshot against must be picked after the
+entities of the new snapshot have been stored.
 ==================
 */
-static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg )
+static clientSnapshot_t *SV_GetDeltaFrame( client_t *client, int *lastframe )
 {
-	clientSnapshot_t *frame, *oldframe;
-	int              lastframe;
-	int              i;
-	int              snapFlags;
-
-	// this is the snapshot we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+	clientSnapshot_t *oldframe;
 
 	// try to use a previous frame as the source for delta compressing the snapshot
 	if ( client->deltaMessage <= 0 || client->state != clientState_t::CS_ACTIVE )
 	{
 		// client is asking for a retransmit
-		oldframe = nullptr;
-		lastframe = 0;
+		*lastframe = 0;
+		return nullptr;
 	}
-	else if ( client->netchan.outgoingSequence - client->deltaMessage >= ( PACKET_BACKUP - 3 ) )
+
+	if ( client->netchan.outgoingSequence - client->deltaMessage >= ( PACKET_BACKUP - 3 ) )
 	{
 		// client hasn't gotten a good message through in a long time
 		Log::Debug( "%s^*: Delta request from out of date packet.", client->name );
-		oldframe = nullptr;
-		lastframe = 0;
+		*lastframe = 0;
+		return nullptr;
 	}
-	else
+
+	// we have a valid snapshot to delta from
+	oldframe = &client->frames[ client->deltaMessage & PACKET_MASK ];
+
+	// the snapshot's entities may have been dropped from the pool, though
+	if ( !SV_SnapshotStateFrame( oldframe ) )
 	{
-		// we have a valid snapshot to delta from
-		oldframe = &client->frames[ client->deltaMessage & PACKET_MASK ];
-		lastframe = client->netchan.outgoingSequence - client->deltaMessage;
+		Log::Debug( "%s^*: Delta request from out of date entities.", client->name );
+		*lastframe = 0;
+		return nullptr;
+	}
 
-		// the snapshot's entities may still have rolled off the buffer, though
-		if ( oldframe->first_entity <= svs.nextSnapshotEntities - svs.numSnapshotEntities )
-		{
-			Log::Debug( "%s^*: Delta request from out of date entities.", client->name );
-			oldframe = nullptr;
-			lastframe = 0;
-		}
+	*lastframe = client->netchan.outgoingSequence - client->deltaMessage;
+	return oldframe;
+}
+
+/*
+==================
+SV_WriteSnapshotToClient
+==================
+*/
+static void SV_WriteSnapshotToClient( client_t *client, clientSnapshot_t *oldframe, int lastframe, msg_t *msg )
+{
+	clientSnapshot_t *frame;
+	int              i;
+	int              snapFlags;
+
+	// this is the snapshot we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
+	// the entities of the frame to delta from may have been dropped since it was picked
+	if ( oldframe && !SV_SnapshotStateFrame( oldframe ) )
+	{
+		oldframe = nullptr;
+		lastframe = 0;
 	}
 
 	MSG_WriteByte( msg, svc_snapshot );
@@ -262,7 +576,7 @@ void SV_UpdateServerCommandsToClient( client_t *client, msg_t *msg )
 	{
 		MSG_WriteByte( msg, svc_serverCommand );
 		MSG_WriteLong( msg, i );
-		MSG_WriteString( msg, client->reliableCommands[ i & ( MAX_RELIABLE_COMMANDS - 1 ) ] );
+		MSG_WriteString( msg, SV_ReliableCommand( client, i ) );
 	}
 
 	client->reliableSent = client->reliableSequence;
@@ -279,265 +593,534 @@ Build a client snapshot structure
 //#define   MAX_SNAPSHOT_ENTITIES   1024
 static const int MAX_SNAPSHOT_ENTITIES = 2048;
 
-struct snapshotEntityNumbers_t
-{
-	int numSnapshotEntities;
-	int snapshotEntities[ MAX_SNAPSHOT_ENTITIES ];
-};
-
 /*
-=======================
-SV_QsortEntityNumbers
-=======================
+=============================================================================
+
+A set of entity numbers, which is walked in increasing entity number order
+
+=============================================================================
 */
-static int SV_QsortEntityNumbers( const void *a, const void *b )
-{
-	int *ea, *eb;
 
-	ea = ( int * ) a;
-	eb = ( int * ) b;
+struct entityBits_t
+{
+	uint64_t words[ MAX_GENTITIES / 64 ];
 
-	if ( *ea == *eb )
+	void Clear()
 	{
-		Sys::Drop( "SV_QsortEntityNumbers: duplicated entity" );
+		memset( words, 0, sizeof( words ) );
 	}
 
-	if ( *ea < *eb )
+	void Set( int entityNum )
 	{
-		return -1;
+		words[ entityNum >> 6 ] |= uint64_t( 1 ) << ( entityNum & 63 );
 	}
 
-	return 1;
-}
-
-/*
-===============
-SV_AddEntToSnapshot
-===============
-*/
-static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt,
-                                 snapshotEntityNumbers_t *eNums )
-{
-	// if we have already added this entity to this snapshot, don't add again
-	if ( svEnt->snapshotCounter == sv.snapshotCounter )
+	bool Test( int entityNum ) const
 	{
-		return;
+		return words[ entityNum >> 6 ] & ( uint64_t( 1 ) << ( entityNum & 63 ) );
 	}
 
-	svEnt->snapshotCounter = sv.snapshotCounter;
-
-	// if we are full, silently discard entities
-	if ( eNums->numSnapshotEntities == MAX_SNAPSHOT_ENTITIES )
+	// calls func on every entity number of the set below numEntities
+	template<typename Func>
+	void ForEach( int numEntities, Func func ) const
 	{
-		return;
+		for ( int i = 0; i * 64 < numEntities; i++ )
+		{
+			uint64_t word = words[ i ];
+
+			while ( word )
+			{
+				int entityNum = i * 64 + CountTrailingZeroes( word );
+
+				if ( entityNum >= numEntities )
+				{
+					return;
+				}
+
+				func( entityNum );
+				word &= word - 1;
+			}
+		}
 	}
+};
 
-	eNums->snapshotEntities[ eNums->numSnapshotEntities ] = gEnt->s.number;
-	eNums->numSnapshotEntities++;
-}
+struct snapshotEntityNumbers_t
+{
+	int numSnapshotEntities;
+	int snapshotEntities[ MAX_SNAPSHOT_ENTITIES ];
+	entityBits_t added; // used to prevent double adding from portal views
+
+	// entities whose update was held back keep their state of the delta frame
+	int keptStateFrame; // -1 if every entity gets its current state
+	int keptGeneration;
+	int keptStates[ MAX_SNAPSHOT_ENTITIES ]; // index in the states of keptStateFrame, -1 for the current state
+};
 
 /*
 ===============
-SV_AddEntitiesVisibleFromPoint
+SV_AddEntToSnapshot
 ===============
 */
-static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame,
-//                                  snapshotEntityNumbers_t *eNums, bool portal, clientSnapshot_t *oldframe, bool localClient ) {
-//                                  snapshotEntityNumbers_t *eNums, bool portal ) {
-    snapshotEntityNumbers_t *eNums /*, bool portal, bool localClient */ )
+static void SV_AddEntToSnapshot( int entityNum, snapshotEntityNumbers_t *eNums )
 {
-	int            e, i;
-	sharedEntity_t *ent, *playerEnt;
-	svEntity_t     *svEnt;
-	int            l;
-	int            clientarea, clientcluster;
-	int            leafnum;
-//	int             c_fullsend;
-	byte           *clientpvs;
-	byte           *bitvector;
+	// the list itself is made from the set once all viewpoints are done,
+	// so it is already sorted for the delta compression
+	eNums->added.Set( entityNum );
+}
 
-	// during an error shutdown message we may need to transmit
-	// the shutdown message after the server has shutdown, so
-	// specifically check for it
-	if (sv.state == serverState_t::SS_DEAD)
-	{
-		return;
-	}
+/*
+=============================================================================
 
-	leafnum = CM_PointLeafnum( origin );
-	clientarea = CM_LeafArea( leafnum );
-	clientcluster = CM_LeafCluster( leafnum );
+Spatial index of the linked entities, rebuilt once per frame before any
+snapshot is built so that the visibility checks only have to look at the
+entities that can possibly be seen from a given point.
 
-	// calculate the visible areas
-	frame->areabytes = CM_WriteAreaBits( frame->areabits, clientarea );
+Entities are bucketed by the PVS clusters they touch, and the ones with
+SVF_CLIENTS_IN_RANGE are also put in a hashed uniform grid covering their
+range. Entities whose visibility can't be decided from their clusters
+(broadcast, overflowing or invalid cluster lists) are checked every time.
 
-	clientpvs = CM_ClusterPVS( clientcluster );
+The masters of the SVF_VISDUMMY_MULTIPLE entities, which point at their
+dummy with s.otherEntityNum, are kept sorted by dummy so that a visible
+dummy only has to look at its own masters.
 
-//	c_fullsend = 0;
+=============================================================================
+*/
 
-	playerEnt = SV_GentityNum( frame->ps.clientNum );
+static const int SNAPSHOT_GRID_CELL_SIZE = 512;
+static const int SNAPSHOT_GRID_BUCKETS = 1024; // must be a power of two
+static const int SNAPSHOT_GRID_MAX_CELLS = 64; // entities covering more cells are checked every time
 
-	if ( playerEnt->r.svFlags & SVF_SELF_PORTAL )
-	{
-		SV_AddEntitiesVisibleFromPoint( playerEnt->s.origin2, frame, eNums );
-	}
+struct snapshotEntityIndex_t
+{
+	bool                          valid; // only true while SV_SendClientMessages is running
+	std::vector<std::vector<int>> clusters;
+	std::vector<int>              always;
+	std::vector<int>              gridBuckets[ SNAPSHOT_GRID_BUCKETS ];
+	std::vector<int>              rangeAlways; // SVF_CLIENTS_IN_RANGE entities too large for the grid
+	std::vector<std::pair<int, int>> visDummyMasters; // ( dummy, master ), sorted
+};
 
-	for ( e = 0; e < sv.num_entities; e++ )
-	{
-		ent = SV_GentityNum( e );
+static snapshotEntityIndex_t snapshotEntityIndex;
 
-		// never send entities that aren't linked in
-		if ( !ent->r.linked )
-		{
-			continue;
-		}
+static int SV_SnapshotGridCell( float coord )
+{
+	return static_cast<int>( floorf( coord / SNAPSHOT_GRID_CELL_SIZE ) );
+}
 
-		if ( ent->s.number != e )
-		{
-			Log::Debug( "FIXING ENT->S.NUMBER!!!" );
-			ent->s.number = e;
-		}
+static int SV_SnapshotGridBucket( int x, int y, int z )
+{
+	unsigned hash = ( unsigned ) x * 73856093u ^ ( unsigned ) y * 19349663u ^ ( unsigned ) z * 83492791u;
 
-		// entities can be flagged to explicitly not be sent to the client
-		if ( ent->r.svFlags & SVF_NOCLIENT )
-		{
-			continue;
-		}
+	return hash & ( SNAPSHOT_GRID_BUCKETS - 1 );
+}
 
-		// entities can be flagged to be sent to only one client
-		if ( ent->r.svFlags & SVF_SINGLECLIENT )
+/*
+=============================================================================
+
+Per-frame cache of what can be seen from a cluster and area. The area
+portals don't change while the snapshots are built, so everything that
+doesn't depend on the client is computed once for all the clients and
+portal views sharing the same cluster and area.
+
+=============================================================================
+*/
+
+struct visibility_t
+{
+	int          cluster, area;
+	int          areabytes;
+	byte         areabits[ MAX_MAP_AREA_BYTES ]; // not inverted yet
+	entityBits_t entities; // linked entities that pass the PVS, broadcast and novis checks
+	entityBits_t direct; // those of them added as they are, without the dummy and portal handling
+	std::mutex   mutex;
+	bool         computed;
+};
+
+static std::mutex                                visibilityCacheMutex;
+static std::vector<std::unique_ptr<visibility_t>> visibilityCache;
+static int                                       visibilityCacheUsed;
+
+/*
+===============
+SV_EntityInPVS
+
+The client independent part of the visibility checks. direct is set for
+the entities to add without looking at their dummy and portal flags.
+===============
+*/
+static bool SV_EntityInPVS( const sharedEntity_t *ent, const byte *clientpvs, int clientarea, bool *direct )
+{
+	int i, l;
+
+	*direct = false;
+
+	// never send entities that aren't linked in
+	if ( !ent->r.linked )
+	{
+		return false;
+	}
+
+	// entities can be flagged to explicitly not be sent to the client
+	if ( ent->r.svFlags & SVF_NOCLIENT )
+	{
+		return false;
+	}
+
+	if ( sv_novis.Get() )
+	{
+		*direct = true;
+		return true;
+	}
+
+	// broadcast entities are always sent
+	if ( ent->r.svFlags & SVF_BROADCAST )
+	{
+		*direct = true;
+		return true;
+	}
+
+	// Gordon: just check origin for being in pvs, ignore bmodel extents
+	if ( ent->r.svFlags & SVF_IGNOREBMODELEXTENTS )
+	{
+		*direct = true;
+		return clientpvs[ ent->r.originCluster >> 3 ] & ( 1 << ( ent->r.originCluster & 7 ) );
+	}
+
+	// ignore if not touching a PV leaf
+	// check area
+	if ( !CM_AreasConnected( clientarea, ent->r.areanum ) )
+	{
+		// doors can legally straddle two areas, so
+		// we may need to check another one
+		if ( !CM_AreasConnected( clientarea, ent->r.areanum2 ) )
 		{
-			if ( ent->r.singleClient != frame->ps.clientNum )
-			{
-				continue;
-			}
+			return false;
 		}
+	}
 
-		// entities can be flagged to be sent to everyone but one client
-		if ( ent->r.svFlags & SVF_NOTSINGLECLIENT )
+	// check individual leafs
+	if ( !ent->r.numClusters )
+	{
+		return false;
+	}
+
+	l = 0;
+
+	for ( i = 0; i < std::min(std::max(0, ent->r.numClusters), MAX_ENT_CLUSTERS); i++ )
+	{
+		l = ent->r.clusternums[ i ];
+
+		if ( clientpvs[ l >> 3 ] & ( 1 << ( l & 7 ) ) )
 		{
-			if ( ent->r.singleClient == frame->ps.clientNum )
-			{
-				continue;
-			}
+			break;
 		}
+	}
 
-		// entities can be flagged to be sent to only a given mask of clients
-		if ( ent->r.svFlags & SVF_CLIENTMASK )
+	// if we haven't found it to be visible,
+	// check the overflow clusters that couldn't be stored
+	if ( i == ent->r.numClusters )
+	{
+		if ( ent->r.lastCluster )
 		{
-			if ( frame->ps.clientNum >= 32 )
+			for ( ; l <= ent->r.lastCluster; l++ )
 			{
-				if ( ~ent->r.hiMask & ( 1 << ( frame->ps.clientNum - 32 ) ) )
+				if ( clientpvs[ l >> 3 ] & ( 1 << ( l & 7 ) ) )
 				{
-					continue;
+					break;
 				}
 			}
-			else
+
+			if ( l == ent->r.lastCluster )
 			{
-				if ( ~ent->r.loMask & ( 1 << frame->ps.clientNum ) )
-				{
-					continue;
-				}
+				return false;
 			}
 		}
+		else
+		{
+			return false;
+		}
+	}
 
-		svEnt = SV_SvEntityForGentity( ent );
+	return true;
+}
 
-		// don't double add an entity through portals
-		if ( svEnt->snapshotCounter == sv.snapshotCounter )
+/*
+===============
+SV_ComputeVisibility
+===============
+*/
+static void SV_ComputeVisibility( visibility_t *vis )
+{
+	const snapshotEntityIndex_t &index = snapshotEntityIndex;
+	const byte                  *clientpvs;
+
+	// calculate the visible areas
+	memset( vis->areabits, 0, sizeof( vis->areabits ) );
+	vis->areabytes = CM_WriteAreaBits( vis->areabits, vis->area );
+
+	clientpvs = CM_ClusterPVS( vis->cluster );
+
+	vis->entities.Clear();
+	vis->direct.Clear();
+
+	auto check = [ & ]( int e ) {
+		bool direct;
+
+		if ( SV_EntityInPVS( SV_GentityNum( e ), clientpvs, vis->area, &direct ) )
 		{
-			continue;
+			vis->entities.Set( e );
+
+			if ( direct )
+			{
+				vis->direct.Set( e );
+			}
 		}
+	};
 
-		if ( sv_novis.Get() )
+	// without vis every entity has to be checked anyway
+	if ( !index.valid || sv_novis.Get() )
+	{
+		for ( int e = 0; e < sv.num_entities; e++ )
 		{
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
-			continue;
+			check( e );
 		}
 
-		// broadcast entities are always sent
-		if ( ent->r.svFlags & SVF_BROADCAST )
+		return;
+	}
+
+	// entities may be in several clusters, checking them twice is harmless
+	for ( int e : index.always )
+	{
+		check( e );
+	}
+
+	for ( size_t cluster = 0; cluster < index.clusters.size(); cluster++ )
+	{
+		if ( !( clientpvs[ cluster >> 3 ] & ( 1 << ( cluster & 7 ) ) ) )
 		{
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
 			continue;
 		}
 
-		// send entity if the client is in range
-		if ( (ent->r.svFlags & SVF_CLIENTS_IN_RANGE) &&
-		     Distance( ent->s.origin, playerEnt->s.origin ) <= ent->r.clientRadius )
+		for ( int e : index.clusters[ cluster ] )
 		{
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
-			continue;
+			check( e );
 		}
+	}
+}
+
+/*
+===============
+SV_GetVisibility
+
+Returns what can be seen from a cluster and area, from the cache when
+SV_SendClientMessages is running or else computed into scratch
+===============
+*/
+static const visibility_t *SV_GetVisibility( int cluster, int area, visibility_t *scratch )
+{
+	visibility_t *vis = nullptr;
+
+	if ( !snapshotEntityIndex.valid )
+	{
+		scratch->cluster = cluster;
+		scratch->area = area;
+		SV_ComputeVisibility( scratch );
+		return scratch;
+	}
 
-		bitvector = clientpvs;
+	{
+		std::lock_guard<std::mutex> lock( visibilityCacheMutex );
 
-		// Gordon: just check origin for being in pvs, ignore bmodel extents
-		if ( ent->r.svFlags & SVF_IGNOREBMODELEXTENTS )
+		for ( int i = 0; i < visibilityCacheUsed; i++ )
 		{
-			if ( bitvector[ ent->r.originCluster >> 3 ] & ( 1 << ( ent->r.originCluster & 7 ) ) )
+			if ( visibilityCache[ i ]->cluster == cluster && visibilityCache[ i ]->area == area )
 			{
-				SV_AddEntToSnapshot( svEnt, ent, eNums );
+				vis = visibilityCache[ i ].get();
+				break;
 			}
+		}
 
-			continue;
+		if ( !vis )
+		{
+			if ( visibilityCacheUsed == static_cast<int>( visibilityCache.size() ) )
+			{
+				visibilityCache.emplace_back( new visibility_t );
+			}
+
+			vis = visibilityCache[ visibilityCacheUsed++ ].get();
+			vis->cluster = cluster;
+			vis->area = area;
+			vis->computed = false;
 		}
+	}
+
+	// other threads asking for the same cluster and area wait for the first one
+	std::lock_guard<std::mutex> lock( vis->mutex );
+
+	if ( !vis->computed )
+	{
+		SV_ComputeVisibility( vis );
+		vis->computed = true;
+	}
+
+	return vis;
+}
+
+/*
+===============
+SV_AddEntitiesVisibleFromPoint
+===============
+*/
+static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame,
+//                                  snapshotEntityNumbers_t *eNums, bool portal, clientSnapshot_t *oldframe, bool localClient ) {
+//                                  snapshotEntityNumbers_t *eNums, bool portal ) {
+    snapshotEntityNumbers_t *eNums /*, bool portal, bool localClient */ )
+{
+	const snapshotEntityIndex_t &index = snapshotEntityIndex;
+	sharedEntity_t *playerEnt;
+	int            clientarea, clientcluster;
+	int            leafnum;
+	visibility_t   scratch;
+	entityBits_t   candidates;
+
+	// during an error shutdown message we may need to transmit
+	// the shutdown message after the server has shutdown, so
+	// specifically check for it
+	if (sv.state == serverState_t::SS_DEAD)
+	{
+		return;
+	}
+
+	leafnum = CM_PointLeafnum( origin );
+	clientarea = CM_LeafArea( leafnum );
+	clientcluster = CM_LeafCluster( leafnum );
 
-		// ignore if not touching a PV leaf
-		// check area
-		if ( !CM_AreasConnected( clientarea, ent->r.areanum ) )
+	const visibility_t *vis = SV_GetVisibility( clientcluster, clientarea, &scratch );
+
+	// the areabits of all the viewpoints are OR'd together
+	frame->areabytes = vis->areabytes;
+
+	for ( int i = 0; i < MAX_MAP_AREA_BYTES; i++ )
+	{
+		frame->areabits[ i ] |= vis->areabits[ i ];
+	}
+
+	playerEnt = SV_GentityNum( frame->ps.clientNum );
+
+	if ( playerEnt->r.svFlags & SVF_SELF_PORTAL )
+	{
+		SV_AddEntitiesVisibleFromPoint( playerEnt->s.origin2, frame, eNums );
+	}
+
+	// add the entities which may be in range of this client
+	candidates = vis->entities;
+
+	if ( !index.valid )
+	{
+		for ( int e = 0; e < sv.num_entities; e++ )
 		{
-			// doors can legally straddle two areas, so
-			// we may need to check another one
-			if ( !CM_AreasConnected( clientarea, ent->r.areanum2 ) )
+			if ( SV_GentityNum( e )->r.svFlags & SVF_CLIENTS_IN_RANGE )
 			{
-				continue;
+				candidates.Set( e );
 			}
 		}
+	}
+	else
+	{
+		int bucket = SV_SnapshotGridBucket( SV_SnapshotGridCell( playerEnt->s.origin[ 0 ] ),
+		                                    SV_SnapshotGridCell( playerEnt->s.origin[ 1 ] ),
+		                                    SV_SnapshotGridCell( playerEnt->s.origin[ 2 ] ) );
+
+		for ( int e : index.gridBuckets[ bucket ] )
+		{
+			candidates.Set( e );
+		}
 
-		// check individual leafs
-		if ( !ent->r.numClusters )
+		for ( int e : index.rangeAlways )
 		{
-			continue;
+			candidates.Set( e );
 		}
+	}
 
-		l = 0;
+	candidates.ForEach( sv.num_entities, [ & ]( int e ) {
+		sharedEntity_t *ent = SV_GentityNum( e );
+
+		// never send entities that aren't linked in
+		if ( !ent->r.linked )
+		{
+			return;
+		}
 
-		for ( i = 0; i < std::min(std::max(0, ent->r.numClusters), MAX_ENT_CLUSTERS); i++ )
+		// entities can be flagged to explicitly not be sent to the client
+		if ( ent->r.svFlags & SVF_NOCLIENT )
 		{
-			l = ent->r.clusternums[ i ];
+			return;
+		}
 
-			if ( bitvector[ l >> 3 ] & ( 1 << ( l & 7 ) ) )
+		// entities can be flagged to be sent to only one client
+		if ( ent->r.svFlags & SVF_SINGLECLIENT )
+		{
+			if ( ent->r.singleClient != frame->ps.clientNum )
 			{
-				break;
+				return;
 			}
 		}
 
-		// if we haven't found it to be visible,
-		// check the overflow clusters that couldn't be stored
-		if ( i == ent->r.numClusters )
+		// entities can be flagged to be sent to everyone but one client
+		if ( ent->r.svFlags & SVF_NOTSINGLECLIENT )
 		{
-			if ( ent->r.lastCluster )
+			if ( ent->r.singleClient == frame->ps.clientNum )
 			{
-				for ( ; l <= ent->r.lastCluster; l++ )
-				{
-					if ( bitvector[ l >> 3 ] & ( 1 << ( l & 7 ) ) )
-					{
-						break;
-					}
-				}
+				return;
+			}
+		}
 
-				if ( l == ent->r.lastCluster )
+		// entities can be flagged to be sent to only a given mask of clients
+		if ( ent->r.svFlags & SVF_CLIENTMASK )
+		{
+			if ( frame->ps.clientNum >= 32 )
+			{
+				if ( ~ent->r.hiMask & ( 1 << ( frame->ps.clientNum - 32 ) ) )
 				{
-					continue;
+					return;
 				}
 			}
 			else
 			{
-				continue;
+				if ( ~ent->r.loMask & ( 1 << frame->ps.clientNum ) )
+				{
+					return;
+				}
 			}
 		}
 
+		// don't double add an entity through portals
+		if ( eNums->added.Test( e ) )
+		{
+			return;
+		}
+
+		// novis, broadcast and SVF_IGNOREBMODELEXTENTS entities are sent as they are
+		if ( vis->direct.Test( e ) )
+		{
+			SV_AddEntToSnapshot( e, eNums );
+			return;
+		}
+
+		// send entity if the client is in range
+		if ( (ent->r.svFlags & SVF_CLIENTS_IN_RANGE) &&
+		     Distance( ent->s.origin, playerEnt->s.origin ) <= ent->r.clientRadius )
+		{
+			SV_AddEntToSnapshot( e, eNums );
+			return;
+		}
+
+		if ( !vis->entities.Test( e ) )
+		{
+			return;
+		}
+
 		//----(SA) added "visibility dummies"
 		if ( ent->r.svFlags & SVF_VISDUMMY )
 		{
@@ -548,27 +1131,38 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 
 			if ( ment )
 			{
-				svEntity_t *master = nullptr;
-
-				master = SV_SvEntityForGentity( ment );
-
-				if ( master->snapshotCounter == sv.snapshotCounter || !ment->r.linked )
+				if ( eNums->added.Test( ent->s.otherEntityNum ) || !ment->r.linked )
 				{
-					continue;
+					return;
 				}
 
-				SV_AddEntToSnapshot( master, ment, eNums );
+				SV_AddEntToSnapshot( ent->s.otherEntityNum, eNums );
 			}
 
-			continue; // master needs to be added, but not this dummy ent
+			return; // master needs to be added, but not this dummy ent
 		}
 		//----(SA) end
 		else if ( ent->r.svFlags & SVF_VISDUMMY_MULTIPLE )
 		{
+			if ( index.valid )
+			{
+				auto masters = std::equal_range( index.visDummyMasters.begin(), index.visDummyMasters.end(),
+				                                 std::make_pair( e, 0 ),
+				                                 []( const std::pair<int, int> &a, const std::pair<int, int> &b ) {
+				                                     return a.first < b.first;
+				                                 } );
+
+				for ( auto it = masters.first; it != masters.second; ++it )
+				{
+					SV_AddEntToSnapshot( it->second, eNums );
+				}
+
+				return;
+			}
+
 			{
 				int            h;
 				sharedEntity_t *ment = nullptr;
-				svEntity_t     *master = nullptr;
 
 				for ( h = 0; h < sv.num_entities; h++ )
 				{
@@ -579,48 +1173,33 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 						continue;
 					}
 
-					if ( ment )
-					{
-						master = SV_SvEntityForGentity( ment );
-					}
-					else
-					{
-						continue;
-					}
-
 					if ( !( ment->r.linked ) )
 					{
 						continue;
 					}
 
-					if ( ment->s.number != h )
-					{
-						Log::Debug( "FIXING vis dummy multiple ment->S.NUMBER!!!" );
-						ment->s.number = h;
-					}
-
 					if ( ment->r.svFlags & SVF_NOCLIENT )
 					{
 						continue;
 					}
 
-					if ( master->snapshotCounter == sv.snapshotCounter )
+					if ( eNums->added.Test( h ) )
 					{
 						continue;
 					}
 
 					if ( ment->s.otherEntityNum == ent->s.number )
 					{
-						SV_AddEntToSnapshot( master, ment, eNums );
+						SV_AddEntToSnapshot( h, eNums );
 					}
 				}
 
-				continue;
+				return;
 			}
 		}
 
 		// add it
-		SV_AddEntToSnapshot( svEnt, ent, eNums );
+		SV_AddEntToSnapshot( e, eNums );
 
 		// if it's a portal entity, add everything visible from its camera position
 		if ( ent->r.svFlags & SVF_PORTAL )
@@ -632,21 +1211,259 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 
 				if ( VectorLengthSquared( dir ) > ( float ) ent->s.generic1 * ent->s.generic1 )
 				{
-					continue;
+					return;
 				}
 			}
 
 //          SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums, true, oldframe, localClient );
 			SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums /*, true, localClient */ );
 		}
-
-		continue;
-	}
+	} );
 }
 
 /*
-=============
-SV_BuildClientSnapshot
+=============================================================================
+
+Entity prioritization, for the snapshots which wouldn't fit in the rate of
+the client. The size of the entity deltas is estimated from their bits
+before compression, scaled by the compression of the client's last
+snapshot. Once over the budget, the entities far away, behind the viewer
+or updated recently are held back: those the client already has keep the
+state of the delta frame, so that the stored frame always matches what was
+sent, and new ones are left out. Nothing is held back for longer than
+ENTITY_MAX_DEFER_MSEC.
+
+=============================================================================
+*/
+
+static const int HEADER_RATE_BYTES = 48; // include our header, IP header, and some overhead
+static const int PLAYERSTATE_RATE_BYTES = 64; // usual size of a playerstate delta
+static const int ENTITY_MAX_DEFER_MSEC = 1000;
+
+struct entityPriorities_t
+{
+	float            compression = 1.0f; // sent bytes per uncompressed byte in the last snapshot
+	bool             deferred = false; // some entities were held back in the last snapshot
+	int              fullTime = 0; // svs.time of the last snapshot sending everything
+	std::vector<int> sentTimes; // [MAX_GENTITIES] svs.time the entity was last sent up to date
+};
+
+struct entityCandidate_t
+{
+	float priority;
+	int   index; // in snapshotEntities
+	int   bits;
+	int   oldState; // index in the states of the delta frame, -1 if the client doesn't have it
+};
+
+// only the job of a client touches its entry, it is resized on the main thread
+static std::vector<entityPriorities_t> entityPriorities; // [sv_maxclients->integer]
+
+/*
+=============
+SV_SnapshotBudget
+
+The bytes a snapshot can use without exceeding the client's rate
+=============
+*/
+static int SV_SnapshotBudget( const client_t *client )
+{
+	int rate = client->rate;
+
+	if ( sv_maxRate->integer && sv_maxRate->integer < rate )
+	{
+		rate = std::max( sv_maxRate->integer, 1000 );
+	}
+
+	int budget = rate * client->snapshotMsec / 1000 - HEADER_RATE_BYTES - PLAYERSTATE_RATE_BYTES;
+
+	// the reliable commands are sent first
+	for ( int i = client->reliableAcknowledge + 1; i <= client->reliableSequence; i++ )
+	{
+		budget -= 5 + strlen( SV_ReliableCommand( client, i ) ) + 1;
+	}
+
+	return std::max( budget, 0 );
+}
+
+/*
+=============
+SV_PrioritizeSnapshotEntities
+
+Holds back the least important entities when the snapshot would be over
+the budget. Only reads shared state, so it runs with the gathering.
+=============
+*/
+static void SV_PrioritizeSnapshotEntities( client_t *client, snapshotEntityNumbers_t *entityNumbers,
+                                           const vec3_t org, const vec3_t viewangles )
+{
+	static thread_local std::vector<entityCandidate_t> candidates;
+	size_t clientNum = client - svs.clients;
+
+	entityNumbers->keptStateFrame = -1;
+
+	// local clients and bots have no rate, downloads get what's left
+	if ( !sv_snapshotBudget.Get() || clientNum >= entityPriorities.size() ||
+	     client->state != clientState_t::CS_ACTIVE || *client->downloadName || SV_IsBot( client ) ||
+	     client->netchan.remoteAddress.type == netadrtype_t::NA_LOOPBACK ||
+	     ( sv_lanForceRate->integer && Sys_IsLANAddress( client->netchan.remoteAddress ) ) )
+	{
+		return;
+	}
+
+	entityPriorities_t &priorities = entityPriorities[ clientNum ];
+	int budget = SV_SnapshotBudget( client );
+	const clientSnapshot_t &lastSent = client->frames[ ( client->netchan.outgoingSequence - 1 ) & PACKET_MASK ];
+
+	// not worth estimating anything while far from the budget
+	if ( !priorities.deferred && lastSent.messageSize < budget / 2 )
+	{
+		priorities.fullTime = svs.time;
+		return;
+	}
+
+	if ( priorities.sentTimes.empty() )
+	{
+		priorities.sentTimes.assign( MAX_GENTITIES, 0 );
+	}
+
+	int                        lastframe;
+	const clientSnapshot_t     *oldframe = SV_GetDeltaFrame( client, &lastframe );
+	const snapshotStateFrame_t *oldStates = oldframe ? SV_SnapshotStateFrame( oldframe ) : nullptr;
+	int                        numOld = oldStates ? oldframe->num_entities : 0;
+	int                        oldIndex = 0;
+	int                        fixedBits = 0, totalBits = 0;
+	vec3_t                     forward;
+
+	AngleVectors( viewangles, forward, nullptr, nullptr );
+	candidates.clear();
+
+	for ( int i = 0; i < entityNumbers->numSnapshotEntities; i++ )
+	{
+		int                  e = entityNumbers->snapshotEntities[ i ];
+		const sharedEntity_t *ent = SV_GentityNum( e );
+		int                  oldState = -1;
+
+		// both lists are sorted, the old entities passed by are removed
+		while ( oldIndex < numOld )
+		{
+			int state = oldStates->entities[ oldframe->first_entity + oldIndex ];
+			int number = oldStates->states[ state ].number;
+
+			if ( number > e )
+			{
+				break;
+			}
+
+			oldIndex++;
+
+			if ( number == e )
+			{
+				oldState = state;
+				break;
+			}
+
+			fixedBits += GENTITYNUM_BITS + 1;
+		}
+
+		int bits = oldState >= 0 ? MSG_DeltaEntityBits( &oldStates->states[ oldState ], &ent->s, false )
+		                         : MSG_DeltaEntityBits( &sv.svEntities[ e ].baseline, &ent->s, true );
+
+		if ( !bits )
+		{
+			priorities.sentTimes[ e ] = svs.time;
+			continue;
+		}
+
+		vec3_t dir;
+		VectorAdd( ent->r.absmin, ent->r.absmax, dir );
+		VectorMA( dir, -2.0f, org, dir );
+		float distance = VectorNormalize( dir ) * 0.5f;
+		int   age = svs.time - std::max( priorities.sentTimes[ e ], priorities.fullTime );
+		float priority;
+
+		if ( age >= ENTITY_MAX_DEFER_MSEC )
+		{
+			priority = FLT_MAX;
+		}
+		else
+		{
+			// 2.5 times more important straight ahead than behind
+			priority = ( 1.5f + DotProduct( forward, dir ) ) * ( age + client->snapshotMsec ) / std::max( distance, 64.0f );
+		}
+
+		candidates.push_back( { priority, i, bits, oldState } );
+		totalBits += bits;
+	}
+
+	fixedBits += ( numOld - oldIndex ) * ( GENTITYNUM_BITS + 1 );
+
+	float bytesPerBit = priorities.compression / 8;
+	float spent = fixedBits * bytesPerBit;
+
+	if ( spent + totalBits * bytesPerBit <= budget )
+	{
+		for ( const entityCandidate_t &candidate : candidates )
+		{
+			priorities.sentTimes[ entityNumbers->snapshotEntities[ candidate.index ] ] = svs.time;
+		}
+
+		priorities.deferred = false;
+		priorities.fullTime = svs.time;
+		return;
+	}
+
+	std::sort( candidates.begin(), candidates.end(), []( const entityCandidate_t &a, const entityCandidate_t &b ) {
+		return a.priority > b.priority;
+	} );
+
+	std::fill_n( entityNumbers->keptStates, entityNumbers->numSnapshotEntities, -1 );
+
+	for ( const entityCandidate_t &candidate : candidates )
+	{
+		float cost = candidate.bits * bytesPerBit;
+
+		if ( candidate.priority == FLT_MAX || spent + cost <= budget )
+		{
+			priorities.sentTimes[ entityNumbers->snapshotEntities[ candidate.index ] ] = svs.time;
+			spent += cost;
+		}
+		else if ( candidate.oldState >= 0 )
+		{
+			entityNumbers->keptStates[ candidate.index ] = candidate.oldState;
+		}
+		else
+		{
+			entityNumbers->snapshotEntities[ candidate.index ] = -1;
+		}
+	}
+
+	// drop the new entities held back
+	int numEntities = 0;
+
+	for ( int i = 0; i < entityNumbers->numSnapshotEntities; i++ )
+	{
+		if ( entityNumbers->snapshotEntities[ i ] >= 0 )
+		{
+			entityNumbers->snapshotEntities[ numEntities ] = entityNumbers->snapshotEntities[ i ];
+			entityNumbers->keptStates[ numEntities ] = entityNumbers->keptStates[ i ];
+			numEntities++;
+		}
+	}
+
+	entityNumbers->numSnapshotEntities = numEntities;
+	priorities.deferred = true;
+
+	if ( oldframe )
+	{
+		entityNumbers->keptStateFrame = oldframe->stateFrame;
+		entityNumbers->keptGeneration = oldframe->entityGeneration;
+	}
+}
+
+/*
+=============
+SV_GatherSnapshotEntities
 
 Decides which entities are going to be visible to the client, and
 copies off the playerstate and areabits.
@@ -654,29 +1471,27 @@ copies off the playerstate and areabits.
 This properly handles multiple recursive portals, but the render
 currently doesn't.
 
+Only the client's own frame is written to, so this can run for
+several clients at the same time.
+
 For viewing through other player's eyes, clent can be something other than client->gentity
 =============
 */
-static void SV_BuildClientSnapshot( client_t *client )
+static void SV_GatherSnapshotEntities( client_t *client, snapshotEntityNumbers_t *entityNumbers )
 {
 	vec3_t                  org;
 	clientSnapshot_t        *frame;
-	snapshotEntityNumbers_t entityNumbers;
 	int                     i;
-	sharedEntity_t          *ent;
-	entityState_t           *state;
-	svEntity_t              *svEnt;
 	sharedEntity_t          *clent;
 	int                     clientNum;
 
-	// bump the counter used to prevent double adding
-	sv.snapshotCounter++;
-
 	// this is the frame we are creating
 	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	// clear everything in this snapshot
-	entityNumbers.numSnapshotEntities = 0;
+	entityNumbers->numSnapshotEntities = 0;
+	entityNumbers->keptStateFrame = -1;
+	entityNumbers->added.Clear();
 	memset( frame->areabits, 0, sizeof( frame->areabits ) );
 
 	// show_bug.cgi?id=62
@@ -702,9 +1517,7 @@ static void SV_BuildClientSnapshot( client_t *client )
 		Sys::Drop( "SV_SvEntityForGentity: bad gEnt" );
 	}
 
-	svEnt = &sv.svEntities[ clientNum ];
-
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	entityNumbers->added.Set( clientNum );
 
 	if ( clent->r.svFlags & SVF_SELF_PORTAL_EXCLUSIVE )
 	{
@@ -720,14 +1533,17 @@ static void SV_BuildClientSnapshot( client_t *client )
 
 	// add all the entities directly visible to the eye, which
 	// may include portal entities that merge other viewpoints
-	SV_AddEntitiesVisibleFromPoint( org, frame, &entityNumbers /*, false, client->netchan.remoteAddress.type == NA_LOOPBACK */ );
+	SV_AddEntitiesVisibleFromPoint( org, frame, entityNumbers /*, false, client->netchan.remoteAddress.type == NA_LOOPBACK */ );
 
-	// if there were portals visible, there may be out of order entities
-	// in the list which will need to be resorted for the delta compression
-	// to work correctly.  This also catches the error condition
-	// of an entity being included twice.
-	qsort( entityNumbers.snapshotEntities, entityNumbers.numSnapshotEntities,
-	       sizeof( entityNumbers.snapshotEntities[ 0 ] ), SV_QsortEntityNumbers );
+	// the set gives the entities in increasing order, as needed by the
+	// delta compression, even if they were found through portals
+	entityNumbers->added.ForEach( sv.num_entities, [ & ]( int e ) {
+		// if we are full, silently discard entities
+		if ( e != clientNum && entityNumbers->numSnapshotEntities < MAX_SNAPSHOT_ENTITIES )
+		{
+			entityNumbers->snapshotEntities[ entityNumbers->numSnapshotEntities++ ] = e;
+		}
+	} );
 
 	// now that all viewpoint's areabits have been OR'd together, invert
 	// all of them to make it a mask vector, which is what the renderer wants
@@ -736,255 +1552,841 @@ static void SV_BuildClientSnapshot( client_t *client )
 		( ( int * ) frame->areabits ) [ i ] = ( ( int * ) frame->areabits ) [ i ] ^ -1;
 	}
 
-	// copy the entity states out
-	frame->num_entities = 0;
-	frame->first_entity = svs.nextSnapshotEntities;
+	SV_PrioritizeSnapshotEntities( client, entityNumbers, org, ps->viewangles );
+}
+
+/*
+=============
+SV_StoreSnapshotEntities
+
+Stores the client's new frame in the pool, copying the states of the
+entities no other client got in this generation. This is the only part
+of building a snapshot that touches shared state, so it always runs on
+the main thread.
+=============
+*/
+static void SV_StoreSnapshotEntities( client_t *client, const snapshotEntityNumbers_t *entityNumbers )
+{
+	clientSnapshot_t *frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
+	// the frame being replaced was last used PACKET_BACKUP snapshots ago
+	if ( snapshotStateFrame_t *old = SV_SnapshotStateFrame( frame ) )
+	{
+		old->refs = std::max( old->refs - 1, 0 );
+	}
+
+	snapshotStateFrame_t &states = SV_CurrentSnapshotStateFrame();
+	const snapshotStateFrame_t *kept = nullptr;
+
+	// the delta frame may have been dropped since the entities were prioritized
+	if ( entityNumbers->keptStateFrame >= 0 && entityNumbers->keptStateFrame < static_cast<int>( snapshotStates.size() ) &&
+	     snapshotStates[ entityNumbers->keptStateFrame ].generation == entityNumbers->keptGeneration )
+	{
+		kept = &snapshotStates[ entityNumbers->keptStateFrame ];
+	}
+
+	states.refs++;
+	frame->stateFrame = currentStateFrame;
+	frame->entityGeneration = states.generation;
+	frame->first_entity = states.entities.size();
+	frame->num_entities = entityNumbers->numSnapshotEntities;
+
+	for ( int i = 0; i < frame->num_entities; i++ )
+	{
+		int e = entityNumbers->snapshotEntities[ i ];
+
+		if ( kept && entityNumbers->keptStates[ i ] >= 0 )
+		{
+			// held back, the copy may come from the current frame itself
+			entityState_t state = kept->states[ entityNumbers->keptStates[ i ] ];
+
+			states.entities.push_back( states.states.size() );
+			states.states.push_back( state );
+			continue;
+		}
+
+		// sv.num_entities only grows within a generation
+		if ( e >= static_cast<int>( states.slots.size() ) )
+		{
+			states.slots.resize( e + 1, -1 );
+		}
+
+		if ( states.slots[ e ] < 0 )
+		{
+			states.slots[ e ] = states.states.size();
+			states.states.push_back( SV_GentityNum( e )->s );
+		}
+
+		states.entities.push_back( states.slots[ e ] );
+	}
+}
+
+/*
+=======================
+SV_CheckEntityNumbers
+
+Snapshots may be built concurrently, so fix up
+the entity numbers once before building any
+=======================
+*/
+static void SV_CheckEntityNumbers()
+{
+	for ( int e = 0; e < sv.num_entities; e++ )
+	{
+		sharedEntity_t *ent = SV_GentityNum( e );
+
+		if ( ent->r.linked && ent->s.number != e )
+		{
+			Log::Debug( "FIXING ENT->S.NUMBER!!!" );
+			ent->s.number = e;
+		}
+	}
+}
+
+/*
+=============
+SV_BuildClientSnapshot
+=============
+*/
+static void SV_BuildClientSnapshot( client_t *client )
+{
+	snapshotEntityNumbers_t entityNumbers;
+
+	// outside of SV_SendClientMessages the entities may have changed since any other snapshot
+	if ( !snapshotEntityIndex.valid )
+	{
+		SV_CheckEntityNumbers();
+		snapshotGeneration++;
+	}
+
+	SV_GatherSnapshotEntities( client, &entityNumbers );
+	SV_StoreSnapshotEntities( client, &entityNumbers );
+}
+
+/*
+=============
+SV_BotGetSnapshotEntity
+
+Returns the number of an entity in the last snapshot built for a bot,
+or -1 past its last entity
+=============
+*/
+int SV_BotGetSnapshotEntity( int client, int sequence )
+{
+	const client_t             *cl = &svs.clients[ client ];
+	const clientSnapshot_t     *frame = &cl->frames[ cl->netchan.outgoingSequence & PACKET_MASK ];
+	const snapshotStateFrame_t *states = SV_SnapshotStateFrame( frame );
+
+	if ( !states || sequence < 0 || sequence >= frame->num_entities )
+	{
+		return -1;
+	}
+
+	return states->states[ states->entities[ frame->first_entity + sequence ] ].number;
+}
+
+/*
+====================
+SV_RateMsec
+
+Return the number of msec a given size message is supposed
+to take to clear, based on the current rate
+TTimo - use sv_maxRate or sv_dl_maxRate depending on regular or downloading client
+====================
+*/
+int SV_RateMsec( client_t *client, int messageSize )
+{
+	int rate;
+	int rateMsec;
+	int maxRate;
+
+	// individual messages will never be larger than fragment size
+	if ( messageSize > 1500 )
+	{
+		messageSize = 1500;
+	}
+
+	// low watermark for sv_maxRate, never 0 < sv_maxRate < 1000 (0 is no limitation)
+	if ( sv_maxRate->integer && sv_maxRate->integer < 1000 )
+	{
+		Cvar_Set( "sv_MaxRate", "1000" );
+	}
+
+	rate = client->rate;
+
+	// work on the appropriate max rate (client or download)
+	if ( !*client->downloadName )
+	{
+		maxRate = sv_maxRate->integer;
+	}
+	else
+	{
+		maxRate = sv_dl_maxRate->integer;
+	}
+
+	if ( maxRate )
+	{
+		if ( maxRate < rate )
+		{
+			rate = maxRate;
+		}
+	}
+
+	rateMsec = ( messageSize + HEADER_RATE_BYTES ) * 1000 / rate;
+
+	return rateMsec;
+}
+
+/*
+=======================
+SV_SendMessageToClient
+
+Called by SV_SendClientSnapshot and SV_SendClientGameState
+=======================
+*/
+void SV_SendMessageToClient( msg_t *msg, client_t *client )
+{
+	int rateMsec;
+
+	// the sequence of a message still paced would be reused
+	SV_Netchan_FlushPaced( client );
+
+	// record information about the message
+	client->frames[ client->netchan.outgoingSequence & PACKET_MASK ].messageSize = msg->cursize;
+	client->frames[ client->netchan.outgoingSequence & PACKET_MASK ].messageSent = SV_PingTime();
+	client->frames[ client->netchan.outgoingSequence & PACKET_MASK ].messageAcked = -1;
+
+	// send the datagram, or queue it until its turn when pacing
+	SV_Netchan_PacedTransmit( client, msg );
+
+	// set nextSnapshotTime based on rate and requested number of updates
+
+	// local clients get snapshots every frame
+	// TTimo - show_bug.cgi?id=491
+	// added sv_lanForceRate check
+	if ( client->netchan.remoteAddress.type == netadrtype_t::NA_LOOPBACK ||
+	     ( sv_lanForceRate->integer && Sys_IsLANAddress( client->netchan.remoteAddress ) ) )
+	{
+		client->nextSnapshotTime = svs.time - 1;
+		return;
+	}
+
+	rateMsec = SV_RateMsec( client, msg->cursize );
+
+	// TTimo - during a download, ignore the snapshotMsec
+	// the update server on steroids, with this disabled and sv_fps 60, the download can reach 30 kb/s
+	// on a regular server, we will still top at 20 kb/s because of sv_fps 20
+	if ( !*client->downloadName && rateMsec < client->snapshotMsec )
+	{
+		// never send more packets than this, no matter what the rate is at
+		rateMsec = client->snapshotMsec;
+		client->rateDelayed = false;
+	}
+	else
+	{
+		client->rateDelayed = true;
+	}
+
+	client->nextSnapshotTime = svs.time + rateMsec;
+
+	// don't pile up empty snapshots while connecting
+	if ( client->state != clientState_t::CS_ACTIVE )
+	{
+		// a gigantic connection message may have already put the nextSnapshotTime
+		// more than a second away, so don't shorten it
+		// do shorten if client is downloading
+		if ( !*client->downloadName && client->nextSnapshotTime < svs.time + 1000 )
+		{
+			client->nextSnapshotTime = svs.time + 1000;
+		}
+	}
+}
+
+//bani
+
+/*
+=======================
+SV_SendClientIdle
+
+There is no need to send full snapshots to clients who are loading a map.
+So we send them "idle" packets with the bare minimum required to keep them on the server.
+
+=======================
+*/
+void SV_SendClientIdle( client_t *client )
+{
+	byte  msg_buf[ MAX_MSGLEN ];
+	msg_t msg;
+
+	MSG_Init( &msg, msg_buf, sizeof( msg_buf ) );
+
+	// NOTE, MRE: all server->client messages now acknowledge
+	// let the client know which reliable clientCommands we have received
+	MSG_WriteLong( &msg, client->lastClientCommand );
+
+	// (re)send any reliable server commands
+	SV_UpdateServerCommandsToClient( client, &msg );
+
+	// send over all the relevant entityState_t
+	// and the playerState_t
+//  SV_WriteSnapshotToClient( client, &msg );
+
+	// Add any download data if the client is downloading
+	SV_WriteDownloadToClient( client, &msg );
+
+	// check for overflow
+	if ( msg.overflowed )
+	{
+		Log::Warn( "msg overflowed for %s", client->name );
+		MSG_Clear( &msg );
+
+		SV_DropClient( client, "Msg overflowed" );
+		return;
+	}
+
+	SV_SendMessageToClient( &msg, client );
+
+	sv.bpsTotalBytes += msg.cursize; // NERVE - SMF - net debugging
+	sv.ubpsTotalBytes += msg.uncompsize / 8; // NERVE - SMF - net debugging
+}
+
+/*
+=======================
+SV_WriteClientSnapshot
+
+Writes everything that goes into a snapshot message but the download data.
+The entities of the frame must already be stored.
+=======================
+*/
+static void SV_WriteClientSnapshot( client_t *client, clientSnapshot_t *oldframe, int lastframe, msg_t *msg )
+{
+	// NOTE, MRE: all server->client messages now acknowledge
+	// let the client know which reliable clientCommands we have received
+	MSG_WriteLong( msg, client->lastClientCommand );
+
+	// (re)send any reliable server commands
+	SV_UpdateServerCommandsToClient( client, msg );
+
+	// send over all the relevant entityState_t
+	// and the playerState_t
+	SV_WriteSnapshotToClient( client, oldframe, lastframe, msg );
+}
+
+/*
+=======================
+SV_FinishClientSnapshot
+
+Adds the download data to a snapshot message and sends it
+=======================
+*/
+static void SV_FinishClientSnapshot( client_t *client, msg_t *msg )
+{
+	// Add any download data if the client is downloading
+	SV_WriteDownloadToClient( client, msg );
+
+	// check for overflow
+	if ( msg->overflowed )
+	{
+		Log::Warn("msg overflowed for %s", client->name );
+		MSG_Clear( msg );
+
+		SV_DropClient( client, "Msg overflowed" );
+		return;
+	}
+
+	SV_SendMessageToClient( msg, client );
+
+	size_t clientNum = client - svs.clients;
+
+	if ( clientNum < entityPriorities.size() && msg->uncompsize > 0 )
+	{
+		entityPriorities[ clientNum ].compression = std::min( msg->cursize * 8.0f / msg->uncompsize, 1.0f );
+	}
+
+	sv.bpsTotalBytes += msg->cursize; // NERVE - SMF - net debugging
+	sv.ubpsTotalBytes += msg->uncompsize / 8; // NERVE - SMF - net debugging
+}
+
+/*
+=======================
+SV_SendClientSnapshot
+
+Also called by SV_FinalCommand
+
+=======================
+*/
+void SV_SendClientSnapshot( client_t *client )
+{
+	byte             msg_buf[ MAX_MSGLEN ];
+	msg_t            msg;
+	clientSnapshot_t *oldframe;
+	int              lastframe;
+
+	//bani
+	if ( client->state < clientState_t::CS_ACTIVE )
+	{
+		// bani - #760 - zombie clients need full snaps so they can still process reliable commands
+		// (eg so they can pick up the disconnect reason)
+		if ( client->state != clientState_t::CS_ZOMBIE )
+		{
+			SV_SendClientIdle( client );
+			return;
+		}
+	}
+
+	// the message still paced is in the frame about to be built
+	SV_Netchan_FlushPaced( client );
+
+	// build the snapshot
+	auto profileStart = SV_ProfileStart();
+	SV_BuildClientSnapshot( client );
+	SV_ProfileClient( client, profilePhase_t::SNAPSHOT_BUILD, profileStart );
+
+	// bots need to have their snapshots built, but
+	// those are queried directly without needing to be sent
+	if ( SV_IsBot(client) )
+	{
+		return;
+	}
+
+	MSG_Init( &msg, msg_buf, sizeof( msg_buf ) );
+
+	profileStart = SV_ProfileStart();
+	oldframe = SV_GetDeltaFrame( client, &lastframe );
+	SV_WriteClientSnapshot( client, oldframe, lastframe, &msg );
+	SV_ProfileClient( client, profilePhase_t::SNAPSHOT_ENCODE, profileStart );
+
+	profileStart = SV_ProfileStart();
+	SV_FinishClientSnapshot( client, &msg );
+	SV_ProfileClient( client, profilePhase_t::TRANSMIT, profileStart );
+}
+
+/*
+=============================================================================
+
+Parallel snapshot building
+
+With sv_snapshotThreads > 0 the visible entities of every client are found
+and the snapshot messages are delta encoded on a pool of worker threads.
+Storing the entity states in the pool, picking the delta frames and
+everything that may drop a client or touch the network stays on the
+main thread.
+
+=============================================================================
+*/
+
+// All functions in this class are intended to be called by the engine
+// main thread only.
+class SnapshotWorkers
+{
+private:
+	std::vector<std::thread> threads_;
+	std::condition_variable wake_;
+	std::condition_variable done_;
+	std::mutex mutex_; // Guards everything below but next_
+	const std::function<void(int)> *job_ = nullptr;
+	int count_ = 0;
+	std::atomic<int> next_;
+	int busy_ = 0; // number of workers still running the current job
+	unsigned generation_ = 0;
+	bool halt_ = false;
+
+	void Work()
+	{
+		int i;
+
+		while ( ( i = next_.fetch_add( 1, std::memory_order_relaxed ) ) < count_ )
+		{
+			( *job_ )( i );
+		}
+	}
+
+	// seen is the generation before the first job of the worker, read by the
+	// thread starting it, as Run may hand out that job before it gets the lock
+	void WorkerMain( unsigned seen )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+
+		while ( true )
+		{
+			wake_.wait( lock, [ & ] { return halt_ || generation_ != seen; } );
+
+			if ( halt_ )
+			{
+				return;
+			}
+
+			seen = generation_;
+			lock.unlock();
+			Work();
+			lock.lock();
+
+			if ( --busy_ == 0 )
+			{
+				done_.notify_one();
+			}
+		}
+	}
+
+public:
+	~SnapshotWorkers()
+	{
+		Stop();
+	}
+
+	// Calls func( i ) for every i in [0, count) using the calling thread and
+	// numThreads workers, and returns when all the calls have finished.
+	// func must not throw.
+	void Run( int numThreads, int count, const std::function<void(int)> &func )
+	{
+		if ( static_cast<int>( threads_.size() ) != numThreads )
+		{
+			Stop();
+			Log::Notice( "Starting %d snapshot worker threads", numThreads );
+
+			unsigned generation;
+
+			{
+				std::lock_guard<std::mutex> lock( mutex_ );
+				generation = generation_;
+			}
+
+			for ( int i = 0; i < numThreads; i++ )
+			{
+				threads_.emplace_back( &SnapshotWorkers::WorkerMain, this, generation );
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			job_ = &func;
+			count_ = count;
+			next_ = 0;
+			busy_ = numThreads;
+			generation_++;
+		}
+
+		wake_.notify_all();
+		Work();
+
+		std::unique_lock<std::mutex> lock( mutex_ );
+		done_.wait( lock, [ this ] { return busy_ == 0; } );
+		job_ = nullptr;
+	}
+
+	void Stop()
+	{
+		if ( threads_.empty() )
+		{
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			halt_ = true;
+		}
 
-	for ( i = 0; i < entityNumbers.numSnapshotEntities; i++ )
-	{
-		ent = SV_GentityNum( entityNumbers.snapshotEntities[ i ] );
-		state = &svs.snapshotEntities[ svs.nextSnapshotEntities % svs.numSnapshotEntities ];
-		*state = ent->s;
-		svs.nextSnapshotEntities++;
+		wake_.notify_all();
 
-		// this should never hit, map should always be restarted first in SV_Frame
-		if ( svs.nextSnapshotEntities >= 0x7FFFFFFE )
+		for ( std::thread &thread : threads_ )
 		{
-			Sys::Error( "svs.nextSnapshotEntities wrapped" );
+			thread.join();
 		}
 
-		frame->num_entities++;
+		threads_.clear();
+		halt_ = false;
 	}
-}
+};
+
+static SnapshotWorkers snapshotWorkers;
+
+struct snapshotJob_t
+{
+	client_t                *client;
+	clientSnapshot_t        *oldframe;
+	int                     lastframe;
+	snapshotEntityNumbers_t entityNumbers;
+	msg_t                   msg;
+	byte                    msgBuffer[ MAX_MSGLEN ];
+	std::exception_ptr      error;
+};
+
+static std::vector<snapshotJob_t> snapshotJobs;
 
 /*
-====================
-SV_RateMsec
+=======================
+SV_RunSnapshotJobs
 
-Return the number of msec a given size message is supposed
-to take to clear, based on the current rate
-TTimo - use sv_maxRate or sv_dl_maxRate depending on regular or downloading client
-====================
+Runs func on every queued job and rethrows the first error on the main thread
+=======================
 */
-static const int HEADER_RATE_BYTES = 48; // include our header, IP header, and some overhead
-static int SV_RateMsec( client_t *client, int messageSize )
+static void SV_RunSnapshotJobs( int numJobs, void ( *func )( snapshotJob_t &job ) )
 {
-	int rate;
-	int rateMsec;
-	int maxRate;
+	snapshotWorkers.Run( sv_snapshotThreads.Get(), numJobs, [ func ]( int i ) {
+		try
+		{
+			func( snapshotJobs[ i ] );
+		}
+		catch ( ... )
+		{
+			snapshotJobs[ i ].error = std::current_exception();
+		}
+	} );
 
-	// individual messages will never be larger than fragment size
-	if ( messageSize > 1500 )
+	for ( int i = 0; i < numJobs; i++ )
 	{
-		messageSize = 1500;
-	}
+		if ( snapshotJobs[ i ].error )
+		{
+			std::exception_ptr error = snapshotJobs[ i ].error;
 
-	// low watermark for sv_maxRate, never 0 < sv_maxRate < 1000 (0 is no limitation)
-	if ( sv_maxRate->integer && sv_maxRate->integer < 1000 )
-	{
-		Cvar_Set( "sv_MaxRate", "1000" );
+			for ( int j = i; j < numJobs; j++ )
+			{
+				snapshotJobs[ j ].error = nullptr;
+			}
+
+			std::rethrow_exception( error );
+		}
 	}
+}
 
-	rate = client->rate;
+/*
+=======================
+SV_SendQueuedSnapshots
 
-	// work on the appropriate max rate (client or download)
-	if ( !*client->downloadName )
-	{
-		maxRate = sv_maxRate->integer;
-	}
-	else
+Builds and sends the snapshots of the first numJobs entries of snapshotJobs
+=======================
+*/
+static void SV_SendQueuedSnapshots( int numJobs )
+{
+	SV_RunSnapshotJobs( numJobs, []( snapshotJob_t &job ) {
+		auto profileStart = SV_ProfileStart();
+		SV_GatherSnapshotEntities( job.client, &job.entityNumbers );
+		SV_ProfileClient( job.client, profilePhase_t::SNAPSHOT_BUILD, profileStart );
+	} );
+
+	for ( int i = 0; i < numJobs; i++ )
 	{
-		maxRate = sv_dl_maxRate->integer;
+		auto profileStart = SV_ProfileStart();
+		SV_StoreSnapshotEntities( snapshotJobs[ i ].client, &snapshotJobs[ i ].entityNumbers );
+		SV_ProfileClient( snapshotJobs[ i ].client, profilePhase_t::SNAPSHOT_BUILD, profileStart );
 	}
 
-	if ( maxRate )
+	for ( int i = 0; i < numJobs; i++ )
 	{
-		if ( maxRate < rate )
-		{
-			rate = maxRate;
-		}
+		snapshotJob_t &job = snapshotJobs[ i ];
+
+		job.oldframe = SV_GetDeltaFrame( job.client, &job.lastframe );
+		MSG_Init( &job.msg, job.msgBuffer, sizeof( job.msgBuffer ) );
 	}
 
-	rateMsec = ( messageSize + HEADER_RATE_BYTES ) * 1000 / rate;
+	SV_RunSnapshotJobs( numJobs, []( snapshotJob_t &job ) {
+		auto profileStart = SV_ProfileStart();
+		SV_WriteClientSnapshot( job.client, job.oldframe, job.lastframe, &job.msg );
+		SV_ProfileClient( job.client, profilePhase_t::SNAPSHOT_ENCODE, profileStart );
+	} );
 
-	return rateMsec;
+	for ( int i = 0; i < numJobs; i++ )
+	{
+		auto profileStart = SV_ProfileStart();
+		SV_FinishClientSnapshot( snapshotJobs[ i ].client, &snapshotJobs[ i ].msg );
+		SV_ProfileClient( snapshotJobs[ i ].client, profilePhase_t::TRANSMIT, profileStart );
+	}
 }
 
 /*
 =======================
-SV_SendMessageToClient
-
-Called by SV_SendClientSnapshot and SV_SendClientGameState
+SV_ShutdownSnapshotWorkers
 =======================
 */
-void SV_SendMessageToClient( msg_t *msg, client_t *client )
+void SV_ShutdownSnapshotWorkers()
 {
-	int rateMsec;
-
-	// record information about the message
-	client->frames[ client->netchan.outgoingSequence & PACKET_MASK ].messageSize = msg->cursize;
-	client->frames[ client->netchan.outgoingSequence & PACKET_MASK ].messageSent = svs.time;
-	client->frames[ client->netchan.outgoingSequence & PACKET_MASK ].messageAcked = -1;
+	snapshotWorkers.Stop();
+	snapshotJobs.clear();
+	snapshotJobs.shrink_to_fit();
+	snapshotEntityIndex.clusters.clear();
+	snapshotEntityIndex.clusters.shrink_to_fit();
+	visibilityCache.clear();
+	visibilityCacheUsed = 0;
+	entityDeltas.clear();
+	entityDeltas.shrink_to_fit();
+	snapshotStates.clear();
+	snapshotStates.shrink_to_fit();
+	currentStateFrame = -1;
+	entityPriorities.clear();
+	entityPriorities.shrink_to_fit();
+}
 
-	// send the datagram
-	SV_Netchan_Transmit( client, msg );
+/*
+=======================
+SV_IndexEntityClusters
 
-	// set nextSnapshotTime based on rate and requested number of updates
+Returns false if the entity can't be found through its clusters
+=======================
+*/
+static bool SV_IndexEntityClusters( int e, const entityShared_t &r )
+{
+	std::vector<std::vector<int>> &clusters = snapshotEntityIndex.clusters;
+	int numClusters = clusters.size();
 
-	// local clients get snapshots every frame
-	// TTimo - show_bug.cgi?id=491
-	// added sv_lanForceRate check
-	if ( client->netchan.remoteAddress.type == netadrtype_t::NA_LOOPBACK ||
-	     ( sv_lanForceRate->integer && Sys_IsLANAddress( client->netchan.remoteAddress ) ) )
+	if ( r.svFlags & SVF_IGNOREBMODELEXTENTS )
 	{
-		client->nextSnapshotTime = svs.time - 1;
-		return;
-	}
+		if ( r.originCluster < 0 || r.originCluster >= numClusters )
+		{
+			return false;
+		}
 
-	rateMsec = SV_RateMsec( client, msg->cursize );
+		clusters[ r.originCluster ].push_back( e );
+		return true;
+	}
 
-	// TTimo - during a download, ignore the snapshotMsec
-	// the update server on steroids, with this disabled and sv_fps 60, the download can reach 30 kb/s
-	// on a regular server, we will still top at 20 kb/s because of sv_fps 20
-	if ( !*client->downloadName && rateMsec < client->snapshotMsec )
+	// never visible through the PVS
+	if ( !r.numClusters )
 	{
-		// never send more packets than this, no matter what the rate is at
-		rateMsec = client->snapshotMsec;
-		client->rateDelayed = false;
+		return true;
 	}
-	else
+
+	// the overflow clusters are handled by the full checks
+	if ( r.numClusters < 0 || r.numClusters > MAX_ENT_CLUSTERS || r.lastCluster )
 	{
-		client->rateDelayed = true;
+		return false;
 	}
 
-	client->nextSnapshotTime = svs.time + rateMsec;
-
-	// don't pile up empty snapshots while connecting
-	if ( client->state != clientState_t::CS_ACTIVE )
+	for ( int i = 0; i < r.numClusters; i++ )
 	{
-		// a gigantic connection message may have already put the nextSnapshotTime
-		// more than a second away, so don't shorten it
-		// do shorten if client is downloading
-		if ( !*client->downloadName && client->nextSnapshotTime < svs.time + 1000 )
+		if ( r.clusternums[ i ] < 0 || r.clusternums[ i ] >= numClusters )
 		{
-			client->nextSnapshotTime = svs.time + 1000;
+			return false;
 		}
 	}
-}
 
-//bani
+	for ( int i = 0; i < r.numClusters; i++ )
+	{
+		clusters[ r.clusternums[ i ] ].push_back( e );
+	}
+
+	return true;
+}
 
 /*
 =======================
-SV_SendClientIdle
-
-There is no need to send full snapshots to clients who are loading a map.
-So we send them "idle" packets with the bare minimum required to keep them on the server.
+SV_IndexEntityRange
 
+Returns false if the range covers too many grid cells
 =======================
 */
-void SV_SendClientIdle( client_t *client )
+static bool SV_IndexEntityRange( int e, const sharedEntity_t *ent )
 {
-	byte  msg_buf[ MAX_MSGLEN ];
-	msg_t msg;
-
-	MSG_Init( &msg, msg_buf, sizeof( msg_buf ) );
+	float radius = ent->r.clientRadius;
+	int   mins[ 3 ], maxs[ 3 ];
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
+	// never in range
+	if ( !( radius >= 0.0f ) )
+	{
+		return true;
+	}
 
-	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+	for ( int i = 0; i < 3; i++ )
+	{
+		if ( !( fabsf( ent->s.origin[ i ] ) + radius < SNAPSHOT_GRID_CELL_SIZE * float( 1 << 20 ) ) )
+		{
+			return false;
+		}
 
-	// send over all the relevant entityState_t
-	// and the playerState_t
-//  SV_WriteSnapshotToClient( client, &msg );
+		mins[ i ] = SV_SnapshotGridCell( ent->s.origin[ i ] - radius );
+		maxs[ i ] = SV_SnapshotGridCell( ent->s.origin[ i ] + radius );
+	}
 
-	// Add any download data if the client is downloading
-	SV_WriteDownloadToClient( client, &msg );
+	if ( ( maxs[ 0 ] - mins[ 0 ] + 1 ) * ( maxs[ 1 ] - mins[ 1 ] + 1 ) * ( maxs[ 2 ] - mins[ 2 ] + 1 ) > SNAPSHOT_GRID_MAX_CELLS )
+	{
+		return false;
+	}
 
-	// check for overflow
-	if ( msg.overflowed )
+	for ( int x = mins[ 0 ]; x <= maxs[ 0 ]; x++ )
 	{
-		Log::Warn( "msg overflowed for %s", client->name );
-		MSG_Clear( &msg );
+		for ( int y = mins[ 1 ]; y <= maxs[ 1 ]; y++ )
+		{
+			for ( int z = mins[ 2 ]; z <= maxs[ 2 ]; z++ )
+			{
+				std::vector<int> &bucket = snapshotEntityIndex.gridBuckets[ SV_SnapshotGridBucket( x, y, z ) ];
 
-		SV_DropClient( client, "Msg overflowed" );
-		return;
+				// neighbouring cells may share a bucket
+				if ( bucket.empty() || bucket.back() != e )
+				{
+					bucket.push_back( e );
+				}
+			}
+		}
 	}
 
-	SV_SendMessageToClient( &msg, client );
-
-	sv.bpsTotalBytes += msg.cursize; // NERVE - SMF - net debugging
-	sv.ubpsTotalBytes += msg.uncompsize / 8; // NERVE - SMF - net debugging
+	return true;
 }
 
 /*
 =======================
-SV_SendClientSnapshot
-
-Also called by SV_FinalCommand
+SV_BuildSnapshotEntityIndex
 
+The game links and unlinks its entities in shared memory without telling
+the engine, so the index is rebuilt from the linked entities once per frame
 =======================
 */
-void SV_SendClientSnapshot( client_t *client )
+static void SV_BuildSnapshotEntityIndex()
 {
-	byte  msg_buf[ MAX_MSGLEN ];
-	msg_t msg;
+	snapshotEntityIndex_t &index = snapshotEntityIndex;
 
-	//bani
-	if ( client->state < clientState_t::CS_ACTIVE )
+	visibilityCacheUsed = 0;
+	index.clusters.resize( CM_NumClusters() );
+
+	for ( std::vector<int> &cluster : index.clusters )
 	{
-		// bani - #760 - zombie clients need full snaps so they can still process reliable commands
-		// (eg so they can pick up the disconnect reason)
-		if ( client->state != clientState_t::CS_ZOMBIE )
-		{
-			SV_SendClientIdle( client );
-			return;
-		}
+		cluster.clear();
 	}
 
-	// build the snapshot
-	SV_BuildClientSnapshot( client );
-
-	// bots need to have their snapshots built, but
-	// those are queried directly without needing to be sent
-	if ( SV_IsBot(client) )
+	for ( std::vector<int> &bucket : index.gridBuckets )
 	{
-		return;
+		bucket.clear();
 	}
 
-	MSG_Init( &msg, msg_buf, sizeof( msg_buf ) );
+	index.always.clear();
+	index.rangeAlways.clear();
+	index.visDummyMasters.clear();
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
+	for ( int e = 0; e < sv.num_entities; e++ )
+	{
+		const sharedEntity_t *ent = SV_GentityNum( e );
 
-	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+		if ( !ent->r.linked || ( ent->r.svFlags & SVF_NOCLIENT ) )
+		{
+			continue;
+		}
 
-	// send over all the relevant entityState_t
-	// and the playerState_t
-	SV_WriteSnapshotToClient( client, &msg );
+		int other = ent->s.otherEntityNum;
 
-	// Add any download data if the client is downloading
-	SV_WriteDownloadToClient( client, &msg );
+		if ( other != e && other >= 0 && other < sv.num_entities
+		     && ( SV_GentityNum( other )->r.svFlags & SVF_VISDUMMY_MULTIPLE ) )
+		{
+			index.visDummyMasters.emplace_back( other, e );
+		}
 
-	// check for overflow
-	if ( msg.overflowed )
-	{
-		Log::Warn("msg overflowed for %s", client->name );
-		MSG_Clear( &msg );
+		if ( ent->r.svFlags & SVF_BROADCAST )
+		{
+			index.always.push_back( e );
+			continue;
+		}
 
-		SV_DropClient( client, "Msg overflowed" );
-		return;
+		if ( ( ent->r.svFlags & SVF_CLIENTS_IN_RANGE ) && !SV_IndexEntityRange( e, ent ) )
+		{
+			index.rangeAlways.push_back( e );
+		}
+
+		if ( !SV_IndexEntityClusters( e, ent->r ) )
+		{
+			index.always.push_back( e );
+		}
 	}
 
-	SV_SendMessageToClient( &msg, client );
+	std::sort( index.visDummyMasters.begin(), index.visDummyMasters.end() );
 
-	sv.bpsTotalBytes += msg.cursize; // NERVE - SMF - net debugging
-	sv.ubpsTotalBytes += msg.uncompsize / 8; // NERVE - SMF - net debugging
+	index.valid = true;
 }
 
 /*
@@ -998,6 +2400,12 @@ void SV_SendClientMessages()
 	int      i;
 	client_t *c;
 	int      numclients = 0; // NERVE - SMF - net debugging
+	int      numJobs = 0;
+	// without the entity index each snapshot fixes up the entity numbers itself
+	bool     parallel = sv_snapshotThreads.Get() > 0 && sv.state != serverState_t::SS_DEAD;
+
+	// the messages still paced from the last frame use the sequences of the frames built now
+	SV_Netchan_FlushAllPaced();
 
 	sv.bpsTotalBytes = 0; // NERVE - SMF - net debugging
 	sv.ubpsTotalBytes = 0; // NERVE - SMF - net debugging
@@ -1005,6 +2413,47 @@ void SV_SendClientMessages()
 	// Gordon: update any changed configstrings from this frame
 	SV_UpdateConfigStrings();
 
+	// entities may move before the next call, so only use the index
+	// for this frame's snapshots, even if one of them drops the server
+	struct indexInvalidator_t
+	{
+		~indexInvalidator_t()
+		{
+			snapshotEntityIndex.valid = false;
+			entityDeltaCacheActive = false;
+		}
+	} indexInvalidator;
+
+	if ( sv.state != serverState_t::SS_DEAD )
+	{
+		SV_CheckEntityNumbers();
+		SV_BuildSnapshotEntityIndex();
+	}
+
+	snapshotGeneration++;
+	entityEncodeTimed = sv_showDeltaEntityStats.Get();
+
+	if ( sv_deltaEntityCache.Get() )
+	{
+		entityDeltas.resize( MAX_GENTITIES );
+		entityDeltaCacheActive = sv.state != serverState_t::SS_DEAD;
+	}
+	else
+	{
+		entityDeltas.clear();
+		entityDeltas.shrink_to_fit();
+	}
+
+	if ( parallel && static_cast<int>( snapshotJobs.size() ) < sv_maxclients->integer )
+	{
+		snapshotJobs.resize( sv_maxclients->integer );
+	}
+
+	if ( static_cast<int>( entityPriorities.size() ) != sv_maxclients->integer )
+	{
+		entityPriorities.resize( sv_maxclients->integer );
+	}
+
 	// send a message to each connected client
 	for ( i = 0; i < sv_maxclients->integer; i++ )
 	{
@@ -1036,12 +2485,24 @@ void SV_SendClientMessages()
 		if ( c->netchan.unsentFragments )
 		{
 			c->nextSnapshotTime = svs.time + SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
-			SV_Netchan_TransmitNextFragment( c );
+			SV_Netchan_PacedTransmitNextFragment( c );
 			continue;
 		}
 
 		// generate and send a new message
-		SV_SendClientSnapshot( c );
+		if ( parallel && ( c->state == clientState_t::CS_ACTIVE || c->state == clientState_t::CS_ZOMBIE ) )
+		{
+			snapshotJobs[ numJobs++ ].client = c;
+		}
+		else
+		{
+			SV_SendClientSnapshot( c );
+		}
+	}
+
+	if ( numJobs )
+	{
+		SV_SendQueuedSnapshots( numJobs );
 	}
 
 	// NERVE - SMF - net debugging
@@ -1096,4 +2557,21 @@ void SV_SendClientMessages()
 	}
 
 	// -NERVE - SMF
+
+	if ( !sv_showDeltaEntityStats.Get() || ++entityDeltaStatFrames >= STATFRAMES )
+	{
+		int hits = entityDeltaHits, misses = entityDeltaMisses;
+
+		if ( sv_showDeltaEntityStats.Get() )
+		{
+			Log::Notice( "entity deltas: %.3f ms per frame encoding, %d%% from the cache (%d hits, %d misses)",
+			             entityEncodeTime / 1e6 / entityDeltaStatFrames,
+			             hits + misses ? 100 * hits / ( hits + misses ) : 0, hits, misses );
+		}
+
+		entityDeltaStatFrames = 0;
+		entityDeltaHits = 0;
+		entityDeltaMisses = 0;
+		entityEncodeTime = 0;
+	}
 }
@@ -0,0 +1,192 @@
+/*
+===========================================================================
+Daemon BSD Source Code
+Copyright (c) 2024, Daemon Developers
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Daemon developers nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DAEMON DEVELOPERS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================
+*/
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "common/Common.h"
+#include "common/FileSystem.h"
+#include "server/server.h"
+
+namespace {
+
+using ::testing::ElementsAre;
+
+// A bot in plat23 with a few entities put directly in the world
+class SnapshotTest : public ::testing::Test
+{
+protected:
+    static constexpr int numEntities = 10;
+
+    sharedEntity_t entities[numEntities];
+    OpaquePlayerState ps;
+    std::vector<client_t> clients;
+    client_t *oldClients;
+    int viewCluster, viewArea;
+    vec3_t camera;
+    int cameraCluster;
+
+    void SetUp() override
+    {
+        const FS::PakInfo* pak = FS::FindPak("testdata", "src");
+        ASSERT_TRUE(pak) << "Test data not available. Please add daemon/pkg/ to the pak path";
+        FS::PakPath::LoadPak(*pak);
+        CM_LoadMap("plat23_1.13.4");
+
+        memset(&ps, 0, sizeof(ps));
+        ps.clientNum = 0;
+
+        // a viewpoint and a camera position which can't see each other
+        vec3_t mins, maxs;
+        CM_ModelBounds(CM_InlineModel(0), mins, maxs);
+        viewCluster = cameraCluster = -1;
+        for (float x = mins[0]; x < maxs[0] && cameraCluster < 0; x += 128)
+        {
+            for (float y = mins[1]; y < maxs[1] && cameraCluster < 0; y += 128)
+            {
+                for (float z = mins[2]; z < maxs[2] && cameraCluster < 0; z += 128)
+                {
+                    vec3_t point{ x, y, z };
+                    int leaf = CM_PointLeafnum(point);
+                    int cluster = CM_LeafCluster(leaf);
+                    if (cluster < 0)
+                    {
+                        continue;
+                    }
+                    if (viewCluster < 0)
+                    {
+                        viewCluster = cluster;
+                        viewArea = CM_LeafArea(leaf);
+                        VectorCopy(point, ps.origin);
+                        continue;
+                    }
+                    const byte *pvs = CM_ClusterPVS(viewCluster);
+                    if (!(pvs[cluster >> 3] & (1 << (cluster & 7))))
+                    {
+                        cameraCluster = cluster;
+                        VectorCopy(point, camera);
+                    }
+                }
+            }
+        }
+        ASSERT_GE(cameraCluster, 0);
+
+        memset(entities, 0, sizeof(entities));
+        for (int i = 0; i < numEntities; i++)
+        {
+            entities[i].s.number = i;
+        }
+
+        sv.state = serverState_t::SS_GAME;
+        sv.gentities = entities;
+        sv.gentitySize = sizeof(sharedEntity_t);
+        sv.num_entities = numEntities;
+        sv.gameClients = &ps;
+        sv.gameClientSize = sizeof(ps);
+
+        clients.resize(sv_maxclients->integer);
+        oldClients = svs.clients;
+        svs.clients = clients.data();
+        client_t &bot = clients[0];
+        bot.state = clientState_t::CS_ACTIVE;
+        bot.netchan.remoteAddress.type = netadrtype_t::NA_BOT;
+        bot.gentity = &entities[0];
+    }
+
+    void TearDown() override
+    {
+        svs.clients = oldClients;
+        sv.state = serverState_t::SS_DEAD;
+        sv.gentities = nullptr;
+        sv.num_entities = 0;
+        sv.gameClients = nullptr;
+        CM_ClearMap();
+    }
+
+    // visible from the viewpoint
+    void Place(int e, int svFlags)
+    {
+        entityShared_t &r = entities[e].r;
+        r.linked = true;
+        r.svFlags = svFlags;
+        r.originCluster = viewCluster;
+        r.numClusters = 1;
+        r.clusternums[0] = viewCluster;
+        r.areanum = r.areanum2 = viewArea;
+    }
+
+    std::vector<int> Snapshot()
+    {
+        std::vector<int> numbers;
+        SV_SendClientSnapshot(&clients[0]);
+        for (int i = 0, e; (e = SV_BotGetSnapshotEntity(0, i)) >= 0; i++)
+        {
+            numbers.push_back(e);
+        }
+        return numbers;
+    }
+};
+
+TEST_F(SnapshotTest, IgnoreBModelExtentsEntitiesAreSentAsTheyAre)
+{
+    // dummies sent themselves instead of their masters
+    Place(1, SVF_IGNOREBMODELEXTENTS | SVF_VISDUMMY);
+    entities[1].s.otherEntityNum = 2;
+    Place(2, SVF_NOCLIENT);
+    Place(3, SVF_IGNOREBMODELEXTENTS | SVF_VISDUMMY_MULTIPLE);
+    Place(4, SVF_NOCLIENT);
+    entities[4].s.otherEntityNum = 3;
+
+    // a portal whose camera view isn't added
+    Place(5, SVF_IGNOREBMODELEXTENTS | SVF_PORTAL);
+    VectorCopy(camera, entities[5].s.origin2);
+    Place(6, SVF_IGNOREBMODELEXTENTS);
+    entities[6].r.originCluster = cameraCluster;
+
+    // an ordinary dummy still sends its master
+    Place(7, SVF_VISDUMMY);
+    entities[7].s.otherEntityNum = 8;
+    Place(8, 0);
+    entities[8].r.numClusters = 0;
+
+    EXPECT_THAT(Snapshot(), ElementsAre(1, 3, 5, 8));
+}
+
+TEST_F(SnapshotTest, PortalsAddTheirCameraView)
+{
+    Place(5, SVF_PORTAL);
+    VectorCopy(camera, entities[5].s.origin2);
+    Place(6, SVF_IGNOREBMODELEXTENTS);
+    entities[6].r.originCluster = cameraCluster;
+
+    EXPECT_THAT(Snapshot(), ElementsAre(5, 6));
+}
+
+} // namespace
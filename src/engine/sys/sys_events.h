@@ -137,8 +137,9 @@ public:
 
     const netadr_t adr;
     const std::vector<byte> data;
-    PacketEvent(const netadr_t& adr, const byte* dataPtr, size_t dataLen):
-        EventBase(ClassType()), adr(adr), data(dataPtr, dataPtr + dataLen) {}
+    const int time; // Sys::Milliseconds() when the packet was read from the socket
+    PacketEvent(const netadr_t& adr, const byte* dataPtr, size_t dataLen, int time):
+        EventBase(ClassType()), adr(adr), data(dataPtr, dataPtr + dataLen), time(time) {}
 };
 
 class FocusEvent: public EventBase {
@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <engine/server/sg_msgdef.h>
 #include <shared/VMMain.h>
+#include "sg_api.h"
 
 IPC::SharedMemory shmRegion;
 
@@ -49,6 +50,7 @@ void trap_LocateGameData(int numGEntities, int sizeofGEntity_t, int sizeofGClien
 void trap_DropClient(int clientNum, const char *reason)
 {
     VM::SendMsg<DropClientMsg>(clientNum, reason);
+    SG_ClientThinkBatchDisconnect(clientNum);
 }
 
 void trap_SendServerCommand(int clientNum, const char *text)
@@ -98,9 +100,83 @@ void trap_GetServerinfo(char *buffer, int bufferSize)
     Q_strncpyz(buffer, res.c_str(), bufferSize);
 }
 
+// The usercmd being run by SG_ClientThinkBatch, which the engine has already sent
+static int batchThinkClient = -1;
+static const usercmd_t *batchThinkCmd;
+
+// The clients disconnected while SG_ClientThinkBatch runs, which may be nested
+// when the engine flushes the usercmds queued meanwhile
+static int batchThinkDepth;
+static std::vector<int> batchDisconnectedClients;
+
+// The latest usercmds, published by the engine in shared memory
+static IPC::SharedMemory usercmdRegion;
+static const sharedUsercmds_t *sharedUsercmds;
+
 void trap_GetUsercmd(int clientNum, usercmd_t *cmd)
 {
-    VM::SendMsg<GetUsercmdMsg>(clientNum, *cmd);
+    if (clientNum == batchThinkClient) {
+        *cmd = *batchThinkCmd;
+        return;
+    }
+
+    if (!sharedUsercmds) {
+        usercmdRegion = IPC::SharedMemory::Create(sizeof(sharedUsercmds_t));
+        VM::SendMsg<LocateUsercmdsMsg>(usercmdRegion);
+        sharedUsercmds = static_cast<const sharedUsercmds_t*>(usercmdRegion.GetBase());
+    }
+
+    // bad client numbers are for the engine to complain about
+    if (clientNum < 0 || clientNum >= MAX_CLIENTS) {
+        VM::SendMsg<GetUsercmdMsg>(clientNum, *cmd);
+        return;
+    }
+
+    const sharedUsercmd_t& shared = sharedUsercmds->clients[clientNum];
+    uint32_t sequence;
+
+    do {
+        sequence = shared.sequence.load(std::memory_order_acquire);
+        *cmd = shared.cmd;
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((sequence & 1) || shared.sequence.load(std::memory_order_relaxed) != sequence);
+}
+
+void trap_EnableClientThinkBatch()
+{
+    VM::SendMsg<EnableClientThinkBatchMsg>();
+}
+
+void SG_ClientThinkBatch(const std::vector<int>& clientNums, const std::vector<usercmd_t>& cmds, void (*think)(int clientNum))
+{
+    int outerClient = batchThinkClient;
+    const usercmd_t* outerCmd = batchThinkCmd;
+    batchThinkDepth++;
+
+    for (size_t i = 0; i < clientNums.size() && i < cmds.size(); i++) {
+        // the usercmds of a client dropped by an earlier one are not for its slot anymore
+        if (std::find(batchDisconnectedClients.begin(), batchDisconnectedClients.end(), clientNums[i]) != batchDisconnectedClients.end()) {
+            continue;
+        }
+
+        batchThinkClient = clientNums[i];
+        batchThinkCmd = &cmds[i];
+        think(clientNums[i]);
+    }
+
+    batchThinkClient = outerClient;
+    batchThinkCmd = outerCmd;
+
+    if (--batchThinkDepth == 0) {
+        batchDisconnectedClients.clear();
+    }
+}
+
+void SG_ClientThinkBatchDisconnect(int clientNum)
+{
+    if (batchThinkDepth > 0) {
+        batchDisconnectedClients.push_back(clientNum);
+    }
 }
 
 bool trap_GetEntityToken(char *buffer, int bufferSize)
@@ -53,5 +53,14 @@ int              trap_RSA_GenerateMessage( const char *public_key, char *clearte
 void             trap_GenFingerprint( const char *pubkey, int size, char *buffer, int bufsize );
 void             trap_GetPlayerPubkey( int clientNum, char *pubkey, int size );
 void             trap_GetTimeString( char *buffer, int size, const char *format, const qtime_t *tm );
+void             trap_EnableClientThinkBatch();
+
+// Runs think for each usercmd of a GAME_CLIENT_THINK_BATCH, trap_GetUsercmd
+// returns the usercmd being run without asking the engine
+void             SG_ClientThinkBatch( const std::vector<int> &clientNums, const std::vector<usercmd_t> &cmds, void ( *think )( int clientNum ) );
+
+// Makes SG_ClientThinkBatch skip the remaining usercmds of a client, to be called
+// by the handler of GAME_CLIENT_DISCONNECT. trap_DropClient already calls it.
+void             SG_ClientThinkBatchDisconnect( int clientNum );
 
 #endif